@@ -2,6 +2,7 @@
 
 #define DEVELOPMENT_MODE
 #define ENABLE_ASSERTS
+#define ENABLE_CPU_PROFILER
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -28,6 +29,9 @@ inline T min(T a, T b) { return b < a ? b : a; }
 template <typename T, typename... Args>
 inline T min(T a, T b, Args... args) { return min(min(a, b), min(args...)); }
 
+template <typename T>
+inline T divideRoundingUp(T a, T b) { return (a + b - 1) / b; }
+
 #ifdef DEVELOPMENT_MODE
 static LiteralString SHADERS_FOLDER = SHADERS_DIR;
 #endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "string_pool.h"
+#include <cstring>
+#include <string>
+
+// Binary files written and read back by the engine itself, values are stored in native byte order
+struct BinaryWriter
+{
+    std::string m_data;
+
+    void writeU32(u32 _value) { m_data.append((const char*)&_value, sizeof(_value)); }
+    void writeU64(u64 _value) { m_data.append((const char*)&_value, sizeof(_value)); }
+
+    void writeString(LiteralString _str)
+    {
+        u32 length = (u32)strlen(_str);
+        writeU32(length);
+        m_data.append(_str, length);
+    }
+};
+
+// Any read past the end flags the whole stream as invalid
+struct BinaryReader
+{
+    const char* m_cursor;
+    const char* m_end;
+    bool m_valid = true;
+
+    bool atEnd() const { return m_cursor == m_end; }
+
+    u32 readU32()
+    {
+        u32 value = 0;
+        readBytes(&value, sizeof(value));
+        return value;
+    }
+
+    u64 readU64()
+    {
+        u64 value = 0;
+        readBytes(&value, sizeof(value));
+        return value;
+    }
+
+    // Interned, so the strings outlive the data they were read from
+    LiteralString readString()
+    {
+        u32 length = readU32();
+        if (!m_valid || m_end - m_cursor < (ptrdiff_t)length) {
+            m_valid = false;
+            return "";
+        }
+        LiteralString str = internString(std::string_view(m_cursor, length));
+        m_cursor += length;
+        return str;
+    }
+
+private:
+    void readBytes(void* _dst, size_t _size)
+    {
+        if (m_end - m_cursor < (ptrdiff_t)_size) {
+            m_valid = false;
+            return;
+        }
+        memcpy(_dst, m_cursor, _size);
+        m_cursor += _size;
+    }
+};
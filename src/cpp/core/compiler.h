@@ -16,6 +16,8 @@
 #endif
 
 #define STRINGIFY(x) #x
+#define CONCAT_IMPL(a, b) a##b
+#define CONCAT(a, b) CONCAT_IMPL(a, b)
 #define ALIGNED_TYPE(alignment) _declspec(align(alignment))
 #define ALIGNED_TYPE16  ALIGNED_TYPE(16)
 #define ALIGNED_TYPE256 ALIGNED_TYPE(256)
@@ -0,0 +1,126 @@
+#include "common.h"
+
+#include "cpu_profiler.h"
+#include <chrono>
+#include <fstream>
+
+thread_local CpuProfiler::ThreadBuffer* CpuProfiler::s_threadBuffer = nullptr;
+static const auto C_ProfilerEpoch = std::chrono::steady_clock::now();
+
+CpuProfiler::CpuProfiler(u64 _firstFrame, u64 _frameCount, std::string _outputPath)
+    : m_firstFrame(_firstFrame)
+    , m_frameCount(_frameCount)
+    , m_outputPath(std::move(_outputPath))
+{
+}
+
+CpuProfiler::~CpuProfiler()
+{
+    // Write whatever was captured if the app exits inside the capture window
+    if (m_capturing)
+        writeCapture();
+}
+
+void CpuProfiler::beginFrame(u64 _frameNum)
+{
+    if (!m_frameCount || m_written)
+        return;
+
+    if (_frameNum == m_firstFrame) {
+        logInfo("Cpu profiler capturing frames {} to {}", m_firstFrame, m_firstFrame + m_frameCount - 1);
+        m_capturing = true;
+    } else if (_frameNum == m_firstFrame + m_frameCount) {
+        writeCapture();
+    }
+}
+
+bool CpuProfiler::isCapturing()
+{
+    CpuProfiler* profiler = globals::getPtr<CpuProfiler>();
+    return profiler && profiler->m_capturing.load(std::memory_order_relaxed);
+}
+
+u64 CpuProfiler::getTimestampNs()
+{
+    // Never 0, so scopes can use 0 as "not captured"
+    return 1 + (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - C_ProfilerEpoch).count();
+}
+
+void CpuProfiler::recordZone(LiteralString _name, u64 _startNs, u64 _endNs)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    if (!buffer)
+        return;
+
+    std::lock_guard<std::mutex> lock(buffer->m_mutex);
+    buffer->m_zones.push_back({ _name, _startNs, _endNs });
+}
+
+void CpuProfiler::setThreadName(std::string _name)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    if (!buffer)
+        return;
+
+    std::lock_guard<std::mutex> lock(buffer->m_mutex);
+    buffer->m_name = std::move(_name);
+}
+
+CpuProfiler::ThreadBuffer* CpuProfiler::getThreadBuffer()
+{
+    if (s_threadBuffer)
+        return s_threadBuffer;
+
+    CpuProfiler* profiler = globals::getPtr<CpuProfiler>();
+    if (!profiler)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(profiler->m_threadsMutex);
+    profiler->m_threads.push_back(std::make_unique<ThreadBuffer>());
+    s_threadBuffer = profiler->m_threads.back().get();
+    s_threadBuffer->m_threadId = (u32)profiler->m_threads.size();
+    s_threadBuffer->m_zones.reserve(4096);
+    return s_threadBuffer;
+}
+
+void CpuProfiler::writeCapture()
+{
+    m_capturing = false;
+    m_written = true;
+
+    std::ofstream file(m_outputPath, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        logError("Failed to open {} to write the cpu profiler capture", m_outputPath);
+        return;
+    }
+
+    u64 zoneCount = 0;
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+
+    std::lock_guard<std::mutex> threadsLock(m_threadsMutex);
+    for (unique_ptr<ThreadBuffer>& thread : m_threads) {
+        std::lock_guard<std::mutex> lock(thread->m_mutex);
+
+        if (!thread->m_name.empty()) {
+            file << (first ? "" : ",\n");
+            file << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                thread->m_threadId, thread->m_name);
+            first = false;
+        }
+
+        // Timestamps are in microseconds
+        for (const Zone& zone : thread->m_zones) {
+            file << (first ? "" : ",\n");
+            file << fmt::format("{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                zone.m_name, thread->m_threadId, zone.m_startNs * 1e-3, (zone.m_endNs - zone.m_startNs) * 1e-3);
+            first = false;
+        }
+        zoneCount += thread->m_zones.size();
+        thread->m_zones.clear();
+        thread->m_zones.shrink_to_fit();
+    }
+
+    file << "\n]}\n";
+    logInfo("Cpu profiler wrote {} zones to {}", zoneCount, m_outputPath);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#ifdef ENABLE_CPU_PROFILER
+#define PROFILE_SCOPE(name) CpuProfileScope CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) CpuProfiler::setThreadName(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_THREAD_NAME(name)
+#endif
+
+// Records scoped zones into per-thread buffers for a window of frames
+// and writes them as a chrome://tracing / Perfetto json file.
+class CpuProfiler
+{
+public:
+    // Frames [_firstFrame, _firstFrame + _frameCount) are captured, nothing is captured if _frameCount is 0
+    CpuProfiler(u64 _firstFrame, u64 _frameCount, std::string _outputPath);
+    ~CpuProfiler();
+
+    // Called by the main thread before each frame, starts and stops the capture
+    void beginFrame(u64 _frameNum);
+
+    static bool isCapturing();
+    static u64 getTimestampNs();
+    static void recordZone(LiteralString _name, u64 _startNs, u64 _endNs);
+    static void setThreadName(std::string _name);
+
+private:
+    struct Zone
+    {
+        LiteralString m_name;
+        u64 m_startNs;
+        u64 m_endNs;
+    };
+
+    struct ThreadBuffer
+    {
+        u32 m_threadId;
+        std::string m_name;
+        // Only contended while the capture is written out
+        std::mutex m_mutex;
+        vector<Zone> m_zones;
+    };
+
+    u64 m_firstFrame;
+    u64 m_frameCount;
+    std::string m_outputPath;
+    std::atomic<bool> m_capturing = false;
+    bool m_written = false;
+
+    std::mutex m_threadsMutex;
+    vector<unique_ptr<ThreadBuffer>> m_threads;
+
+    static thread_local ThreadBuffer* s_threadBuffer;
+
+    static ThreadBuffer* getThreadBuffer();
+    void writeCapture();
+};
+
+class CpuProfileScope
+{
+public:
+    CpuProfileScope(LiteralString _name)
+        : m_name(_name)
+        , m_startNs(CpuProfiler::isCapturing() ? CpuProfiler::getTimestampNs() : 0) {};
+    ~CpuProfileScope()
+    {
+        if (m_startNs)
+            CpuProfiler::recordZone(m_name, m_startNs, CpuProfiler::getTimestampNs());
+    }
+
+private:
+    LiteralString m_name;
+    u64 m_startNs;
+};
@@ -0,0 +1,162 @@
+#include "common.h"
+
+#include "file_watcher.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#ifdef _WIN32
+
+FileWatcher::FileWatcher(const std::string& _directory)
+    : m_directory(_directory)
+{
+    m_directoryHandle = ::CreateFileA(m_directory.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (m_directoryHandle == INVALID_HANDLE_VALUE) {
+        logError("Can't watch {} for changes", m_directory);
+        m_directoryHandle = nullptr;
+        return;
+    }
+
+    m_stopEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    m_thread = std::thread([this]() { watchLoop(); });
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (m_thread.joinable()) {
+        m_exiting = true;
+        ::SetEvent(m_stopEvent);
+        m_thread.join();
+    }
+    if (m_stopEvent)
+        ::CloseHandle(m_stopEvent);
+    if (m_directoryHandle)
+        ::CloseHandle(m_directoryHandle);
+}
+
+void FileWatcher::watchLoop()
+{
+    PROFILE_THREAD_NAME("file watcher");
+
+    alignas(DWORD) u8 buffer[16 * 1024];
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+    while (!m_exiting) {
+        ::ResetEvent(overlapped.hEvent);
+        if (!::ReadDirectoryChangesW(m_directoryHandle, buffer, sizeof(buffer), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, nullptr, &overlapped, nullptr)) {
+            logError("Stopped watching {}", m_directory);
+            break;
+        }
+
+        HANDLE events[] = { overlapped.hEvent, m_stopEvent };
+        if (::WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            ::CancelIoEx(m_directoryHandle, &overlapped);
+            DWORD unused;
+            ::GetOverlappedResult(m_directoryHandle, &overlapped, &unused, TRUE);
+            break;
+        }
+
+        DWORD bytes = 0;
+        if (!::GetOverlappedResult(m_directoryHandle, &overlapped, &bytes, FALSE) || !bytes)
+            continue;
+
+        for (u8* it = buffer;;) {
+            FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)it;
+            if (info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED
+                || info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                int wideLength = (int)(info->FileNameLength / sizeof(WCHAR));
+                int size = ::WideCharToMultiByte(CP_UTF8, 0, info->FileName, wideLength, nullptr, 0, nullptr, nullptr);
+                std::string fileName(size, 0);
+                ::WideCharToMultiByte(CP_UTF8, 0, info->FileName, wideLength, &fileName[0], size, nullptr, nullptr);
+                addChange(std::move(fileName));
+            }
+
+            if (!info->NextEntryOffset)
+                break;
+            it += info->NextEntryOffset;
+        }
+    }
+
+    ::CloseHandle(overlapped.hEvent);
+}
+
+#else
+
+FileWatcher::FileWatcher(const std::string& _directory)
+    : m_directory(_directory)
+{
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // Editors either rewrite the file in place or save to a temp file and rename it over the original
+    if (m_inotifyFd < 0 || inotify_add_watch(m_inotifyFd, m_directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        logError("Can't watch {} for changes: {}", m_directory, strerror(errno));
+        return;
+    }
+
+    m_thread = std::thread([this]() { watchLoop(); });
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (m_thread.joinable()) {
+        m_exiting = true;
+        m_thread.join();
+    }
+    if (m_inotifyFd >= 0)
+        close(m_inotifyFd);
+}
+
+void FileWatcher::watchLoop()
+{
+    PROFILE_THREAD_NAME("file watcher");
+
+    // Wake up regularly to notice m_exiting
+    const int C_PollTimeoutMs = 100;
+    alignas(inotify_event) u8 buffer[16 * 1024];
+
+    while (!m_exiting) {
+        pollfd fd = { m_inotifyFd, POLLIN, 0 };
+        if (poll(&fd, 1, C_PollTimeoutMs) <= 0)
+            continue;
+
+        ssize_t bytes = read(m_inotifyFd, buffer, sizeof(buffer));
+        if (bytes <= 0)
+            continue;
+
+        for (u8* it = buffer; it < buffer + bytes;) {
+            const inotify_event* event = (const inotify_event*)it;
+            if (event->len)
+                addChange(event->name);
+            it += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+#endif
+
+void FileWatcher::addChange(std::string _fileName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (std::find(m_changes.begin(), m_changes.end(), _fileName) == m_changes.end())
+        m_changes.push_back(std::move(_fileName));
+}
+
+vector<std::string> FileWatcher::consumeChanges()
+{
+    vector<std::string> changes;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    changes.swap(m_changes);
+    return changes;
+}
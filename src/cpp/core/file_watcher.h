@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Reports files modified inside a directory, non recursive. Notifications are gathered on a
+// background thread so polling for changes never blocks.
+class FileWatcher
+{
+public:
+    FileWatcher(const std::string& _directory);
+    ~FileWatcher();
+
+    bool isWatching() const { return m_thread.joinable(); }
+
+    // Names relative to the watched directory of the files written since the last call, without duplicates
+    vector<std::string> consumeChanges();
+
+private:
+    std::string m_directory;
+    std::thread m_thread;
+    std::atomic<bool> m_exiting = false;
+
+    std::mutex m_mutex;
+    vector<std::string> m_changes;
+
+#ifdef _WIN32
+    void* m_directoryHandle = nullptr;
+    void* m_stopEvent = nullptr;
+#else
+    int m_inotifyFd = -1;
+#endif
+
+    void watchLoop();
+    void addChange(std::string _fileName);
+};
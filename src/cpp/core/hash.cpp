@@ -0,0 +1,87 @@
+#include "common.h"
+
+#include "hash.h"
+#include <cstring>
+#include <string>
+
+static FORCE_INLINE u64 rotl64(u64 _x, u32 _r)
+{
+    return (_x << _r) | (_x >> (64 - _r));
+}
+
+static FORCE_INLINE u64 fmix64(u64 _k)
+{
+    _k ^= _k >> 33;
+    _k *= 0xff51afd7ed558ccdull;
+    _k ^= _k >> 33;
+    _k *= 0xc4ceb9fe1a85ec53ull;
+    _k ^= _k >> 33;
+    return _k;
+}
+
+// https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp, MurmurHash3_x64_128
+Hash128 hash128(const void* _data, size_t _size, u64 _seed)
+{
+    const u8* data = (const u8*)_data;
+    const size_t blockCount = _size / 16;
+
+    u64 h1 = _seed;
+    u64 h2 = _seed;
+    const u64 c1 = 0x87c37b91114253d5ull;
+    const u64 c2 = 0x4cf5ad432745937full;
+
+    for (size_t i = 0; i < blockCount; ++i) {
+        u64 k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(k1));
+        memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const u8* tail = data + blockCount * 16;
+    u64 k1 = 0;
+    u64 k2 = 0;
+
+    switch (_size & 15) {
+    case 15: k2 ^= ((u64)tail[14]) << 48; [[fallthrough]];
+    case 14: k2 ^= ((u64)tail[13]) << 40; [[fallthrough]];
+    case 13: k2 ^= ((u64)tail[12]) << 32; [[fallthrough]];
+    case 12: k2 ^= ((u64)tail[11]) << 24; [[fallthrough]];
+    case 11: k2 ^= ((u64)tail[10]) << 16; [[fallthrough]];
+    case 10: k2 ^= ((u64)tail[9]) << 8; [[fallthrough]];
+    case 9:
+        k2 ^= ((u64)tail[8]) << 0;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        [[fallthrough]];
+    case 8: k1 ^= ((u64)tail[7]) << 56; [[fallthrough]];
+    case 7: k1 ^= ((u64)tail[6]) << 48; [[fallthrough]];
+    case 6: k1 ^= ((u64)tail[5]) << 40; [[fallthrough]];
+    case 5: k1 ^= ((u64)tail[4]) << 32; [[fallthrough]];
+    case 4: k1 ^= ((u64)tail[3]) << 24; [[fallthrough]];
+    case 3: k1 ^= ((u64)tail[2]) << 16; [[fallthrough]];
+    case 2: k1 ^= ((u64)tail[1]) << 8; [[fallthrough]];
+    case 1:
+        k1 ^= ((u64)tail[0]) << 0;
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= _size;
+    h2 ^= _size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    return { h1, h2 };
+}
+
+std::string Hash128::toString() const
+{
+    return fmt::format("{:016x}{:016x}", m_high, m_low);
+}
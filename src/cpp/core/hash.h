@@ -19,3 +19,28 @@ inline size_t hash_literal_string(LiteralString s)
 {
     return std::hash<std::string_view>()(std::string_view(s, std::strlen(s)));
 }
+
+// 128 bit MurmurHash3, for content addressing where collisions must practically never happen
+struct Hash128
+{
+    u64 m_low = 0;
+    u64 m_high = 0;
+
+    bool operator==(const Hash128& _o) const { return m_low == _o.m_low && m_high == _o.m_high; }
+    bool operator!=(const Hash128& _o) const { return !(*this == _o); }
+
+    // 32 hex characters
+    std::string toString() const;
+};
+
+Hash128 hash128(const void* _data, size_t _size, u64 _seed = 0);
+
+namespace std {
+template <>
+struct hash<Hash128> {
+    std::size_t operator()(const Hash128& _h) const noexcept
+    {
+        return (std::size_t)_h.m_low;
+    }
+};
+}
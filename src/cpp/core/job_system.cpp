@@ -0,0 +1,308 @@
+#include "common.h"
+
+#include "job_system.h"
+#include "cpu_profiler.h"
+#include <chrono>
+#include <cmath>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Which system the current thread belongs to, a thread takes part in at most one at a time
+static thread_local JobSystem* s_currentSystem = nullptr;
+static thread_local u32 s_currentThreadIndex = ~0u;
+
+// https://fzn.fr/readings/ppopp13.pdf, Correct and Efficient Work-Stealing for Weak Memory Models
+bool JobSystem::WorkStealingDeque::push(JobEntry* _entry)
+{
+    i64 bottom = m_bottom.load(std::memory_order_relaxed);
+    i64 top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= C_Capacity)
+        return false;
+
+    m_entries[bottom & (C_Capacity - 1)].store(_entry, std::memory_order_relaxed);
+    m_bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+JobSystem::JobEntry* JobSystem::WorkStealingDeque::pop()
+{
+    i64 bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 top = m_top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    JobEntry* entry = m_entries[bottom & (C_Capacity - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // Last entry, race thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            entry = nullptr;
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return entry;
+}
+
+JobSystem::JobEntry* JobSystem::WorkStealingDeque::steal()
+{
+    i64 top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+        return nullptr;
+
+    JobEntry* entry = m_entries[top & (C_Capacity - 1)].load(std::memory_order_acquire);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return entry;
+}
+
+JobSystem::JobSystem(u32 _workerCount, bool _pinThreads)
+{
+    if (!_workerCount)
+        _workerCount = max(2u, std::thread::hardware_concurrency()) - 1;
+
+    m_previousSystem = s_currentSystem;
+    m_previousThreadIndex = s_currentThreadIndex;
+    s_currentSystem = this;
+    s_currentThreadIndex = 0;
+    if (_pinThreads)
+        pinCurrentThread(0);
+
+    // All deques exist before any worker starts stealing
+    m_workers.resize(_workerCount);
+    for (unique_ptr<Worker>& worker : m_workers)
+        worker = std::make_unique<Worker>();
+    for (u32 i = 0; i < _workerCount; ++i)
+        m_workers[i]->m_thread = std::thread([this, i, _pinThreads]() { workerLoop(i + 1, _pinThreads); });
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_exiting = true;
+    }
+    m_wakeUp.notify_all();
+
+    for (unique_ptr<Worker>& worker : m_workers)
+        worker->m_thread.join();
+
+    s_currentSystem = m_previousSystem;
+    s_currentThreadIndex = m_previousThreadIndex;
+}
+
+u32 JobSystem::getCurrentThreadIndex() const
+{
+    return s_currentSystem == this ? s_currentThreadIndex : ~0u;
+}
+
+void JobSystem::run(Job _job, JobCounter* _counter, JobPriority _priority)
+{
+    JobEntry* entry = new JobEntry { std::move(_job), _counter };
+    if (_counter)
+        _counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    u32 threadIndex = getCurrentThreadIndex();
+    if (_priority == JobPriority::Background) {
+        std::lock_guard<std::mutex> lock(m_sharedMutex);
+        m_backgroundQueue.push_back(entry);
+    } else if (threadIndex != ~0u && threadIndex > 0) {
+        if (!m_workers[threadIndex - 1]->m_deque.push(entry)) {
+            execute(entry, threadIndex);
+            return;
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(m_sharedMutex);
+        m_sharedQueue.push_back(entry);
+    }
+
+    // Sleepers check m_queuedJobs under m_sleepMutex, taking it guarantees the notification isn't lost
+    m_queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+    if (m_sleepingWorkers.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wakeUp.notify_one();
+    }
+}
+
+JobSystem::JobEntry* JobSystem::findJob(u32 _threadIndex, bool _allowBackground)
+{
+    JobEntry* entry = nullptr;
+
+    // Own work first, newest first since its data is most likely still in cache
+    if (_threadIndex > 0)
+        entry = m_workers[_threadIndex - 1]->m_deque.pop();
+
+    if (!entry) {
+        std::lock_guard<std::mutex> lock(m_sharedMutex);
+        if (!m_sharedQueue.empty()) {
+            entry = m_sharedQueue.front();
+            m_sharedQueue.pop_front();
+        }
+    }
+
+    // Steal the oldest, and so usually largest, job of the other workers starting from a different victim each time
+    for (u32 i = 0, count = (u32)m_workers.size(); !entry && i < count; ++i) {
+        u32 victim = (_threadIndex + i) % count;
+        if (victim + 1 != _threadIndex)
+            entry = m_workers[victim]->m_deque.steal();
+    }
+
+    if (!entry && _allowBackground) {
+        std::lock_guard<std::mutex> lock(m_sharedMutex);
+        if (!m_backgroundQueue.empty()) {
+            entry = m_backgroundQueue.front();
+            m_backgroundQueue.pop_front();
+        }
+    }
+
+    if (entry)
+        m_queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    return entry;
+}
+
+void JobSystem::execute(JobEntry* _entry, u32 _threadIndex)
+{
+    _entry->m_job(_threadIndex);
+    if (_entry->m_counter)
+        _entry->m_counter->m_pending.fetch_sub(1, std::memory_order_release);
+    delete _entry;
+}
+
+void JobSystem::wait(JobCounter& _counter)
+{
+    u32 threadIndex = getCurrentThreadIndex();
+    while (!_counter.isDone()) {
+        // Never a background job, it could keep the waiting thread busy long after _counter is done
+        JobEntry* entry = threadIndex != ~0u ? findJob(threadIndex, false) : nullptr;
+        if (entry)
+            execute(entry, threadIndex);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::workerLoop(u32 _threadIndex, bool _pin)
+{
+    s_currentSystem = this;
+    s_currentThreadIndex = _threadIndex;
+    if (_pin)
+        pinCurrentThread(_threadIndex);
+    PROFILE_THREAD_NAME(fmt::format("worker {}", _threadIndex));
+
+    while (true) {
+        if (JobEntry* entry = findJob(_threadIndex, true)) {
+            execute(entry, _threadIndex);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+        m_wakeUp.wait(lock, [this]() { return m_exiting || m_queuedJobs.load(std::memory_order_seq_cst) > 0; });
+        m_sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+        if (m_exiting)
+            return;
+    }
+}
+
+void JobSystem::parallelFor(u32 _count, u32 _grainSize, const IndexedJob& _job)
+{
+    if (!_count)
+        return;
+
+    u32 threadIndex = getCurrentThreadIndex();
+    JobCounter counter;
+    if (threadIndex == ~0u) {
+        // Outside threads can't run the first half themselves
+        run([&](u32 _threadIndex) { splitRange(0, _count, _grainSize, _job, counter, _threadIndex); }, &counter);
+    } else {
+        splitRange(0, _count, _grainSize, _job, counter, threadIndex);
+    }
+    wait(counter);
+}
+
+void JobSystem::splitRange(u32 _begin, u32 _end, u32 _grainSize, const IndexedJob& _job, JobCounter& _counter, u32 _threadIndex)
+{
+    // Hand off the upper half until the range is small enough, thieves take the biggest remaining pieces
+    while (_end - _begin > max(1u, _grainSize)) {
+        u32 middle = _begin + (_end - _begin) / 2;
+        run([=, &_job, &_counter](u32 _stolenBy) { splitRange(middle, _end, _grainSize, _job, _counter, _stolenBy); }, &_counter);
+        _end = middle;
+    }
+
+    for (u32 i = _begin; i < _end; ++i)
+        _job(i, _threadIndex);
+}
+
+void JobSystem::pinCurrentThread(u32 _core)
+{
+    u32 coreCount = max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+    ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << (_core % coreCount));
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(_core % coreCount, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void JobSystem::benchmark(bool _pinThreads)
+{
+    // Fine: many cheap indices, dominated by scheduling overhead. Coarse: few expensive ones, dominated by balance
+    struct Workload
+    {
+        LiteralString m_name;
+        u32 m_count;
+        u32 m_grainSize;
+        u32 m_iterations;
+    };
+    static const Workload C_Workloads[] = {
+        { "fine", 1 << 20, 256, 16 },
+        { "coarse", 256, 1, 40000 },
+    };
+    static constexpr u32 C_Repeats = 8;
+
+    u32 maxThreads = max(1u, std::thread::hardware_concurrency());
+    for (const Workload& workload : C_Workloads) {
+        vector<float> results(workload.m_count);
+        double singleThreadMs = 0.0;
+
+        for (u32 threads = 1; threads <= maxThreads; ++threads) {
+            // A system with a single thread still needs one worker, the creating thread only runs jobs while waiting
+            JobSystem jobSystem(max(1u, threads - 1), _pinThreads);
+
+            auto start = std::chrono::steady_clock::now();
+            for (u32 r = 0; r < C_Repeats; ++r) {
+                auto work = [&](u32 _index, u32) {
+                    float value = (float)_index;
+                    for (u32 i = 0; i < workload.m_iterations; ++i)
+                        value = std::sqrt(value + (float)i);
+                    results[_index] = value;
+                };
+                if (threads == 1) {
+                    for (u32 i = 0; i < workload.m_count; ++i)
+                        work(i, 0);
+                } else {
+                    jobSystem.parallelFor(workload.m_count, workload.m_grainSize, work);
+                }
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            double ms = elapsed.count() / C_Repeats;
+            if (threads == 1)
+                singleThreadMs = ms;
+
+            logInfo("Jobs {}: {} indices on {} threads in {:.3f} ms, {:.2f}x speedup",
+                workload.m_name, workload.m_count, threads, ms, singleThreadMs / ms);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Tracks unfinished jobs. Every job run with a counter increments it when scheduled and decrements it once
+// done, jobs can run children on their parent's counter so waiting on it covers the whole tree.
+class JobCounter
+{
+public:
+    bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<u32> m_pending = 0;
+};
+
+// Normal jobs are short and may be run by any thread waiting on a counter. Background jobs are long or block, like
+// shader compilation and pipeline creation, and only idle workers run them so a wait never picks one up.
+enum class JobPriority : u8
+{
+    Normal,
+    Background
+};
+
+// Work-stealing scheduler. Each worker owns a Chase-Lev deque, it pushes and pops jobs at the bottom while idle
+// workers steal from the top. Threads that aren't workers submit through a shared FIFO queue, background jobs
+// go to their own FIFO queue whichever thread submits them.
+// The thread creating the JobSystem participates as thread 0 whenever it waits, workers are threads 1 to N.
+class JobSystem
+{
+public:
+    // Receives the index of the thread running it, in [0, getThreadCount())
+    using Job = std::function<void(u32 _threadIndex)>;
+    using IndexedJob = std::function<void(u32 _index, u32 _threadIndex)>;
+
+    // 0 uses one worker per hardware thread besides the creating thread.
+    // Pinning binds thread i to core i % core count.
+    JobSystem(u32 _workerCount = 0, bool _pinThreads = false);
+    ~JobSystem();
+
+    // Workers plus the creating thread, the bound for per-thread resources indexed by _threadIndex
+    u32 getThreadCount() const { return (u32)m_workers.size() + 1; }
+    // Index of the calling thread in this system, ~0u if it doesn't participate
+    u32 getCurrentThreadIndex() const;
+
+    void run(Job _job, JobCounter* _counter = nullptr, JobPriority _priority = JobPriority::Normal);
+
+    // Runs other normal jobs until _counter is done. Threads outside the system can't run jobs and just yield
+    void wait(JobCounter& _counter);
+
+    // Calls _job for every index in [0, _count) and returns once all are done. The range is split in halves down
+    // to _grainSize indices, idle threads steal the largest halves first. The calling thread takes part.
+    void parallelFor(u32 _count, u32 _grainSize, const IndexedJob& _job);
+
+    // Logs how fine and coarse grained parallelFor scale from 1 to the hardware thread count
+    static void benchmark(bool _pinThreads);
+
+private:
+    struct JobEntry
+    {
+        Job m_job;
+        JobCounter* m_counter;
+    };
+
+    // Fixed capacity, push fails when full and the job runs inline instead
+    class WorkStealingDeque
+    {
+    public:
+        bool push(JobEntry* _entry);
+        // Owner only
+        JobEntry* pop();
+        // Any thread
+        JobEntry* steal();
+
+    private:
+        static constexpr i64 C_Capacity = 4096;
+        std::atomic<i64> m_top = 0;
+        std::atomic<i64> m_bottom = 0;
+        std::atomic<JobEntry*> m_entries[C_Capacity];
+    };
+
+    struct Worker
+    {
+        std::thread m_thread;
+        WorkStealingDeque m_deque;
+    };
+
+    // m_workers[i] runs as thread i + 1. The creating thread has no deque and submits to the shared queue
+    vector<unique_ptr<Worker>> m_workers;
+
+    std::mutex m_sharedMutex;
+    std::deque<JobEntry*> m_sharedQueue;
+    std::deque<JobEntry*> m_backgroundQueue;
+
+    // Queued and not yet picked up, workers sleep while it's 0
+    std::atomic<u32> m_queuedJobs = 0;
+    std::atomic<u32> m_sleepingWorkers = 0;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    std::atomic<bool> m_exiting = false;
+
+    // The creating thread's previous system, restored on destruction so benchmarks can create temporary systems
+    JobSystem* m_previousSystem;
+    u32 m_previousThreadIndex;
+
+    void workerLoop(u32 _threadIndex, bool _pin);
+    // Background jobs are only taken once no normal job is left, and only when _allowBackground is set
+    JobEntry* findJob(u32 _threadIndex, bool _allowBackground);
+    void execute(JobEntry* _entry, u32 _threadIndex);
+    void splitRange(u32 _begin, u32 _end, u32 _grainSize, const IndexedJob& _job, JobCounter& _counter, u32 _threadIndex);
+    static void pinCurrentThread(u32 _core);
+};
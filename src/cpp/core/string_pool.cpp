@@ -0,0 +1,16 @@
+#include "common.h"
+
+#include "string_pool.h"
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+LiteralString internString(std::string_view _str)
+{
+    // Node based so the strings never move, intentionally leaked so the pointers stay valid during shutdown
+    static std::mutex* s_mutex = new std::mutex;
+    static std::unordered_set<std::string>* s_strings = new std::unordered_set<std::string>;
+
+    std::lock_guard<std::mutex> lock(*s_mutex);
+    return s_strings->emplace(_str).first->c_str();
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string_view>
+
+// Returns a copy of _str that lives until exit, equal strings always return the same pointer.
+// For names loaded at runtime that have to be stored where string literals are expected. Thread-safe.
+LiteralString internString(std::string_view _str);
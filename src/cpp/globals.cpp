@@ -1,44 +1,101 @@
 #include "common.h"
 
 #include "globals.h"
+#include "settings.h"
+#include "core/job_system.h"
+#include "core/cpu_profiler.h"
 #include "logging/logger.h"
 #include "window/window.h"
 #include "rendering/driver.h"
 #include "rendering/renderer.h"
+#include "rendering/deferred_release.h"
+#include "rendering/upload_manager.h"
+#include "rendering/frame_capture.h"
 #include "rendering/shader.h"
+#include "rendering/pipeline_layout_cache.h"
+#include "rendering/pso_manager.h"
 
 namespace globals {
 
     Logger* logger;
+    Settings* settings;
+    CpuProfiler* cpuprofiler;
+    JobSystem* jobsystem;
     Window* window;
     Renderer* renderer;
     Driver* driver;
+    DeferredReleaseQueue* deferredrelease;
+    UploadManager* uploadmgr;
+    FrameCapture* framecapture;
     ShaderManager* shadermgr;
+    PipelineLayoutCache* layoutcache;
+    PsoManager* psomanager;
 
-    void init()
+    void init(int _argc, char** _argv)
     {
         logger = new Logger;
         globals::GlobalObject<Logger>::set(logger);
 
-        window = new Window(1280, 720, APP_NAME);
-        globals::GlobalObject<Window>::set(window);
+        settings = new Settings;
+        settings->parseCommandLine(_argc, _argv);
+        globals::GlobalObject<Settings>::set(settings);
 
-        driver = new Driver(*window);
+        cpuprofiler = new CpuProfiler(settings->m_traceFirstFrame, settings->m_traceFrameCount, settings->m_traceOutputPath);
+        globals::GlobalObject<CpuProfiler>::set(cpuprofiler);
+        PROFILE_THREAD_NAME("main");
+
+        jobsystem = new JobSystem(settings->m_workerCount, settings->m_pinThreads);
+        globals::GlobalObject<JobSystem>::set(jobsystem);
+
+        // Headless and null backend runs have no window or surface at all
+        window = nullptr;
+        if (!settings->m_headless && !settings->m_nullBackend) {
+            window = new Window(settings->m_dims.x, settings->m_dims.y, APP_NAME);
+            globals::GlobalObject<Window>::set(window);
+        }
+
+        driver = new Driver(window);
         globals::GlobalObject<Driver>::set(driver);
 
+        deferredrelease = new DeferredReleaseQueue();
+        globals::GlobalObject<DeferredReleaseQueue>::set(deferredrelease);
+
+        framecapture = nullptr;
+        if (!settings->m_capturePath.empty()) {
+            framecapture = new FrameCapture(settings->m_capturePath);
+            globals::GlobalObject<FrameCapture>::set(framecapture);
+        }
+
+        uploadmgr = new UploadManager();
+        globals::GlobalObject<UploadManager>::set(uploadmgr);
+
         shadermgr = new ShaderManager();
         globals::GlobalObject<ShaderManager>::set(shadermgr);
 
-        renderer = new Renderer(*window);
+        layoutcache = new PipelineLayoutCache();
+        globals::GlobalObject<PipelineLayoutCache>::set(layoutcache);
+
+        psomanager = new PsoManager();
+        globals::GlobalObject<PsoManager>::set(psomanager);
+
+        renderer = new Renderer(window ? window->getDims() : settings->m_dims);
         globals::GlobalObject<Renderer>::set(renderer);
     }
 
     void deinit()
     {
         delete renderer;
+        delete psomanager;
+        delete layoutcache;
         delete shadermgr;
+        delete uploadmgr;
+        delete framecapture;
+        delete deferredrelease;
         delete driver;
         delete window;
+        delete jobsystem;
+        delete cpuprofiler;
+        delete settings;
         delete logger;
     }
 }
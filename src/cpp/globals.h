@@ -30,7 +30,7 @@ inline T * getPtr()
 
 }
 
-void init();
+void init(int _argc, char** _argv);
 void deinit();
 
 }
\ No newline at end of file
@@ -1,21 +1,68 @@
 #include "common.h"
 
 #include "logging/logger.h"
+#include "settings.h"
 #include "window/window.h"
 #include "rendering/renderer.h"
+#include "rendering/driver.h"
+#include "rendering/shader.h"
+#include "core/cpu_profiler.h"
+#include "core/job_system.h"
+#include <chrono>
 
 
-int main()
+int main(int _argc, char** _argv)
 {
-    globals::init();
+    auto launchTime = std::chrono::steady_clock::now();
+    globals::init(_argc, _argv);
     logInfo("ooo!");
 
-    while (!globals::getPtr<Window>()->shouldClose()) 
+    const Settings& settings = globals::getRef<Settings>();
+    Window* window = globals::getPtr<Window>();
+    Renderer* renderer = globals::getPtr<Renderer>();
+    CpuProfiler* cpuProfiler = globals::getPtr<CpuProfiler>();
+
+    auto startTime = std::chrono::steady_clock::now();
+    u64 frameCount = 0;
+
+    while (!settings.isBenchmarking() && (!window || !window->shouldClose()))
     {
-        globals::getPtr<Window>()->pollEvents();
-        globals::getPtr<Renderer>()->RenderFrame();
+        cpuProfiler->beginFrame(renderer->getFrameNum());
+        PROFILE_SCOPE("Frame");
+
+        if (window) {
+            PROFILE_SCOPE("Window::pollEvents");
+            window->pollEvents();
+        }
+        renderer->RenderFrame();
+
+        if (!frameCount) {
+            std::chrono::duration<double, std::milli> startup = std::chrono::steady_clock::now() - launchTime;
+            logInfo("Startup to first frame: {:.2f} ms with a {} pipeline cache", startup.count(),
+                globals::getRef<Driver>().isPipelineCacheWarm() ? "warm" : "cold");
+        }
+
+        if (++frameCount == settings.m_frameCount)
+            break;
     }
 
+    if (settings.m_benchmarkJobs)
+        JobSystem::benchmark(settings.m_pinThreads);
+    if (settings.m_benchmarkRecording)
+        renderer->benchmarkRecording();
+    if (settings.m_benchmarkShaderCount)
+        globals::getRef<ShaderManager>().benchmarkCompilation(settings.m_benchmarkShaderCount);
+
+    if (frameCount && settings.m_frameCount) {
+        renderer->waitForGpuIdle();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+        logInfo("Rendered {} frames in {:.2f} ms, {:.3f} ms/frame, {:.1f} fps",
+            frameCount, elapsed.count(), elapsed.count() / frameCount, frameCount * 1000.0 / elapsed.count());
+    }
+
+    if (!settings.m_gpuMemoryStatsPath.empty())
+        globals::getRef<Driver>().getGpuAllocator().writeStats(settings.m_gpuMemoryStatsPath);
+
     globals::deinit();
 	return 0;
 }
@@ -24,6 +71,6 @@ int main()
 #include <Windows.h>
 INT WinMain(HINSTANCE, HINSTANCE, PSTR, INT)
 {
-    return main();
+    return main(__argc, __argv);
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,594 @@
+#include "common.h"
+
+#include "cmd_context.h"
+#include "driver.h"
+#include "globals.h"
+#include <cstring>
+
+LiteralString getCmdTypeName(CmdType _type)
+{
+    switch (_type) {
+    case CmdType::BeginRendering: return "beginRendering";
+    case CmdType::EndRendering: return "endRendering";
+    case CmdType::ExecuteCommands: return "executeCommands";
+    case CmdType::PipelineBarrier: return "pipelineBarrier";
+    case CmdType::BindPipeline: return "bindPipeline";
+    case CmdType::BindDescriptorSets: return "bindDescriptorSets";
+    case CmdType::PushConstants: return "pushConstants";
+    case CmdType::SetViewport: return "setViewport";
+    case CmdType::SetScissor: return "setScissor";
+    case CmdType::BindVertexBuffers: return "bindVertexBuffers";
+    case CmdType::BindIndexBuffer: return "bindIndexBuffer";
+    case CmdType::Draw: return "draw";
+    case CmdType::DrawIndexed: return "drawIndexed";
+    case CmdType::Dispatch: return "dispatch";
+    case CmdType::ResetQueryPool: return "resetQueryPool";
+    case CmdType::WriteTimestamp: return "writeTimestamp";
+    default: return "unknown";
+    }
+}
+
+VulkanCmdContext::VulkanCmdContext(vk::CommandBuffer _cmd)
+    : m_cmd(_cmd)
+    , m_loader(globals::getRef<Driver>().getLoader())
+{
+}
+
+void VulkanCmdContext::begin(const vk::CommandBufferBeginInfo& _info)
+{
+    VK_CHECK(m_cmd.begin(_info));
+}
+
+void VulkanCmdContext::end()
+{
+    VK_CHECK(m_cmd.end());
+}
+
+void VulkanCmdContext::beginRendering(const vk::RenderingInfoKHR& _info)
+{
+    m_cmd.beginRenderingKHR(_info, m_loader);
+}
+
+void VulkanCmdContext::endRendering()
+{
+    m_cmd.endRenderingKHR(m_loader);
+}
+
+void VulkanCmdContext::executeCommands(CmdContext* const* _contexts, u32 _count)
+{
+    SmallVector<vk::CommandBuffer, 32> cmds;
+    for (u32 i = 0; i < _count; ++i)
+        cmds.push_back(static_cast<const VulkanCmdContext*>(_contexts[i])->m_cmd);
+    if (!cmds.empty())
+        m_cmd.executeCommands({ (u32)cmds.size(), cmds.data() });
+}
+
+void VulkanCmdContext::pipelineBarrier(const vk::DependencyInfoKHR& _info)
+{
+    m_cmd.pipelineBarrier2KHR(_info, m_loader);
+}
+
+void VulkanCmdContext::bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline)
+{
+    m_cmd.bindPipeline(_bindPoint, _pipeline);
+}
+
+void VulkanCmdContext::bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout, u32 _firstSet,
+    u32 _setCount, const vk::DescriptorSet* _sets)
+{
+    m_cmd.bindDescriptorSets(_bindPoint, _layout, _firstSet, { _setCount, _sets }, {});
+}
+
+void VulkanCmdContext::pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset, u32 _size,
+    const void* _data)
+{
+    m_cmd.pushConstants(_layout, _stages, _offset, _size, _data);
+}
+
+void VulkanCmdContext::setViewport(const vk::Viewport& _viewport)
+{
+    m_cmd.setViewport(0, _viewport);
+}
+
+void VulkanCmdContext::setScissor(const vk::Rect2D& _scissor)
+{
+    m_cmd.setScissor(0, _scissor);
+}
+
+void VulkanCmdContext::bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers,
+    const vk::DeviceSize* _offsets)
+{
+    m_cmd.bindVertexBuffers(_firstBinding, { _count, _buffers }, { _count, _offsets });
+}
+
+void VulkanCmdContext::bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type)
+{
+    m_cmd.bindIndexBuffer(_buffer, _offset, _type);
+}
+
+void VulkanCmdContext::draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance)
+{
+    m_cmd.draw(_vertexCount, _instanceCount, _firstVertex, _firstInstance);
+}
+
+void VulkanCmdContext::drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset,
+    u32 _firstInstance)
+{
+    m_cmd.drawIndexed(_indexCount, _instanceCount, _firstIndex, _vertexOffset, _firstInstance);
+}
+
+void VulkanCmdContext::dispatch(u32 _x, u32 _y, u32 _z)
+{
+    m_cmd.dispatch(_x, _y, _z);
+}
+
+void VulkanCmdContext::resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count)
+{
+    m_cmd.resetQueryPool(_pool, _firstQuery, _count);
+}
+
+void VulkanCmdContext::writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query)
+{
+    m_cmd.writeTimestamp(_stage, _pool, _query);
+}
+
+void CommandLog::clear()
+{
+    m_data.clear();
+    m_lastHeader = 0;
+    for (u32& count : m_counts)
+        count = 0;
+}
+
+void CommandLog::record(CmdType _type, const void* _payload, u32 _size)
+{
+    Header header = { _type, _size };
+    m_lastHeader = m_data.size();
+    m_data.resize(m_lastHeader + sizeof(Header) + _size);
+    memcpy(m_data.data() + m_lastHeader, &header, sizeof(Header));
+    if (_size)
+        memcpy(m_data.data() + m_lastHeader + sizeof(Header), _payload, _size);
+    m_counts[(u32)_type]++;
+}
+
+void CommandLog::append(const void* _data, u32 _size)
+{
+    ASSERT_TRUE_MSG(!m_data.empty(), "Nothing recorded to append to");
+    if (!_size)
+        return;
+
+    Header header;
+    memcpy(&header, m_data.data() + m_lastHeader, sizeof(Header));
+    header.m_size += _size;
+    memcpy(m_data.data() + m_lastHeader, &header, sizeof(Header));
+
+    u64 offset = m_data.size();
+    m_data.resize(offset + _size);
+    memcpy(m_data.data() + offset, _data, _size);
+}
+
+u32 CommandLog::getCommandCount() const
+{
+    u32 total = 0;
+    for (u32 count : m_counts)
+        total += count;
+    return total;
+}
+
+void RecordingCmdContext::begin(const vk::CommandBufferBeginInfo&)
+{
+    m_log.clear();
+}
+
+void RecordingCmdContext::end()
+{
+}
+
+void RecordingCmdContext::beginRendering(const vk::RenderingInfoKHR& _info)
+{
+    struct Payload
+    {
+        vk::Rect2D m_renderArea;
+        u32 m_layerCount;
+        u32 m_colorAttachmentCount;
+    };
+    record(CmdType::BeginRendering, Payload { _info.renderArea, _info.layerCount, _info.colorAttachmentCount });
+    m_log.append(_info.pColorAttachments, _info.colorAttachmentCount * sizeof(vk::RenderingAttachmentInfoKHR));
+    if (_info.pDepthAttachment)
+        m_log.append(_info.pDepthAttachment, sizeof(vk::RenderingAttachmentInfoKHR));
+}
+
+void RecordingCmdContext::endRendering()
+{
+    m_log.record(CmdType::EndRendering, nullptr, 0);
+}
+
+void RecordingCmdContext::executeCommands(CmdContext* const* _contexts, u32 _count)
+{
+    // The secondary logs are kept by their owners, only the order they execute in is recorded
+    m_log.record(CmdType::ExecuteCommands, _contexts, _count * sizeof(CmdContext*));
+}
+
+void RecordingCmdContext::pipelineBarrier(const vk::DependencyInfoKHR& _info)
+{
+    m_log.record(CmdType::PipelineBarrier, _info.pImageMemoryBarriers,
+        _info.imageMemoryBarrierCount * sizeof(vk::ImageMemoryBarrier2KHR));
+    m_log.append(_info.pBufferMemoryBarriers, _info.bufferMemoryBarrierCount * sizeof(vk::BufferMemoryBarrier2KHR));
+    m_log.append(_info.pMemoryBarriers, _info.memoryBarrierCount * sizeof(vk::MemoryBarrier2KHR));
+}
+
+void RecordingCmdContext::bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline)
+{
+    struct Payload
+    {
+        vk::PipelineBindPoint m_bindPoint;
+        vk::Pipeline m_pipeline;
+    };
+    record(CmdType::BindPipeline, Payload { _bindPoint, _pipeline });
+}
+
+void RecordingCmdContext::bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout,
+    u32 _firstSet, u32 _setCount, const vk::DescriptorSet* _sets)
+{
+    struct Payload
+    {
+        vk::PipelineBindPoint m_bindPoint;
+        vk::PipelineLayout m_layout;
+        u32 m_firstSet;
+    };
+    record(CmdType::BindDescriptorSets, Payload { _bindPoint, _layout, _firstSet });
+    m_log.append(_sets, _setCount * sizeof(vk::DescriptorSet));
+}
+
+void RecordingCmdContext::pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset,
+    u32 _size, const void* _data)
+{
+    struct Payload
+    {
+        vk::PipelineLayout m_layout;
+        vk::ShaderStageFlags m_stages;
+        u32 m_offset;
+    };
+    record(CmdType::PushConstants, Payload { _layout, _stages, _offset });
+    m_log.append(_data, _size);
+}
+
+void RecordingCmdContext::setViewport(const vk::Viewport& _viewport)
+{
+    record(CmdType::SetViewport, _viewport);
+}
+
+void RecordingCmdContext::setScissor(const vk::Rect2D& _scissor)
+{
+    record(CmdType::SetScissor, _scissor);
+}
+
+void RecordingCmdContext::bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers,
+    const vk::DeviceSize* _offsets)
+{
+    record(CmdType::BindVertexBuffers, _firstBinding);
+    m_log.append(_buffers, _count * sizeof(vk::Buffer));
+    m_log.append(_offsets, _count * sizeof(vk::DeviceSize));
+}
+
+void RecordingCmdContext::bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type)
+{
+    struct Payload
+    {
+        vk::Buffer m_buffer;
+        vk::DeviceSize m_offset;
+        vk::IndexType m_type;
+    };
+    record(CmdType::BindIndexBuffer, Payload { _buffer, _offset, _type });
+}
+
+void RecordingCmdContext::draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance)
+{
+    struct Payload
+    {
+        u32 m_vertexCount;
+        u32 m_instanceCount;
+        u32 m_firstVertex;
+        u32 m_firstInstance;
+    };
+    record(CmdType::Draw, Payload { _vertexCount, _instanceCount, _firstVertex, _firstInstance });
+}
+
+void RecordingCmdContext::drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset,
+    u32 _firstInstance)
+{
+    struct Payload
+    {
+        u32 m_indexCount;
+        u32 m_instanceCount;
+        u32 m_firstIndex;
+        i32 m_vertexOffset;
+        u32 m_firstInstance;
+    };
+    record(CmdType::DrawIndexed, Payload { _indexCount, _instanceCount, _firstIndex, _vertexOffset, _firstInstance });
+}
+
+void RecordingCmdContext::dispatch(u32 _x, u32 _y, u32 _z)
+{
+    u32 groups[3] = { _x, _y, _z };
+    record(CmdType::Dispatch, groups);
+}
+
+void RecordingCmdContext::resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count)
+{
+    struct Payload
+    {
+        vk::QueryPool m_pool;
+        u32 m_firstQuery;
+        u32 m_count;
+    };
+    record(CmdType::ResetQueryPool, Payload { _pool, _firstQuery, _count });
+}
+
+void RecordingCmdContext::writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query)
+{
+    struct Payload
+    {
+        vk::PipelineStageFlagBits m_stage;
+        vk::QueryPool m_pool;
+        u32 m_query;
+    };
+    record(CmdType::WriteTimestamp, Payload { _stage, _pool, _query });
+}
+
+StateCachingCmdContext::StateCachingCmdContext(unique_ptr<CmdContext> _inner)
+    : m_inner(std::move(_inner))
+{
+    invalidateState();
+}
+
+void StateCachingCmdContext::invalidateState()
+{
+    for (BindPointState& state : m_bindPoints)
+        state = BindPointState();
+    m_pushLayout = vk::PipelineLayout();
+    m_pushStages = vk::ShaderStageFlags();
+    m_pushValid.reset();
+    m_viewportValid = false;
+    m_scissorValid = false;
+    for (u32 i = 0; i < C_MaxVertexBindings; ++i) {
+        m_vertexBuffers[i] = vk::Buffer();
+        m_vertexOffsets[i] = 0;
+    }
+    m_indexBuffer = vk::Buffer();
+}
+
+StateCachingCmdContext::BindPointState* StateCachingCmdContext::getBindPointState(vk::PipelineBindPoint _bindPoint)
+{
+    switch (_bindPoint) {
+    case vk::PipelineBindPoint::eGraphics: return &m_bindPoints[0];
+    case vk::PipelineBindPoint::eCompute: return &m_bindPoints[1];
+    default: return nullptr;
+    }
+}
+
+void StateCachingCmdContext::begin(const vk::CommandBufferBeginInfo& _info)
+{
+    invalidateState();
+    for (u32 type = 0; type < (u32)CmdType::Count; ++type) {
+        m_issuedCounts[type] = 0;
+        m_elidedCounts[type] = 0;
+    }
+    m_inner->begin(_info);
+}
+
+void StateCachingCmdContext::end()
+{
+    m_inner->end();
+}
+
+void StateCachingCmdContext::beginRendering(const vk::RenderingInfoKHR& _info)
+{
+    issued(CmdType::BeginRendering);
+    m_inner->beginRendering(_info);
+}
+
+void StateCachingCmdContext::endRendering()
+{
+    issued(CmdType::EndRendering);
+    m_inner->endRendering();
+}
+
+void StateCachingCmdContext::executeCommands(CmdContext* const* _contexts, u32 _count)
+{
+    SmallVector<CmdContext*, 32> inners;
+    for (u32 i = 0; i < _count; ++i)
+        inners.push_back(&static_cast<StateCachingCmdContext*>(_contexts[i])->getInner());
+
+    issued(CmdType::ExecuteCommands);
+    m_inner->executeCommands(inners.data(), (u32)inners.size());
+    invalidateState();
+}
+
+void StateCachingCmdContext::pipelineBarrier(const vk::DependencyInfoKHR& _info)
+{
+    issued(CmdType::PipelineBarrier);
+    m_inner->pipelineBarrier(_info);
+}
+
+void StateCachingCmdContext::bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline)
+{
+    BindPointState* state = getBindPointState(_bindPoint);
+    if (state && _pipeline && state->m_pipeline == _pipeline) {
+        elided(CmdType::BindPipeline);
+        return;
+    }
+
+    if (state) {
+        state->m_pipeline = _pipeline;
+        m_pushValid.reset();
+    }
+    issued(CmdType::BindPipeline);
+    m_inner->bindPipeline(_bindPoint, _pipeline);
+}
+
+void StateCachingCmdContext::bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout,
+    u32 _firstSet, u32 _setCount, const vk::DescriptorSet* _sets)
+{
+    BindPointState* state = getBindPointState(_bindPoint);
+    if (state && _firstSet + _setCount <= C_MaxDescriptorSets) {
+        // Sets bound with another layout may have been disturbed, they are all forgotten
+        if (_layout != state->m_layout) {
+            state->m_layout = _layout;
+            for (vk::DescriptorSet& set : state->m_sets)
+                set = vk::DescriptorSet();
+        }
+
+        bool redundant = true;
+        for (u32 i = 0; i < _setCount && redundant; ++i)
+            redundant = _sets[i] && state->m_sets[_firstSet + i] == _sets[i];
+        if (redundant) {
+            elided(CmdType::BindDescriptorSets);
+            return;
+        }
+
+        for (u32 i = 0; i < _setCount; ++i)
+            state->m_sets[_firstSet + i] = _sets[i];
+    } else if (state) {
+        state->m_layout = vk::PipelineLayout();
+        for (vk::DescriptorSet& set : state->m_sets)
+            set = vk::DescriptorSet();
+    }
+
+    issued(CmdType::BindDescriptorSets);
+    m_inner->bindDescriptorSets(_bindPoint, _layout, _firstSet, _setCount, _sets);
+}
+
+void StateCachingCmdContext::pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset,
+    u32 _size, const void* _data)
+{
+    if (_offset + _size <= C_MaxPushConstantSize) {
+        if (_layout != m_pushLayout || _stages != m_pushStages) {
+            m_pushLayout = _layout;
+            m_pushStages = _stages;
+            m_pushValid.reset();
+        }
+
+        const u8* bytes = static_cast<const u8*>(_data);
+        bool redundant = true;
+        for (u32 i = 0; i < _size && redundant; ++i)
+            redundant = m_pushValid[_offset + i] && m_pushData[_offset + i] == bytes[i];
+        if (redundant) {
+            elided(CmdType::PushConstants);
+            return;
+        }
+
+        memcpy(m_pushData + _offset, bytes, _size);
+        for (u32 i = 0; i < _size; ++i)
+            m_pushValid.set(_offset + i);
+    } else {
+        m_pushValid.reset();
+    }
+
+    issued(CmdType::PushConstants);
+    m_inner->pushConstants(_layout, _stages, _offset, _size, _data);
+}
+
+void StateCachingCmdContext::setViewport(const vk::Viewport& _viewport)
+{
+    if (m_viewportValid && m_viewport == _viewport) {
+        elided(CmdType::SetViewport);
+        return;
+    }
+
+    m_viewport = _viewport;
+    m_viewportValid = true;
+    issued(CmdType::SetViewport);
+    m_inner->setViewport(_viewport);
+}
+
+void StateCachingCmdContext::setScissor(const vk::Rect2D& _scissor)
+{
+    if (m_scissorValid && m_scissor == _scissor) {
+        elided(CmdType::SetScissor);
+        return;
+    }
+
+    m_scissor = _scissor;
+    m_scissorValid = true;
+    issued(CmdType::SetScissor);
+    m_inner->setScissor(_scissor);
+}
+
+void StateCachingCmdContext::bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers,
+    const vk::DeviceSize* _offsets)
+{
+    if (_firstBinding + _count > C_MaxVertexBindings) {
+        for (u32 i = _firstBinding; i < C_MaxVertexBindings; ++i)
+            m_vertexBuffers[i] = vk::Buffer();
+        issued(CmdType::BindVertexBuffers);
+        m_inner->bindVertexBuffers(_firstBinding, _count, _buffers, _offsets);
+        return;
+    }
+
+    // Only the bindings between the first and the last that change are issued
+    u32 first = _count;
+    u32 last = 0;
+    for (u32 i = 0; i < _count; ++i) {
+        u32 binding = _firstBinding + i;
+        if (!_buffers[i] || m_vertexBuffers[binding] != _buffers[i] || m_vertexOffsets[binding] != _offsets[i]) {
+            first = min(first, i);
+            last = i;
+        }
+        m_vertexBuffers[binding] = _buffers[i];
+        m_vertexOffsets[binding] = _offsets[i];
+    }
+
+    if (first == _count) {
+        elided(CmdType::BindVertexBuffers);
+        return;
+    }
+
+    issued(CmdType::BindVertexBuffers);
+    m_inner->bindVertexBuffers(_firstBinding + first, last - first + 1, _buffers + first, _offsets + first);
+}
+
+void StateCachingCmdContext::bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type)
+{
+    if (_buffer && m_indexBuffer == _buffer && m_indexOffset == _offset && m_indexType == _type) {
+        elided(CmdType::BindIndexBuffer);
+        return;
+    }
+
+    m_indexBuffer = _buffer;
+    m_indexOffset = _offset;
+    m_indexType = _type;
+    issued(CmdType::BindIndexBuffer);
+    m_inner->bindIndexBuffer(_buffer, _offset, _type);
+}
+
+void StateCachingCmdContext::draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance)
+{
+    issued(CmdType::Draw);
+    m_inner->draw(_vertexCount, _instanceCount, _firstVertex, _firstInstance);
+}
+
+void StateCachingCmdContext::drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset,
+    u32 _firstInstance)
+{
+    issued(CmdType::DrawIndexed);
+    m_inner->drawIndexed(_indexCount, _instanceCount, _firstIndex, _vertexOffset, _firstInstance);
+}
+
+void StateCachingCmdContext::dispatch(u32 _x, u32 _y, u32 _z)
+{
+    issued(CmdType::Dispatch);
+    m_inner->dispatch(_x, _y, _z);
+}
+
+void StateCachingCmdContext::resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count)
+{
+    issued(CmdType::ResetQueryPool);
+    m_inner->resetQueryPool(_pool, _firstQuery, _count);
+}
+
+void StateCachingCmdContext::writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query)
+{
+    issued(CmdType::WriteTimestamp);
+    m_inner->writeTimestamp(_stage, _pool, _query);
+}
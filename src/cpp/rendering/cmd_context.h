@@ -0,0 +1,255 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include <bitset>
+
+enum class CmdType : u8
+{
+    BeginRendering,
+    EndRendering,
+    ExecuteCommands,
+    PipelineBarrier,
+    BindPipeline,
+    BindDescriptorSets,
+    PushConstants,
+    SetViewport,
+    SetScissor,
+    BindVertexBuffers,
+    BindIndexBuffer,
+    Draw,
+    DrawIndexed,
+    Dispatch,
+    ResetQueryPool,
+    WriteTimestamp,
+    Count
+};
+
+LiteralString getCmdTypeName(CmdType _type);
+
+// The command recording surface used by the renderer. Implemented on top of a vk::CommandBuffer, or by a
+// command log for measuring the cpu side of recording without the driver. A context is used by one thread at a time.
+class CmdContext
+{
+public:
+    virtual ~CmdContext() {};
+
+    virtual void begin(const vk::CommandBufferBeginInfo& _info) = 0;
+    virtual void end() = 0;
+
+    virtual void beginRendering(const vk::RenderingInfoKHR& _info) = 0;
+    virtual void endRendering() = 0;
+    // _contexts have the same implementation as this one
+    virtual void executeCommands(CmdContext* const* _contexts, u32 _count) = 0;
+    virtual void pipelineBarrier(const vk::DependencyInfoKHR& _info) = 0;
+
+    virtual void bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline) = 0;
+    virtual void bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout, u32 _firstSet,
+        u32 _setCount, const vk::DescriptorSet* _sets) = 0;
+    virtual void pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset, u32 _size,
+        const void* _data) = 0;
+    virtual void setViewport(const vk::Viewport& _viewport) = 0;
+    virtual void setScissor(const vk::Rect2D& _scissor) = 0;
+    virtual void bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers, const vk::DeviceSize* _offsets) = 0;
+    virtual void bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type) = 0;
+
+    virtual void draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance) = 0;
+    virtual void drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset, u32 _firstInstance) = 0;
+    virtual void dispatch(u32 _x, u32 _y, u32 _z) = 0;
+
+    virtual void resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count) = 0;
+    virtual void writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query) = 0;
+};
+
+class VulkanCmdContext final : public CmdContext
+{
+public:
+    VulkanCmdContext(vk::CommandBuffer _cmd);
+
+    vk::CommandBuffer getCommandBuffer() const { return m_cmd; }
+
+    void begin(const vk::CommandBufferBeginInfo& _info) override;
+    void end() override;
+
+    void beginRendering(const vk::RenderingInfoKHR& _info) override;
+    void endRendering() override;
+    void executeCommands(CmdContext* const* _contexts, u32 _count) override;
+    void pipelineBarrier(const vk::DependencyInfoKHR& _info) override;
+
+    void bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline) override;
+    void bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout, u32 _firstSet,
+        u32 _setCount, const vk::DescriptorSet* _sets) override;
+    void pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset, u32 _size,
+        const void* _data) override;
+    void setViewport(const vk::Viewport& _viewport) override;
+    void setScissor(const vk::Rect2D& _scissor) override;
+    void bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers, const vk::DeviceSize* _offsets) override;
+    void bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type) override;
+
+    void draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance) override;
+    void drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset, u32 _firstInstance) override;
+    void dispatch(u32 _x, u32 _y, u32 _z) override;
+
+    void resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count) override;
+    void writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query) override;
+
+private:
+    vk::CommandBuffer m_cmd;
+    const vk::DispatchLoaderDynamic& m_loader;
+};
+
+// Commands packed back to back in a byte stream, each one a type, a payload size and the arguments it was
+// recorded with. Arrays are copied, so the log costs about what filling a driver command buffer would.
+class CommandLog
+{
+public:
+    void clear();
+    void record(CmdType _type, const void* _payload, u32 _size);
+    // Appends to the payload of the command recorded last
+    void append(const void* _data, u32 _size);
+
+    u32 getCount(CmdType _type) const { return m_counts[(u32)_type]; }
+    u32 getCommandCount() const;
+    u64 getSizeBytes() const { return m_data.size(); }
+
+private:
+    struct Header
+    {
+        CmdType m_type;
+        u32 m_size;
+    };
+
+    vector<u8> m_data;
+    u64 m_lastHeader = 0;
+    u32 m_counts[(u32)CmdType::Count] = {};
+};
+
+// Records into a CommandLog instead of calling Vulkan, begin() clears the log
+class RecordingCmdContext final : public CmdContext
+{
+public:
+    const CommandLog& getLog() const { return m_log; }
+
+    void begin(const vk::CommandBufferBeginInfo& _info) override;
+    void end() override;
+
+    void beginRendering(const vk::RenderingInfoKHR& _info) override;
+    void endRendering() override;
+    void executeCommands(CmdContext* const* _contexts, u32 _count) override;
+    void pipelineBarrier(const vk::DependencyInfoKHR& _info) override;
+
+    void bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline) override;
+    void bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout, u32 _firstSet,
+        u32 _setCount, const vk::DescriptorSet* _sets) override;
+    void pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset, u32 _size,
+        const void* _data) override;
+    void setViewport(const vk::Viewport& _viewport) override;
+    void setScissor(const vk::Rect2D& _scissor) override;
+    void bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers, const vk::DeviceSize* _offsets) override;
+    void bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type) override;
+
+    void draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance) override;
+    void drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset, u32 _firstInstance) override;
+    void dispatch(u32 _x, u32 _y, u32 _z) override;
+
+    void resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count) override;
+    void writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query) override;
+
+private:
+    CommandLog m_log;
+
+    template <typename T>
+    void record(CmdType _type, const T& _payload)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Command payloads are copied as bytes");
+        m_log.record(_type, &_payload, sizeof(T));
+    }
+};
+
+// Forwards to another context and drops the binds and dynamic state that would set what is already set. The state
+// is unknown after begin() and executeCommands(), Vulkan doesn't keep it across secondary command buffers.
+// Sets and push constants are only compared under the layout they were last bound with, and push constants are
+// forgotten on a pipeline change since the new pipeline's layout isn't known. Viewport and scissor are assumed
+// dynamic in every pipeline.
+class StateCachingCmdContext final : public CmdContext
+{
+public:
+    StateCachingCmdContext(unique_ptr<CmdContext> _inner);
+
+    CmdContext& getInner() { return *m_inner; }
+    const CmdContext& getInner() const { return *m_inner; }
+
+    // Since begin(). Issued calls reached the wrapped context, elided ones were dropped.
+    u32 getIssuedCount(CmdType _type) const { return m_issuedCounts[(u32)_type]; }
+    u32 getElidedCount(CmdType _type) const { return m_elidedCounts[(u32)_type]; }
+
+    // For when the command buffer was recorded to without going through this context
+    void invalidateState();
+
+    void begin(const vk::CommandBufferBeginInfo& _info) override;
+    void end() override;
+
+    void beginRendering(const vk::RenderingInfoKHR& _info) override;
+    void endRendering() override;
+    void executeCommands(CmdContext* const* _contexts, u32 _count) override;
+    void pipelineBarrier(const vk::DependencyInfoKHR& _info) override;
+
+    void bindPipeline(vk::PipelineBindPoint _bindPoint, vk::Pipeline _pipeline) override;
+    void bindDescriptorSets(vk::PipelineBindPoint _bindPoint, vk::PipelineLayout _layout, u32 _firstSet,
+        u32 _setCount, const vk::DescriptorSet* _sets) override;
+    void pushConstants(vk::PipelineLayout _layout, vk::ShaderStageFlags _stages, u32 _offset, u32 _size,
+        const void* _data) override;
+    void setViewport(const vk::Viewport& _viewport) override;
+    void setScissor(const vk::Rect2D& _scissor) override;
+    void bindVertexBuffers(u32 _firstBinding, u32 _count, const vk::Buffer* _buffers, const vk::DeviceSize* _offsets) override;
+    void bindIndexBuffer(vk::Buffer _buffer, vk::DeviceSize _offset, vk::IndexType _type) override;
+
+    void draw(u32 _vertexCount, u32 _instanceCount, u32 _firstVertex, u32 _firstInstance) override;
+    void drawIndexed(u32 _indexCount, u32 _instanceCount, u32 _firstIndex, i32 _vertexOffset, u32 _firstInstance) override;
+    void dispatch(u32 _x, u32 _y, u32 _z) override;
+
+    void resetQueryPool(vk::QueryPool _pool, u32 _firstQuery, u32 _count) override;
+    void writeTimestamp(vk::PipelineStageFlagBits _stage, vk::QueryPool _pool, u32 _query) override;
+
+private:
+    static constexpr u32 C_MaxDescriptorSets = 8;
+    static constexpr u32 C_MaxVertexBindings = 16;
+    // The smallest maxPushConstantsSize allowed, pushes past it are always issued
+    static constexpr u32 C_MaxPushConstantSize = 128;
+
+    // Graphics and compute, other bind points aren't shadowed
+    struct BindPointState
+    {
+        vk::Pipeline m_pipeline;
+        vk::PipelineLayout m_layout;
+        vk::DescriptorSet m_sets[C_MaxDescriptorSets];
+    };
+
+    unique_ptr<CmdContext> m_inner;
+
+    BindPointState m_bindPoints[2];
+
+    vk::PipelineLayout m_pushLayout;
+    vk::ShaderStageFlags m_pushStages;
+    u8 m_pushData[C_MaxPushConstantSize];
+    std::bitset<C_MaxPushConstantSize> m_pushValid;
+
+    vk::Viewport m_viewport;
+    vk::Rect2D m_scissor;
+    bool m_viewportValid = false;
+    bool m_scissorValid = false;
+
+    // A null buffer is an unknown binding
+    vk::Buffer m_vertexBuffers[C_MaxVertexBindings];
+    vk::DeviceSize m_vertexOffsets[C_MaxVertexBindings];
+
+    vk::Buffer m_indexBuffer;
+    vk::DeviceSize m_indexOffset = 0;
+    vk::IndexType m_indexType = vk::IndexType::eUint16;
+
+    u32 m_issuedCounts[(u32)CmdType::Count] = {};
+    u32 m_elidedCounts[(u32)CmdType::Count] = {};
+
+    BindPointState* getBindPointState(vk::PipelineBindPoint _bindPoint);
+    void issued(CmdType _type) { m_issuedCounts[(u32)_type]++; }
+    void elided(CmdType _type) { m_elidedCounts[(u32)_type]++; }
+};
@@ -0,0 +1,168 @@
+#include "common.h"
+
+#include "deferred_release.h"
+#include "driver.h"
+#include "renderer.h"
+#include "globals.h"
+#include "core/cpu_profiler.h"
+
+DeferredReleaseQueue::~DeferredReleaseQueue()
+{
+    for (const Bucket& bucket : m_buckets)
+        destroyObjects(bucket.m_objects);
+}
+
+void DeferredReleaseQueue::retire(vk::Buffer _buffer, VmaAllocation _allocation, u64 _lastUsedFrame)
+{
+    retireObject(vk::ObjectType::eBuffer, (u64)static_cast<VkBuffer>(_buffer), _allocation, _lastUsedFrame);
+}
+
+void DeferredReleaseQueue::retire(vk::Image _image, VmaAllocation _allocation, u64 _lastUsedFrame)
+{
+    retireObject(vk::ObjectType::eImage, (u64)static_cast<VkImage>(_image), _allocation, _lastUsedFrame);
+}
+
+void DeferredReleaseQueue::retire(VmaAllocation _allocation, u64 _lastUsedFrame)
+{
+    if (_allocation)
+        retireObject(vk::ObjectType::eUnknown, 0, _allocation, _lastUsedFrame);
+}
+
+void DeferredReleaseQueue::retireObject(vk::ObjectType _type, u64 _handle, VmaAllocation _allocation, u64 _lastUsedFrame)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    u64 frameNum = _lastUsedFrame == C_CurrentFrame ? m_currentFrame : _lastUsedFrame;
+    u64 timelineValue = Renderer::getFrameTimelineValue(frameNum);
+
+    // Joining a newer bucket only delays the release, it keeps the buckets ordered
+    if (m_buckets.empty() || m_buckets.back().m_timelineValue < timelineValue) {
+        Bucket& bucket = m_buckets.emplace_back();
+        bucket.m_timelineValue = timelineValue;
+        if (!m_spareObjectVectors.empty()) {
+            bucket.m_objects.swap(m_spareObjectVectors.back());
+            m_spareObjectVectors.pop_back();
+        }
+    }
+
+    m_buckets.back().m_objects.push_back({ _type, _handle, _allocation });
+    ++m_pendingCount;
+}
+
+void DeferredReleaseQueue::update(u64 _frameNum, u64 _completedTimelineValue)
+{
+    PROFILE_SCOPE("DeferredReleaseQueue::update");
+
+    vector<Bucket> released;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_currentFrame = _frameNum;
+        while (!m_buckets.empty() && m_buckets.front().m_timelineValue <= _completedTimelineValue) {
+            released.push_back(std::move(m_buckets.front()));
+            m_buckets.pop_front();
+        }
+    }
+
+    if (released.empty())
+        return;
+
+    // Destroyed outside the lock, workers retiring objects don't wait on the driver
+    u64 releasedCount = 0;
+    for (Bucket& bucket : released) {
+        destroyObjects(bucket.m_objects);
+        releasedCount += bucket.m_objects.size();
+        bucket.m_objects.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pendingCount -= releasedCount;
+    for (Bucket& bucket : released)
+        m_spareObjectVectors.push_back(std::move(bucket.m_objects));
+}
+
+u64 DeferredReleaseQueue::getPendingCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pendingCount;
+}
+
+void DeferredReleaseQueue::destroyObjects(const vector<RetiredObject>& _objects)
+{
+    Driver& driver = globals::getRef<Driver>();
+    // Objects of the null backend are null or placeholders, nothing was created
+    if (driver.isNull())
+        return;
+    GpuAllocator& allocator = driver.getGpuAllocator();
+    vk::Device device = driver.getDriverObjects().m_device;
+
+    for (const RetiredObject& object : _objects) {
+        switch (object.m_type) {
+        case vk::ObjectType::eUnknown:
+            allocator.free(object.m_allocation);
+            break;
+        case vk::ObjectType::eBuffer:
+            if (object.m_allocation)
+                allocator.destroyBuffer(vk::Buffer((VkBuffer)object.m_handle), object.m_allocation);
+            else
+                device.destroyBuffer(vk::Buffer((VkBuffer)object.m_handle));
+            break;
+        case vk::ObjectType::eImage:
+            if (object.m_allocation)
+                allocator.destroyImage(vk::Image((VkImage)object.m_handle), object.m_allocation);
+            else
+                device.destroyImage(vk::Image((VkImage)object.m_handle));
+            break;
+        case vk::ObjectType::eBufferView:
+            device.destroyBufferView(vk::BufferView((VkBufferView)object.m_handle));
+            break;
+        case vk::ObjectType::eImageView:
+            device.destroyImageView(vk::ImageView((VkImageView)object.m_handle));
+            break;
+        case vk::ObjectType::eSampler:
+            device.destroySampler(vk::Sampler((VkSampler)object.m_handle));
+            break;
+        case vk::ObjectType::eFramebuffer:
+            device.destroyFramebuffer(vk::Framebuffer((VkFramebuffer)object.m_handle));
+            break;
+        case vk::ObjectType::eRenderPass:
+            device.destroyRenderPass(vk::RenderPass((VkRenderPass)object.m_handle));
+            break;
+        case vk::ObjectType::ePipeline:
+            device.destroyPipeline(vk::Pipeline((VkPipeline)object.m_handle));
+            break;
+        case vk::ObjectType::ePipelineLayout:
+            device.destroyPipelineLayout(vk::PipelineLayout((VkPipelineLayout)object.m_handle));
+            break;
+        case vk::ObjectType::eShaderModule:
+            device.destroyShaderModule(vk::ShaderModule((VkShaderModule)object.m_handle));
+            break;
+        case vk::ObjectType::eDescriptorSetLayout:
+            device.destroyDescriptorSetLayout(vk::DescriptorSetLayout((VkDescriptorSetLayout)object.m_handle));
+            break;
+        case vk::ObjectType::eDescriptorPool:
+            device.destroyDescriptorPool(vk::DescriptorPool((VkDescriptorPool)object.m_handle));
+            break;
+        case vk::ObjectType::eQueryPool:
+            device.destroyQueryPool(vk::QueryPool((VkQueryPool)object.m_handle));
+            break;
+        case vk::ObjectType::eCommandPool:
+            device.destroyCommandPool(vk::CommandPool((VkCommandPool)object.m_handle));
+            break;
+        case vk::ObjectType::eSemaphore:
+            device.destroySemaphore(vk::Semaphore((VkSemaphore)object.m_handle));
+            break;
+        case vk::ObjectType::eEvent:
+            device.destroyEvent(vk::Event((VkEvent)object.m_handle));
+            break;
+        case vk::ObjectType::eDeviceMemory:
+            device.freeMemory(vk::DeviceMemory((VkDeviceMemory)object.m_handle));
+            break;
+        case vk::ObjectType::eSwapchainKHR:
+            device.destroySwapchainKHR(vk::SwapchainKHR((VkSwapchainKHR)object.m_handle));
+            break;
+        default:
+            ASSERT_TRUE_MSG(false, "Unsupported object type {} in the deferred release queue", vk::to_string(object.m_type));
+            break;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include <deque>
+#include <mutex>
+
+// Destroys gpu objects once the gpu has finished the last frame using them. Objects are bucketed by frame
+// and destroyed in bulk at the frame boundary, nothing waits and no per-object fence is needed. Thread-safe.
+class DeferredReleaseQueue
+{
+public:
+    // Retires with the frame passed to the latest update(), which covers every frame recorded so far
+    static constexpr u64 C_CurrentFrame = ~0ull;
+
+    DeferredReleaseQueue() = default;
+    // The renderer waits for the gpu before this is destroyed
+    ~DeferredReleaseQueue();
+
+    DeferredReleaseQueue(const DeferredReleaseQueue&) = delete;
+    DeferredReleaseQueue& operator=(const DeferredReleaseQueue&) = delete;
+
+    // Any vk handle type, destroyed once frame _lastUsedFrame has finished on the gpu
+    template <typename T>
+    void retire(T _handle, u64 _lastUsedFrame = C_CurrentFrame)
+    {
+        if (_handle)
+            retireObject(T::objectType, (u64)static_cast<typename T::CType>(_handle), nullptr, _lastUsedFrame);
+    }
+    // Objects created through vma are destroyed together with their allocation
+    void retire(vk::Buffer _buffer, VmaAllocation _allocation, u64 _lastUsedFrame = C_CurrentFrame);
+    void retire(vk::Image _image, VmaAllocation _allocation, u64 _lastUsedFrame = C_CurrentFrame);
+    void retire(VmaAllocation _allocation, u64 _lastUsedFrame = C_CurrentFrame);
+
+    // Call at the frame boundary, before _frameNum is recorded. Destroys every bucket whose frame has completed.
+    void update(u64 _frameNum, u64 _completedTimelineValue);
+
+    u64 getPendingCount();
+
+private:
+    struct RetiredObject
+    {
+        vk::ObjectType m_type;
+        u64 m_handle;
+        VmaAllocation m_allocation;
+    };
+
+    struct Bucket
+    {
+        u64 m_timelineValue;
+        vector<RetiredObject> m_objects;
+    };
+
+    std::mutex m_mutex;
+    // Ordered by timeline value, objects retired for an older frame join the newest bucket
+    std::deque<Bucket> m_buckets;
+    // Object vectors of released buckets, reused to avoid reallocating every frame
+    vector<vector<RetiredObject>> m_spareObjectVectors;
+    u64 m_currentFrame = 0;
+    u64 m_pendingCount = 0;
+
+    void retireObject(vk::ObjectType _type, u64 _handle, VmaAllocation _allocation, u64 _lastUsedFrame);
+    static void destroyObjects(const vector<RetiredObject>& _objects);
+};
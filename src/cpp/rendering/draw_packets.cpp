@@ -0,0 +1,93 @@
+#include "common.h"
+
+#include "draw_packets.h"
+#include "globals.h"
+#include "core/job_system.h"
+#include "core/cpu_profiler.h"
+#include <utility>
+
+static constexpr u32 C_RadixBits = 8;
+static constexpr u32 C_RadixBuckets = 1 << C_RadixBits;
+static constexpr u32 C_RadixPasses = 64 / C_RadixBits;
+
+static u32 countPipelineChanges(const vector<DrawPacket>& _packets)
+{
+    u32 changes = 0;
+    for (size_t i = 1; i < _packets.size(); ++i) {
+        if (getSortKeyPipeline(_packets[i].m_sortKey) != getSortKeyPipeline(_packets[i - 1].m_sortKey))
+            ++changes;
+    }
+    return changes;
+}
+
+u64 makeDrawSortKey(u32 _pass, PipelineHandle _pipeline, u32 _material, float _depth)
+{
+    ASSERT_TRUE_MSG(_pass < 256 && _pipeline < 65536 && _material < 65536,
+        "Sort key fields out of range: pass {}, pipeline {}, material {}", _pass, _pipeline, _material);
+
+    u32 depth = (u32)(min(max(_depth, 0.0f), 1.0f) * (float)((1u << C_SortKeyDepthBits) - 1));
+    return ((u64)_pass << C_SortKeyPassShift) | ((u64)_pipeline << C_SortKeyPipelineShift)
+        | ((u64)_material << C_SortKeyMaterialShift) | depth;
+}
+
+DrawPacketQueue::DrawPacketQueue()
+{
+    m_threadBuffers.resize(globals::getRef<JobSystem>().getThreadCount());
+}
+
+void DrawPacketQueue::reset()
+{
+    for (ThreadBuffer& buffer : m_threadBuffers)
+        buffer.m_packets.clear();
+    m_sorted.clear();
+}
+
+void DrawPacketQueue::sort()
+{
+    PROFILE_SCOPE("DrawPacketQueue::sort");
+
+    m_sorted.clear();
+    for (const ThreadBuffer& buffer : m_threadBuffers)
+        m_sorted.insert(m_sorted.end(), buffer.m_packets.begin(), buffer.m_packets.end());
+    m_unsortedPipelineChanges = countPipelineChanges(m_sorted);
+
+    u32 count = (u32)m_sorted.size();
+    if (count < 2) {
+        m_sortedPipelineChanges = 0;
+        return;
+    }
+
+    // Histograms of every digit in a single read of the keys
+    u32 histograms[C_RadixPasses][C_RadixBuckets] = {};
+    for (const DrawPacket& packet : m_sorted) {
+        for (u32 pass = 0; pass < C_RadixPasses; ++pass)
+            histograms[pass][(packet.m_sortKey >> (pass * C_RadixBits)) & (C_RadixBuckets - 1)]++;
+    }
+
+    m_scratch.resize(count);
+    DrawPacket* src = m_sorted.data();
+    DrawPacket* dst = m_scratch.data();
+    for (u32 pass = 0; pass < C_RadixPasses; ++pass) {
+        u32 shift = pass * C_RadixBits;
+        const u32* histogram = histograms[pass];
+        if (histogram[(src[0].m_sortKey >> shift) & (C_RadixBuckets - 1)] == count)
+            continue;
+
+        u32 offsets[C_RadixBuckets];
+        u32 offset = 0;
+        for (u32 bucket = 0; bucket < C_RadixBuckets; ++bucket) {
+            offsets[bucket] = offset;
+            offset += histogram[bucket];
+        }
+
+        for (u32 i = 0; i < count; ++i)
+            dst[offsets[(src[i].m_sortKey >> shift) & (C_RadixBuckets - 1)]++] = src[i];
+        std::swap(src, dst);
+    }
+
+    // An odd number of passes leaves the result in the scratch buffer
+    if (src != m_sorted.data())
+        m_sorted.swap(m_scratch);
+
+    m_sortedPipelineChanges = countPipelineChanges(m_sorted);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "pso_manager.h"
+
+// Sort key layout, most significant bits first: pass 8, pipeline 16, material 16, depth 24.
+// Sorted keys group the draws of a pass by pipeline then material, so state only changes between groups,
+// and order each group front to back.
+static constexpr u32 C_SortKeyDepthBits = 24;
+static constexpr u32 C_SortKeyMaterialShift = C_SortKeyDepthBits;
+static constexpr u32 C_SortKeyPipelineShift = C_SortKeyMaterialShift + 16;
+static constexpr u32 C_SortKeyPassShift = C_SortKeyPipelineShift + 16;
+static constexpr u64 C_SortKeyPipelineMask = 0xffffull << C_SortKeyPipelineShift;
+static constexpr u64 C_SortKeyDepthMask = (1ull << C_SortKeyDepthBits) - 1;
+
+// _depth is the view depth normalized to [0, 1]
+u64 makeDrawSortKey(u32 _pass, PipelineHandle _pipeline, u32 _material, float _depth);
+inline PipelineHandle getSortKeyPipeline(u64 _key) { return (PipelineHandle)((_key & C_SortKeyPipelineMask) >> C_SortKeyPipelineShift); }
+inline u64 setSortKeyPipeline(u64 _key, PipelineHandle _pipeline)
+{
+    return (_key & ~C_SortKeyPipelineMask) | ((u64)_pipeline << C_SortKeyPipelineShift);
+}
+
+// A draw and the state it needs, encoded in its sort key
+struct DrawPacket
+{
+    u64 m_sortKey;
+    u32 m_vertexCount;
+    u32 m_instanceCount;
+    u32 m_firstVertex;
+    u32 m_firstInstance;
+};
+
+// Packets are emitted without synchronization into a linear buffer per job system thread, sort() merges the
+// buffers in thread order and sorts the packets by key. Rebuilt every frame.
+class DrawPacketQueue
+{
+public:
+    DrawPacketQueue();
+
+    void reset();
+    // _threadIndex as the job system passes it, a thread only ever emits to its own buffer
+    void emit(u32 _threadIndex, const DrawPacket& _packet) { m_threadBuffers[_threadIndex].m_packets.push_back(_packet); }
+
+    // Stable LSD radix sort on the keys, one byte per pass. Passes over bytes equal in every key are skipped.
+    void sort();
+    const vector<DrawPacket>& getSortedPackets() const { return m_sorted; }
+
+    // Pipeline changes between consecutive packets before and after the last sort
+    u32 getUnsortedPipelineChanges() const { return m_unsortedPipelineChanges; }
+    u32 getSortedPipelineChanges() const { return m_sortedPipelineChanges; }
+
+private:
+    // Each on its own cache lines, threads emit concurrently
+    struct alignas(64) ThreadBuffer
+    {
+        vector<DrawPacket> m_packets;
+    };
+
+    vector<ThreadBuffer> m_threadBuffers;
+    vector<DrawPacket> m_sorted;
+    vector<DrawPacket> m_scratch;
+    u32 m_unsortedPipelineChanges = 0;
+    u32 m_sortedPipelineChanges = 0;
+};
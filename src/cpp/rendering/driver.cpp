@@ -3,6 +3,12 @@
 #include "driver.h"
 #include "GLFW/glfw3.h"
 #include "window/window.h"
+#include "settings.h"
+#include "core/hash.h"
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 
 #ifndef _NDEBUG
 #define ENABLE_VALIDATION
@@ -28,8 +34,21 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL vulkanDebugCallback(
 }
 #endif
 
-Driver::Driver(const class Window& _window)
+Driver::Driver(const class Window* _window)
 {
+    const bool headless = _window == nullptr;
+
+    // The null backend runs without any Vulkan implementation, every queue type maps to one placeholder queue
+    // and the allocator hands out null resources
+    if (globals::getRef<Settings>().m_nullBackend) {
+        Queue* queue = m_queues.emplace_back(std::make_unique<Queue>()).get();
+        for (QueueTypeState& type : m_queueTypes)
+            type.m_queue = queue;
+        initAllocator();
+        logInfo("Null backend, no Vulkan instance or device is created");
+        return;
+    }
+
     {
         vk::ApplicationInfo appinfo;
         appinfo.setPApplicationName(APP_NAME);
@@ -42,15 +61,18 @@ Driver::Driver(const class Window& _window)
 
         SmallVector<const char*, 8> instanceExtensions = {
             VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
-            VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME,
             VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
             //VK_KHR_PERFORMANCE_QUERY_EXTENSION_NAME,
         };
 
-        u32 glfwExtensionCount = 0;
-        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-        for (u32 i = 0; i < glfwExtensionCount; ++i)
-            instanceExtensions.push_back(glfwExtensions[i]);
+        if (!headless) {
+            instanceExtensions.push_back(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+
+            u32 glfwExtensionCount = 0;
+            const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            for (u32 i = 0; i < glfwExtensionCount; ++i)
+                instanceExtensions.push_back(glfwExtensions[i]);
+        }
 
         instanceinfo.setPEnabledExtensionNames({ instanceExtensions.size(), instanceExtensions.data() });
 
@@ -88,9 +110,9 @@ Driver::Driver(const class Window& _window)
     }
 #endif
 
-    {
+    if (!headless) {
         VkSurfaceKHR surf;
-        VERIFY_TRUE(VK_SUCCESS == glfwCreateWindowSurface(m_instance.get(), _window.getGlfwHandle(), nullptr, &surf));
+        VERIFY_TRUE(VK_SUCCESS == glfwCreateWindowSurface(m_instance.get(), _window->getGlfwHandle(), nullptr, &surf));
         m_surface = UniqueHandle<vk::SurfaceKHR>(surf, m_instance.get());
     }
 
@@ -103,9 +125,19 @@ Driver::Driver(const class Window& _window)
 
     {
         SmallVector<const char*, 8> deviceExtensions = {
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
             VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+            VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
         };
+        if (!headless)
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+        auto availableExtensions = m_gpu.enumerateDeviceExtensionProperties().value;
+        for (const vk::ExtensionProperties& extension : availableExtensions) {
+            if (!strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+                m_memoryBudgetSupported = true;
+        }
+        if (m_memoryBudgetSupported)
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
         vk::DeviceCreateInfo deviceinfo;
         deviceinfo.setPEnabledExtensionNames({ deviceExtensions.size(), deviceExtensions.data() });
 
@@ -113,36 +145,58 @@ Driver::Driver(const class Window& _window)
         sync2.setSynchronization2(true);
         deviceinfo.setPNext(&sync2);
 
-        auto queueprops = m_gpu.getQueueFamilyProperties();
-        u32 qindex = 0;
-        for (; qindex < queueprops.size(); ++qindex) {
-            if (queueprops[qindex].queueFlags | vk::QueueFlagBits::eGraphics)
-                break;
-        }
+        vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering;
+        dynamicRendering.setDynamicRendering(true);
+        sync2.setPNext(&dynamicRendering);
 
-        vk::DeviceQueueCreateInfo queueinfo;
-        queueinfo.setQueueFamilyIndex(qindex);
-        queueinfo.setQueueCount(1);
-        SmallVector<float, 4> priorities = {
-            1.0f,
-        };
-        queueinfo.setQueuePriorities({ priorities.size(), priorities.data() });
-        deviceinfo.setQueueCreateInfos(queueinfo);
+        vk::PhysicalDeviceVulkan12Features vk12features;
+        vk12features.setTimelineSemaphore(true);
+        dynamicRendering.setPNext(&vk12features);
+
+        vector<vk::DeviceQueueCreateInfo> queueinfos;
+        vector<float> priorities;
+        chooseQueues(queueinfos, priorities);
+        deviceinfo.setQueueCreateInfos({ (u32)queueinfos.size(), queueinfos.data() });
 
         m_device = m_gpu.createDeviceUnique(deviceinfo).value;
         m_loader.init(m_device.get());
 
-        vk::Queue q = m_device->getQueue(qindex, 0);
-        m_gQueue = q;
-        m_queueIndex = qindex;
+        for (unique_ptr<Queue>& queue : m_queues)
+            queue->m_queue = m_device->getQueue(queue->m_family, queue->m_index);
+    }
 
-        VERIFY_TRUE(m_gpu.getSurfaceSupportKHR(qindex, m_surface.get()).value);
+    {
+        vk::SemaphoreTypeCreateInfo timelineinfo;
+        timelineinfo.setSemaphoreType(vk::SemaphoreType::eTimeline);
+        timelineinfo.setInitialValue(0);
+
+        vk::SemaphoreCreateInfo semaphoreinfo;
+        semaphoreinfo.setPNext(&timelineinfo);
+        for (QueueTypeState& type : m_queueTypes)
+            type.m_timeline = m_device->createSemaphoreUnique(semaphoreinfo).value;
+    }
+
+    {
+        initAllocator();
+    }
+
+    {
+        initPipelineCache();
     }
 }
 
+Driver::~Driver()
+{
+    if (!isNull())
+        savePipelineCache();
+    m_gpuAllocator.reset();
+}
+
 
 void Driver::nameImage(vk::Image _img, LiteralString _name)
 {
+    if (isNull())
+        return;
     vk::DebugUtilsObjectNameInfoEXT info;
     info.setObjectType(vk::ObjectType::eImage);
     info.setObjectHandle((u64)_img.operator VkImage());
@@ -156,15 +210,19 @@ DriverObjects Driver::getDriverObjects()
     DriverObjects o;
     vk::Device d = m_device.get();
     o.m_device = d;
-    o.m_gQueue = m_gQueue;
+    o.m_gQueue = getQueue(QueueType::Graphics);
+    o.m_gQueueTimeline = getTimeline(QueueType::Graphics);
     o.m_instance = m_instance.get();
     o.m_surface = m_surface.get();
-    o.m_queueIndex = m_queueIndex;
+    o.m_queueIndex = getQueueFamily(QueueType::Graphics);
+    o.m_allocator = m_gpuAllocator->getVmaAllocator();
+    o.m_pipelineCache = m_pipelineCache.get();
     return o;
 }
 
 vk::SurfaceCapabilitiesKHR Driver::getCaps()
 {
+    ASSERT_TRUE(!isHeadless());
     return m_gpu.getSurfaceCapabilitiesKHR(m_surface.get()).value;
 }
 
@@ -179,6 +237,18 @@ vk::PhysicalDeviceMemoryProperties Driver::getMemProps()
     return m_gpu.getMemoryProperties();
 }
 
+vk::PhysicalDeviceProperties Driver::getGpuProps()
+{
+    return m_gpu.getProperties();
+}
+
+vk::QueueFamilyProperties Driver::getQueueFamilyProps(u32 _familyIndex)
+{
+    auto queueprops = m_gpu.getQueueFamilyProperties();
+    ASSERT_TRUE(_familyIndex < queueprops.size());
+    return queueprops[_familyIndex];
+}
+
 void Driver::chooseAndInitGpu()
 {
     u32 deviceCount = 0;
@@ -236,3 +306,258 @@ void Driver::chooseAndInitGpu()
         logInfo(ext.extensionName);
 #endif
 }
+
+void Driver::chooseQueues(vector<vk::DeviceQueueCreateInfo>& _queueinfos, vector<float>& _priorities)
+{
+    auto queueprops = m_gpu.getQueueFamilyProperties();
+    u32 familyCount = (u32)queueprops.size();
+
+    auto findFamily = [&](vk::QueueFlags _required, vk::QueueFlags _excluded, bool _present) {
+        for (u32 i = 0; i < familyCount; ++i) {
+            vk::QueueFlags flags = queueprops[i].queueFlags;
+            if ((flags & _required) != _required || (flags & _excluded))
+                continue;
+            if (_present && !m_gpu.getSurfaceSupportKHR(i, m_surface.get()).value)
+                continue;
+            return i;
+        }
+        return familyCount;
+    };
+
+    // Graphics also presents. Compute and transfer prefer families without the other capabilities,
+    // those map to the hardware queues that run alongside the graphics one.
+    u32 families[(u32)QueueType::Count];
+    families[(u32)QueueType::Graphics] = findFamily(vk::QueueFlagBits::eGraphics, {}, !isHeadless());
+    VERIFY_TRUE_MSG(families[(u32)QueueType::Graphics] < familyCount, "No graphics queue family can present");
+
+    families[(u32)QueueType::Compute] = findFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics, false);
+    if (families[(u32)QueueType::Compute] == familyCount)
+        families[(u32)QueueType::Compute] = families[(u32)QueueType::Graphics];
+
+    families[(u32)QueueType::Transfer] = findFamily(vk::QueueFlagBits::eTransfer,
+        vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, false);
+    if (families[(u32)QueueType::Transfer] == familyCount)
+        families[(u32)QueueType::Transfer] = families[(u32)QueueType::Compute];
+
+    // Types falling back to an already used family get the next queue of that family while there is one
+    vector<u32> usedQueues(familyCount, 0);
+    for (u32 type = 0; type < (u32)QueueType::Count; ++type) {
+        u32 family = families[type];
+        u32 index = min(usedQueues[family], queueprops[family].queueCount - 1);
+        usedQueues[family] = max(usedQueues[family], index + 1);
+
+        Queue* queue = nullptr;
+        for (unique_ptr<Queue>& existing : m_queues) {
+            if (existing->m_family == family && existing->m_index == index)
+                queue = existing.get();
+        }
+        if (!queue) {
+            queue = m_queues.emplace_back(std::make_unique<Queue>()).get();
+            queue->m_family = family;
+            queue->m_index = index;
+        }
+        m_queueTypes[type].m_queue = queue;
+    }
+
+    u32 maxQueueCount = 0;
+    for (u32 count : usedQueues)
+        maxQueueCount = max(maxQueueCount, count);
+    _priorities.assign(maxQueueCount, 1.0f);
+
+    for (u32 family = 0; family < familyCount; ++family) {
+        if (!usedQueues[family])
+            continue;
+        vk::DeviceQueueCreateInfo& queueinfo = _queueinfos.emplace_back();
+        queueinfo.setQueueFamilyIndex(family);
+        queueinfo.setQueueCount(usedQueues[family]);
+        queueinfo.setQueuePriorities({ usedQueues[family], _priorities.data() });
+    }
+
+    static constexpr LiteralString C_QueueTypeNames[] = { "Graphics", "Compute", "Transfer" };
+    for (u32 type = 0; type < (u32)QueueType::Count; ++type) {
+        const Queue& queue = *m_queueTypes[type].m_queue;
+        logInfo("{} queue: family {} ({}), index {}", C_QueueTypeNames[type], queue.m_family,
+            vk::to_string(queueprops[queue.m_family].queueFlags), queue.m_index);
+    }
+}
+
+u64 Driver::submit(QueueType _type, const QueueSubmission& _submission)
+{
+    ASSERT_TRUE_MSG(!isNull(), "Nothing can be submitted with the null backend");
+    QueueTypeState& type = m_queueTypes[(u32)_type];
+
+    SmallVector<vk::SemaphoreSubmitInfoKHR, 8> waits;
+    for (const QueueWait& wait : _submission.m_queueWaits) {
+        vk::SemaphoreSubmitInfoKHR& info = waits.emplace_back();
+        info.setSemaphore(getTimeline(wait.m_queue));
+        info.setValue(wait.m_value);
+        info.setStageMask(wait.m_stages);
+    }
+    for (const vk::SemaphoreSubmitInfoKHR& wait : _submission.m_waitSemaphores)
+        waits.push_back(wait);
+
+    SmallVector<vk::CommandBufferSubmitInfoKHR, 8> cmdBuffers;
+    for (vk::CommandBuffer cmd : _submission.m_cmdBuffers)
+        cmdBuffers.emplace_back().setCommandBuffer(cmd);
+
+    SmallVector<vk::SemaphoreSubmitInfoKHR, 4> signals;
+    for (const vk::SemaphoreSubmitInfoKHR& signal : _submission.m_signalSemaphores)
+        signals.push_back(signal);
+
+    std::lock_guard<std::mutex> lock(type.m_queue->m_mutex);
+    u64 value = type.m_lastSubmittedValue;
+    if (_submission.m_signalTimeline) {
+        vk::SemaphoreSubmitInfoKHR& info = signals.emplace_back();
+        info.setSemaphore(type.m_timeline.get());
+        info.setValue(++value);
+        info.setStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+    }
+
+    vk::SubmitInfo2KHR submitinfo;
+    submitinfo.setWaitSemaphoreInfos({ (u32)waits.size(), waits.data() });
+    submitinfo.setCommandBufferInfos({ (u32)cmdBuffers.size(), cmdBuffers.data() });
+    submitinfo.setSignalSemaphoreInfos({ (u32)signals.size(), signals.data() });
+    VK_CHECK(type.m_queue->m_queue.submit2KHR(submitinfo, nullptr, m_loader));
+
+    type.m_lastSubmittedValue = value;
+    return value;
+}
+
+vk::Result Driver::present(const vk::PresentInfoKHR& _info)
+{
+    ASSERT_TRUE_MSG(!isNull(), "Nothing can be presented with the null backend");
+    Queue& queue = *m_queueTypes[(u32)QueueType::Graphics].m_queue;
+    std::lock_guard<std::mutex> lock(queue.m_mutex);
+    return queue.m_queue.presentKHR(_info);
+}
+
+u64 Driver::getCompletedTimelineValue(QueueType _type)
+{
+    // Nothing was submitted, so everything is complete
+    if (isNull())
+        return m_queueTypes[(u32)_type].m_lastSubmittedValue;
+    return m_device->getSemaphoreCounterValue(getTimeline(_type)).value;
+}
+
+void Driver::waitForTimelineValue(QueueType _type, u64 _value)
+{
+    if (isNull())
+        return;
+    vk::Semaphore timeline = getTimeline(_type);
+    vk::SemaphoreWaitInfo waitinfo;
+    waitinfo.setSemaphores({ 1, &timeline });
+    waitinfo.setValues({ 1, &_value });
+    VK_CHECK(m_device->waitSemaphores(waitinfo, C_nsGpuTimeout));
+}
+
+void Driver::initAllocator()
+{
+    m_gpuAllocator = std::make_unique<GpuAllocator>(m_instance.get(), m_gpu, m_device.get(), m_memoryBudgetSupported);
+}
+
+// Stored in front of the driver's cache data. Vulkan validates vendor, device and cache UUID itself,
+// but some drivers crash on foreign data, so everything is checked before handing it over.
+struct PipelineCacheFileHeader
+{
+    static constexpr u32 C_Magic = 0x4f535045; // "EPSO"
+    static constexpr u32 C_Version = 2;
+
+    u32 m_magic;
+    u32 m_version;
+    u32 m_vendorID;
+    u32 m_deviceID;
+    u32 m_driverVersion;
+    u32 m_reserved;
+    u8 m_pipelineCacheUUID[VK_UUID_SIZE];
+    u8 m_deviceUUID[VK_UUID_SIZE];
+    u8 m_driverUUID[VK_UUID_SIZE];
+    u64 m_dataSize;
+    Hash128 m_dataHash;
+};
+
+static PipelineCacheFileHeader makePipelineCacheHeader(Driver& _driver, const vector<u8>& _data)
+{
+    vk::PhysicalDeviceProperties props = _driver.getGpuProps();
+    vk::PhysicalDeviceIDPropertiesKHR id = _driver.getGpuID();
+
+    PipelineCacheFileHeader header = {};
+    header.m_magic = PipelineCacheFileHeader::C_Magic;
+    header.m_version = PipelineCacheFileHeader::C_Version;
+    header.m_vendorID = props.vendorID;
+    header.m_deviceID = props.deviceID;
+    header.m_driverVersion = props.driverVersion;
+    memcpy(header.m_pipelineCacheUUID, props.pipelineCacheUUID.data(), VK_UUID_SIZE);
+    memcpy(header.m_deviceUUID, id.deviceUUID.data(), VK_UUID_SIZE);
+    memcpy(header.m_driverUUID, id.driverUUID.data(), VK_UUID_SIZE);
+    header.m_dataSize = _data.size();
+    header.m_dataHash = hash128(_data.data(), _data.size());
+    return header;
+}
+
+void Driver::initPipelineCache()
+{
+    const std::string& path = globals::getRef<Settings>().m_pipelineCachePath;
+    vector<u8> data;
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (file.is_open()) {
+        std::error_code error;
+        u64 fileSize = std::filesystem::file_size(path, error);
+
+        // Nothing is allocated from the header before the fields that don't depend on the data match this device,
+        // and the data size can't be more than what the file holds
+        PipelineCacheFileHeader header = {};
+        file.read((char*)&header, sizeof(header));
+        PipelineCacheFileHeader expected = makePipelineCacheHeader(*this, data);
+        bool headerValid = !error && file.gcount() == sizeof(header)
+            && !memcmp(&header, &expected, offsetof(PipelineCacheFileHeader, m_dataSize))
+            && header.m_dataSize && header.m_dataSize <= fileSize - sizeof(header);
+
+        if (headerValid) {
+            data.resize(header.m_dataSize);
+            file.read((char*)data.data(), data.size());
+            expected = makePipelineCacheHeader(*this, data);
+            if ((u64)file.gcount() != header.m_dataSize || memcmp(&header, &expected, sizeof(header)))
+                data.clear();
+        }
+
+        if (data.empty())
+            logInfo("Discarding pipeline cache {}, it is corrupted or was created by another gpu or driver", path);
+    }
+
+    vk::PipelineCacheCreateInfo cacheinfo;
+    cacheinfo.setInitialDataSize(data.size());
+    cacheinfo.setPInitialData(data.data());
+    m_pipelineCache = m_device->createPipelineCacheUnique(cacheinfo).value;
+    m_pipelineCacheWarm = !data.empty();
+
+    logInfo("Pipeline cache: {} ({} bytes)", m_pipelineCacheWarm ? "warm" : "cold", data.size());
+}
+
+void Driver::savePipelineCache()
+{
+    const std::string& path = globals::getRef<Settings>().m_pipelineCachePath;
+
+    vector<u8> data = m_device->getPipelineCacheData(m_pipelineCache.get()).value;
+    if (data.empty())
+        return;
+
+    PipelineCacheFileHeader header = makePipelineCacheHeader(*this, data);
+
+    // Write next to the destination and swap it in, so an interrupted write never leaves a truncated cache
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            logError("Failed to write pipeline cache {}", tmpPath);
+            return;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)data.data(), data.size());
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error)
+        logError("Failed to write pipeline cache {}: {}", path, error.message());
+}
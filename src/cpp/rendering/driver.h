@@ -1,6 +1,9 @@
 #pragma once
 
 #include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include "gpu_allocator.h"
+#include <mutex>
 
 struct DriverObjects 
 {
@@ -8,19 +11,85 @@ struct DriverObjects
     vk::Device m_device;
     vk::SurfaceKHR m_surface;
     vk::Queue m_gQueue;
+    // Timeline semaphore signaled by every graphics submission through Driver::submit
+    vk::Semaphore m_gQueueTimeline;
+    // Family of m_gQueue
     u32 m_queueIndex = 0;
+    VmaAllocator m_allocator = nullptr;
+    vk::PipelineCache m_pipelineCache;
 };
 
+enum class QueueType : u8
+{
+    Graphics,
+    // Falls back to a separate queue of the graphics family, or to the graphics queue itself
+    Compute,
+    // Falls back to the compute queue's family, then to the graphics one
+    Transfer,
+    Count
+};
+
+// Waits for the timeline of a queue to reach a value before _stages of the submission
+struct QueueWait
+{
+    QueueType m_queue;
+    u64 m_value;
+    vk::PipelineStageFlags2KHR m_stages;
+};
+
+struct QueueSubmission
+{
+    SmallVector<vk::CommandBuffer, 4> m_cmdBuffers;
+    SmallVector<QueueWait, 4> m_queueWaits;
+    // Binary semaphores, to sync with presentation
+    SmallVector<vk::SemaphoreSubmitInfoKHR, 2> m_waitSemaphores;
+    SmallVector<vk::SemaphoreSubmitInfoKHR, 2> m_signalSemaphores;
+    // Submissions that don't signal the timeline can't be waited on by other queues
+    bool m_signalTimeline = true;
+};
+
+// Stands in for the objects the null backend never creates. It isn't null, so the code checking that a creation
+// succeeded runs as it does with a device. _id only needs to be unique among the handles of a type.
+template <typename T>
+T makeNullBackendHandle(u64 _id)
+{
+    return T((typename T::CType)_id);
+}
+
 class Driver 
 {
 public:
-    Driver(const class Window& _window);
+    // Pass nullptr to create a headless driver without a surface.
+    // With Settings::m_nullBackend no Vulkan object is created at all.
+    Driver(const class Window* _window);
+    ~Driver();
 
     DriverObjects getDriverObjects();
     vk::SurfaceCapabilitiesKHR getCaps();
     vk::PhysicalDeviceIDPropertiesKHR getGpuID();
     vk::PhysicalDeviceMemoryProperties getMemProps();
+    vk::PhysicalDeviceProperties getGpuProps();
+    vk::QueueFamilyProperties getQueueFamilyProps(u32 _familyIndex);
     void nameImage(vk::Image _img, LiteralString _name);
+    bool isHeadless() const { return !m_surface; }
+    // Null backend, there is no instance or device and every handle handed out is null
+    bool isNull() const { return !m_device; }
+    // Whether the pipeline cache was loaded from disk
+    bool isPipelineCacheWarm() const { return m_pipelineCacheWarm; }
+    GpuAllocator& getGpuAllocator() { return *m_gpuAllocator; }
+
+    // Each queue type has its own timeline, even when it shares the vk::Queue of another type.
+    // Queue types sharing a family need no ownership transfers between them.
+    vk::Queue getQueue(QueueType _type) const { return m_queueTypes[(u32)_type].m_queue->m_queue; }
+    u32 getQueueFamily(QueueType _type) const { return m_queueTypes[(u32)_type].m_queue->m_family; }
+    vk::Semaphore getTimeline(QueueType _type) const { return m_queueTypes[(u32)_type].m_timeline.get(); }
+    // Thread-safe, returns the timeline value the submission signals, or the previous one if it doesn't
+    u64 submit(QueueType _type, const QueueSubmission& _submission);
+    vk::Result present(const vk::PresentInfoKHR& _info);
+    u64 getCompletedTimelineValue(QueueType _type);
+    void waitForTimelineValue(QueueType _type, u64 _value);
+    // Extension entry points, e.g. VK_KHR_synchronization2
+    const vk::DispatchLoaderDynamic& getLoader() const { return m_loader; }
 
 private:
     UniqueHandle<vk::Instance> m_instance;
@@ -29,9 +98,34 @@ private:
     UniqueHandle<vk::SurfaceKHR> m_surface;
     UniqueHandle<vk::Device> m_device;
     vk::PhysicalDevice m_gpu;
-    vk::Queue m_gQueue;
-    u32 m_queueIndex;
+
+    // Submissions and presents to a queue have to be serialized
+    struct Queue
+    {
+        vk::Queue m_queue;
+        u32 m_family = 0;
+        u32 m_index = 0;
+        std::mutex m_mutex;
+    };
+    struct QueueTypeState
+    {
+        Queue* m_queue = nullptr;
+        UniqueHandle<vk::Semaphore> m_timeline;
+        // Written with the queue's mutex held
+        u64 m_lastSubmittedValue = 0;
+    };
+    vector<unique_ptr<Queue>> m_queues;
+    QueueTypeState m_queueTypes[(u32)QueueType::Count];
+    unique_ptr<GpuAllocator> m_gpuAllocator;
+    bool m_memoryBudgetSupported = false;
+    UniqueHandle<vk::PipelineCache> m_pipelineCache;
+    bool m_pipelineCacheWarm = false;
 
     void chooseAndInitGpu();
+    // Picks the family and queue index of each queue type, fills the queue create infos
+    void chooseQueues(vector<vk::DeviceQueueCreateInfo>& _queueinfos, vector<float>& _priorities);
+    void initAllocator();
+    void initPipelineCache();
+    void savePipelineCache();
 
 };
@@ -0,0 +1,402 @@
+#include "common.h"
+
+#include "frame_capture.h"
+#include "driver.h"
+#include "deferred_release.h"
+#include "upload_manager.h"
+#include "globals.h"
+#include "core/binary_stream.h"
+#include "core/cpu_profiler.h"
+#include "core/job_system.h"
+
+// Bump when the events or what they store change
+constexpr u32 C_CaptureMagic = 0x50435245; // "ERCP"
+constexpr u32 C_CaptureVersion = 5;
+// The replay allocates its upload buffer from the largest upload in the file, anything above the staging ring
+// size is treated as corruption rather than trusted
+constexpr u64 C_MaxReplayUploadSize = 64ull * 1024 * 1024;
+// Same for created resources, the limits are the ones every Vulkan 1.2 gpu supports
+constexpr u64 C_MaxReplayBufferSize = 1024ull * 1024 * 1024;
+constexpr u32 C_MaxReplayImageDimension = 16384;
+constexpr u32 C_MaxReplayImageLayers = 2048;
+
+// Every event belongs to the last Frame before it. Pipelines are numbered in the order they appear.
+enum class CaptureEvent : u32
+{
+    // dims
+    Frame,
+    // GraphicsPipelineDesc
+    Pipeline,
+    // pipeline index, u64 sort key without the pipeline and depth, vertex count, instance count, first vertex,
+    // first instance, packet count
+    DrawRun,
+    // CaptureUploadType, u64 size
+    Upload,
+    // GpuMemoryPool, u64 size, usage
+    CreateBuffer,
+    // GpuMemoryPool, type, format, width, height, depth, mip count, layer count, samples, tiling, usage
+    CreateImage
+};
+
+// The renderer creates these itself when replaying, capturing them would count them twice
+static bool isCapturedPool(GpuMemoryPool _pool)
+{
+    return _pool != GpuMemoryPool::RenderTargets && _pool != GpuMemoryPool::StreamingUpload;
+}
+
+// Invalidates the reader when the value is outside of [_min, _max]
+static u32 readInRange(BinaryReader& _reader, u32 _min, u32 _max)
+{
+    u32 value = _reader.readU32();
+    if (value < _min || value > _max) {
+        _reader.m_valid = false;
+        return _min;
+    }
+    return value;
+}
+
+static void writeBufferCreation(BinaryWriter& _writer, const vk::BufferCreateInfo& _info, GpuMemoryPool _pool)
+{
+    _writer.writeU32((u32)CaptureEvent::CreateBuffer);
+    _writer.writeU32((u32)_pool);
+    _writer.writeU64(_info.size);
+    _writer.writeU32((u32)(VkBufferUsageFlags)_info.usage);
+}
+
+// Only core usages are replayed, the create flags are dropped
+static vk::BufferCreateInfo readBufferCreation(BinaryReader& _reader, u64 _size)
+{
+    constexpr u32 C_BufferUsageMask = (u32)(VkBufferUsageFlags)(vk::BufferUsageFlagBits::eTransferSrc
+        | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eUniformTexelBuffer
+        | vk::BufferUsageFlagBits::eStorageTexelBuffer | vk::BufferUsageFlagBits::eUniformBuffer
+        | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndexBuffer
+        | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+
+    vk::BufferCreateInfo info;
+    info.setSize(_size);
+    u32 usage = _reader.readU32();
+    if (!usage || (usage & ~C_BufferUsageMask))
+        _reader.m_valid = false;
+    info.setUsage((vk::BufferUsageFlags)usage);
+    return info;
+}
+
+static void writeImageCreation(BinaryWriter& _writer, const vk::ImageCreateInfo& _info, GpuMemoryPool _pool)
+{
+    _writer.writeU32((u32)CaptureEvent::CreateImage);
+    _writer.writeU32((u32)_pool);
+    _writer.writeU32((u32)_info.imageType);
+    _writer.writeU32((u32)_info.format);
+    _writer.writeU32(_info.extent.width);
+    _writer.writeU32(_info.extent.height);
+    _writer.writeU32(_info.extent.depth);
+    _writer.writeU32(_info.mipLevels);
+    _writer.writeU32(_info.arrayLayers);
+    _writer.writeU32((u32)_info.samples);
+    _writer.writeU32((u32)_info.tiling);
+    _writer.writeU32((u32)(VkImageUsageFlags)_info.usage);
+}
+
+static vk::ImageCreateInfo readImageCreation(BinaryReader& _reader)
+{
+    constexpr u32 C_ImageUsageMask = (u32)(VkImageUsageFlags)(vk::ImageUsageFlagBits::eTransferSrc
+        | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage
+        | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment
+        | vk::ImageUsageFlagBits::eTransientAttachment | vk::ImageUsageFlagBits::eInputAttachment);
+
+    vk::ImageCreateInfo info;
+    info.setImageType((vk::ImageType)readInRange(_reader, 0, (u32)vk::ImageType::e3D));
+    info.setFormat((vk::Format)readInRange(_reader, 1, (u32)vk::Format::eAstc12x12SrgbBlock));
+    u32 width = readInRange(_reader, 1, C_MaxReplayImageDimension);
+    u32 height = readInRange(_reader, 1, C_MaxReplayImageDimension);
+    u32 depth = readInRange(_reader, 1, C_MaxReplayImageDimension);
+    info.setExtent({ width, height, depth });
+    info.setMipLevels(readInRange(_reader, 1, 15));
+    info.setArrayLayers(readInRange(_reader, 1, C_MaxReplayImageLayers));
+    u32 samples = readInRange(_reader, 1, 64);
+    if (samples & (samples - 1))
+        _reader.m_valid = false;
+    info.setSamples((vk::SampleCountFlagBits)samples);
+    info.setTiling((vk::ImageTiling)readInRange(_reader, 0, (u32)vk::ImageTiling::eLinear));
+    u32 usage = _reader.readU32();
+    if (!usage || (usage & ~C_ImageUsageMask))
+        _reader.m_valid = false;
+    info.setUsage((vk::ImageUsageFlags)usage);
+    return info;
+}
+
+// Depths aren't stored, packets are captured sorted and replayed from a single thread so the stable sort keeps
+// their order. Draws with unique depths still form runs.
+static bool continuesRun(const DrawPacket& _first, const DrawPacket& _packet, u32 _index)
+{
+    return (_packet.m_sortKey & ~C_SortKeyDepthMask) == (_first.m_sortKey & ~C_SortKeyDepthMask)
+        && _packet.m_vertexCount == _first.m_vertexCount
+        && _packet.m_instanceCount == _first.m_instanceCount && _packet.m_firstVertex == _first.m_firstVertex
+        && _packet.m_firstInstance == _first.m_firstInstance + _index;
+}
+
+FrameCapture::FrameCapture(const std::string& _path)
+    : m_path(_path)
+{
+    m_file.open(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file.is_open()) {
+        logError("Failed to open frame capture {}, nothing will be captured", _path);
+        return;
+    }
+
+    BinaryWriter writer;
+    writer.writeU32(C_CaptureMagic);
+    writer.writeU32(C_CaptureVersion);
+    m_file.write(writer.m_data.data(), writer.m_data.size());
+    m_bytesWritten = writer.m_data.size();
+}
+
+FrameCapture::~FrameCapture()
+{
+    if (m_file.is_open())
+        logInfo("Captured {} frames to {}, {:.1f} KiB", m_frameCount, m_path, m_bytesWritten / 1024.0);
+}
+
+void FrameCapture::recordFrame(uint2 _dims, const vector<DrawPacket>& _packets)
+{
+    PROFILE_SCOPE("FrameCapture::recordFrame");
+    if (!m_file.is_open())
+        return;
+
+    BinaryWriter writer;
+    writer.writeU32((u32)CaptureEvent::Frame);
+    writer.writeU32(_dims.x);
+    writer.writeU32(_dims.y);
+
+    const PsoManager& psoManager = globals::getRef<PsoManager>();
+    for (size_t i = 0; i < _packets.size();) {
+        const DrawPacket& first = _packets[i];
+        u32 count = 1;
+        while (i + count < _packets.size() && continuesRun(first, _packets[i + count], count))
+            ++count;
+
+        // Handles are only meaningful in this run, the pipeline is stored as its index in the capture
+        PipelineHandle pipeline = getSortKeyPipeline(first.m_sortKey);
+        auto it = m_pipelineIndices.find(pipeline);
+        if (it == m_pipelineIndices.end()) {
+            it = m_pipelineIndices.emplace(pipeline, (u32)m_pipelineIndices.size()).first;
+            writer.writeU32((u32)CaptureEvent::Pipeline);
+            writePipelineDesc(writer, psoManager.getPipelineDesc(pipeline));
+        }
+
+        writer.writeU32((u32)CaptureEvent::DrawRun);
+        writer.writeU32(it->second);
+        writer.writeU64(setSortKeyPipeline(first.m_sortKey, 0) & ~C_SortKeyDepthMask);
+        writer.writeU32(first.m_vertexCount);
+        writer.writeU32(first.m_instanceCount);
+        writer.writeU32(first.m_firstVertex);
+        writer.writeU32(first.m_firstInstance);
+        writer.writeU32(count);
+        i += count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        // Resources are created before the uploads that fill them
+        writer.m_data += m_pendingCreations.m_data;
+        m_pendingCreations.m_data.clear();
+        for (const Upload& upload : m_pendingUploads) {
+            writer.writeU32((u32)CaptureEvent::Upload);
+            writer.writeU32((u32)upload.m_type);
+            writer.writeU64(upload.m_size);
+        }
+        m_pendingUploads.clear();
+        m_framesStarted = true;
+    }
+
+    if (!m_file.write(writer.m_data.data(), writer.m_data.size()) || !m_file.flush()) {
+        logError("Failed to write frame capture {}, stopped after {} frames", m_path, m_frameCount);
+        m_file.close();
+        return;
+    }
+    m_bytesWritten += writer.m_data.size();
+    m_frameCount++;
+}
+
+void FrameCapture::recordUpload(CaptureUploadType _type, u64 _size)
+{
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_pendingUploads.push_back({ _type, _size });
+}
+
+void FrameCapture::recordBufferCreation(const vk::BufferCreateInfo& _info, GpuMemoryPool _pool)
+{
+    if (!isCapturedPool(_pool))
+        return;
+
+    // Resources created before the first frame are startup work, the replay does its own
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    if (m_framesStarted)
+        writeBufferCreation(m_pendingCreations, _info, _pool);
+}
+
+void FrameCapture::recordImageCreation(const vk::ImageCreateInfo& _info, GpuMemoryPool _pool)
+{
+    if (!isCapturedPool(_pool))
+        return;
+
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    if (m_framesStarted)
+        writeImageCreation(m_pendingCreations, _info, _pool);
+}
+
+FrameReplay::~FrameReplay()
+{
+    if (m_uploadTarget)
+        globals::getRef<DeferredReleaseQueue>().retire(m_uploadTarget, m_uploadAllocation);
+}
+
+bool FrameReplay::load(const std::string& _path)
+{
+    PROFILE_SCOPE("FrameReplay::load");
+    std::ifstream file(_path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        logError("Failed to open frame capture {}", _path);
+        return false;
+    }
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    BinaryReader reader = { data.data(), data.data() + data.size() };
+    if (reader.readU32() != C_CaptureMagic || reader.readU32() != C_CaptureVersion) {
+        logError("Frame capture {} was written by another version", _path);
+        return false;
+    }
+
+    PsoManager& psoManager = globals::getRef<PsoManager>();
+    u64 maxUploadSize = 0;
+    while (reader.m_valid && !reader.atEnd()) {
+        CaptureEvent event = (CaptureEvent)reader.readU32();
+        if (event != CaptureEvent::Frame && m_frames.empty()) {
+            reader.m_valid = false;
+            break;
+        }
+
+        switch (event) {
+        case CaptureEvent::Frame: {
+            Frame& frame = m_frames.emplace_back();
+            frame.m_dims.x = reader.readU32();
+            frame.m_dims.y = reader.readU32();
+            break;
+        }
+        case CaptureEvent::Pipeline: {
+            GraphicsPipelineDesc desc = readPipelineDesc(reader);
+            if (reader.m_valid)
+                m_pipelines.push_back(psoManager.requestPipeline(desc));
+            break;
+        }
+        case CaptureEvent::DrawRun: {
+            DrawRun run;
+            u32 pipeline = reader.readU32();
+            run.m_first.m_sortKey = reader.readU64();
+            run.m_first.m_vertexCount = reader.readU32();
+            run.m_first.m_instanceCount = reader.readU32();
+            run.m_first.m_firstVertex = reader.readU32();
+            run.m_first.m_firstInstance = reader.readU32();
+            run.m_count = reader.readU32();
+            if (pipeline >= m_pipelines.size()) {
+                reader.m_valid = false;
+                break;
+            }
+            run.m_first.m_sortKey = setSortKeyPipeline(run.m_first.m_sortKey, m_pipelines[pipeline]);
+            m_frames.back().m_draws.push_back(run);
+            break;
+        }
+        case CaptureEvent::Upload: {
+            Upload upload;
+            upload.m_type = (CaptureUploadType)reader.readU32();
+            upload.m_size = reader.readU64();
+            if (upload.m_type > CaptureUploadType::Image || !upload.m_size || upload.m_size > C_MaxReplayUploadSize) {
+                reader.m_valid = false;
+                break;
+            }
+            maxUploadSize = max(maxUploadSize, upload.m_size);
+            m_frames.back().m_uploads.push_back(upload);
+            break;
+        }
+        case CaptureEvent::CreateBuffer: {
+            BufferCreation creation;
+            creation.m_pool = (GpuMemoryPool)readInRange(reader, 0, (u32)GpuMemoryPool::Count - 1);
+            u64 size = reader.readU64();
+            if (!size || size > C_MaxReplayBufferSize) {
+                reader.m_valid = false;
+                break;
+            }
+            creation.m_info = readBufferCreation(reader, size);
+            if (reader.m_valid)
+                m_frames.back().m_buffers.push_back(creation);
+            break;
+        }
+        case CaptureEvent::CreateImage: {
+            ImageCreation creation;
+            creation.m_pool = (GpuMemoryPool)readInRange(reader, 0, (u32)GpuMemoryPool::Count - 1);
+            creation.m_info = readImageCreation(reader);
+            if (reader.m_valid)
+                m_frames.back().m_images.push_back(creation);
+            break;
+        }
+        default:
+            reader.m_valid = false;
+            break;
+        }
+    }
+
+    if (!reader.m_valid || m_frames.empty()) {
+        logError("Frame capture {} is truncated or corrupted", _path);
+        m_frames.clear();
+        return false;
+    }
+
+    if (maxUploadSize) {
+        vk::BufferCreateInfo bufferinfo;
+        bufferinfo.setSize(maxUploadSize);
+        bufferinfo.setUsage(vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer);
+        m_uploadTarget = globals::getRef<Driver>().getGpuAllocator().createBuffer(bufferinfo, GpuMemoryPool::Default,
+            &m_uploadAllocation);
+        // The null backend drops uploads, its target stays null
+        VERIFY_TRUE_MSG(m_uploadTarget || globals::getRef<Driver>().isNull(), "No gpu memory left for the {} MiB replay upload target",
+            maxUploadSize / (1024 * 1024));
+        m_uploadData.resize(maxUploadSize);
+    }
+
+    // Pipeline creation would dominate the first frames otherwise
+    psoManager.flush();
+    logInfo("Loaded {} frames and {} pipelines from frame capture {}", m_frames.size(), m_pipelines.size(), _path);
+    return true;
+}
+
+void FrameReplay::nextFrame(uint2& _dims, DrawPacketQueue& _packets)
+{
+    const Frame& frame = m_frames[m_nextFrame];
+    m_nextFrame = (m_nextFrame + 1) % (u32)m_frames.size();
+
+    _dims = frame.m_dims;
+    u32 threadIndex = globals::getRef<JobSystem>().getCurrentThreadIndex();
+    for (const DrawRun& run : frame.m_draws) {
+        DrawPacket packet = run.m_first;
+        for (u32 i = 0; i < run.m_count; ++i, ++packet.m_firstInstance)
+            _packets.emit(threadIndex, packet);
+    }
+
+    // Only the creation and the memory it holds until the frame completes are reproduced, nothing uses them
+    GpuAllocator& allocator = globals::getRef<Driver>().getGpuAllocator();
+    DeferredReleaseQueue& deferredRelease = globals::getRef<DeferredReleaseQueue>();
+    for (const BufferCreation& creation : frame.m_buffers) {
+        VmaAllocation allocation = nullptr;
+        if (vk::Buffer buffer = allocator.createBuffer(creation.m_info, creation.m_pool, &allocation))
+            deferredRelease.retire(buffer, allocation);
+    }
+    for (const ImageCreation& creation : frame.m_images) {
+        VmaAllocation allocation = nullptr;
+        if (vk::Image image = allocator.createImage(creation.m_info, creation.m_pool, &allocation))
+            deferredRelease.retire(image, allocation);
+    }
+
+    UploadManager& uploadManager = globals::getRef<UploadManager>();
+    for (const Upload& upload : frame.m_uploads)
+        uploadManager.uploadBuffer(m_uploadTarget, 0, m_uploadData.data(), upload.m_size);
+}
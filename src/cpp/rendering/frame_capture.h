@@ -0,0 +1,123 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include "draw_packets.h"
+#include "gpu_allocator.h"
+#include "core/binary_stream.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+
+enum class CaptureUploadType : u8
+{
+    Buffer,
+    Image
+};
+
+// Writes the work each frame issues to a binary file: the viewport size, the pipelines it creates and binds, its
+// sorted draw packets, the buffers and images it creates and the size of its uploads. Packets only differing by
+// their depth and a first instance one above the previous one are stored as a single run. Each frame is flushed
+// once recorded, so a run that is killed keeps the frames before.
+// Only resources created once frames are running are captured, and neither render targets nor staging buffers:
+// the replaying renderer creates those itself at startup, on resize and for its uploads.
+class FrameCapture
+{
+public:
+    FrameCapture(const std::string& _path);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Render thread. Uploads recorded since the previous frame are stored with this one.
+    void recordFrame(uint2 _dims, const vector<DrawPacket>& _packets);
+    // Thread-safe, the contents aren't captured
+    void recordUpload(CaptureUploadType _type, u64 _size);
+    // Thread-safe, called by the GpuAllocator for every resource it creates
+    void recordBufferCreation(const vk::BufferCreateInfo& _info, GpuMemoryPool _pool);
+    void recordImageCreation(const vk::ImageCreateInfo& _info, GpuMemoryPool _pool);
+
+private:
+    struct Upload
+    {
+        CaptureUploadType m_type;
+        u64 m_size;
+    };
+
+    std::string m_path;
+    std::ofstream m_file;
+    u64 m_frameCount = 0;
+    u64 m_bytesWritten = 0;
+    // Index in the capture of every pipeline written so far
+    flat_hash_map<PipelineHandle, u32> m_pipelineIndices;
+
+    // Guards everything recorded between two frames
+    std::mutex m_pendingMutex;
+    bool m_framesStarted = false;
+    vector<Upload> m_pendingUploads;
+    // Creation events, already serialized
+    BinaryWriter m_pendingCreations;
+};
+
+// Plays a capture back through the renderer, frame after frame and from the start again once all were played.
+// Uploads go to a buffer owned by the replay, images are uploaded as buffers of the same size. Resources created
+// by the captured frames are created again and released once the frame completes.
+class FrameReplay
+{
+public:
+    FrameReplay() = default;
+    ~FrameReplay();
+
+    FrameReplay(const FrameReplay&) = delete;
+    FrameReplay& operator=(const FrameReplay&) = delete;
+
+    // Creates the capture's pipelines before returning, false if the file is missing or invalid
+    bool load(const std::string& _path);
+    u32 getFrameCount() const { return (u32)m_frames.size(); }
+
+    // Creates the resources and issues the uploads of the next frame and emits its draw packets from the calling thread
+    void nextFrame(uint2& _dims, DrawPacketQueue& _packets);
+
+private:
+    struct DrawRun
+    {
+        DrawPacket m_first;
+        u32 m_count;
+    };
+
+    struct Upload
+    {
+        CaptureUploadType m_type;
+        u64 m_size;
+    };
+
+    struct BufferCreation
+    {
+        GpuMemoryPool m_pool;
+        vk::BufferCreateInfo m_info;
+    };
+
+    struct ImageCreation
+    {
+        GpuMemoryPool m_pool;
+        vk::ImageCreateInfo m_info;
+    };
+
+    struct Frame
+    {
+        uint2 m_dims;
+        vector<DrawRun> m_draws;
+        vector<Upload> m_uploads;
+        vector<BufferCreation> m_buffers;
+        vector<ImageCreation> m_images;
+    };
+
+    vector<PipelineHandle> m_pipelines;
+    vector<Frame> m_frames;
+    u32 m_nextFrame = 0;
+
+    vk::Buffer m_uploadTarget;
+    VmaAllocation m_uploadAllocation = nullptr;
+    vector<u8> m_uploadData;
+};
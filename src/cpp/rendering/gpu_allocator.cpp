@@ -0,0 +1,301 @@
+#include "common.h"
+
+#include "gpu_allocator.h"
+#include "frame_capture.h"
+#include "globals.h"
+#include "core/cpu_profiler.h"
+#include <fstream>
+#include <iterator>
+
+static constexpr LiteralString C_PoolNames[] = { "default", "render target", "static geometry", "streaming upload" };
+static_assert(std::size(C_PoolNames) == (u32)GpuMemoryPool::Count);
+
+static constexpr double C_MiB = 1024.0 * 1024.0;
+
+// Custom pools can't hold allocations bigger than a block, those larger than half a block get their own memory
+static constexpr u64 C_PoolBlockSize = 128ull * 1024 * 1024;
+
+GpuAllocator::GpuAllocator(vk::Instance _instance, vk::PhysicalDevice _gpu, vk::Device _device, bool _memoryBudgetSupported)
+    : m_device(_device)
+{
+    if (!_device) {
+        logInfo("Gpu allocator: no device, every resource is null");
+        return;
+    }
+
+    VmaAllocatorCreateInfo allocatorinfo = {};
+    allocatorinfo.vulkanApiVersion = VK_API_VERSION_1_2;
+    allocatorinfo.instance = _instance;
+    allocatorinfo.physicalDevice = _gpu;
+    allocatorinfo.device = _device;
+    // Without the extension vma estimates the budget as a fraction of the heap size
+    if (_memoryBudgetSupported)
+        allocatorinfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    VK_CHECK(vk::Result(vmaCreateAllocator(&allocatorinfo, &m_allocator)));
+
+    m_heapCount = _gpu.getMemoryProperties().memoryHeapCount;
+    createPools();
+
+    logInfo("Gpu allocator: {} heaps, budgets {}", m_heapCount,
+        _memoryBudgetSupported ? "from VK_EXT_memory_budget" : "estimated from heap sizes");
+}
+
+GpuAllocator::~GpuAllocator()
+{
+    if (!m_allocator)
+        return;
+    for (VmaPool pool : m_pools) {
+        if (pool)
+            vmaDestroyPool(m_allocator, pool);
+    }
+    vmaDestroyAllocator(m_allocator);
+}
+
+void GpuAllocator::createPools()
+{
+    // The memory type of each pool is chosen for a typical resource of its kind
+    vk::ImageCreateInfo renderTargetInfo;
+    renderTargetInfo.setImageType(vk::ImageType::e2D);
+    renderTargetInfo.setFormat(vk::Format::eR8G8B8A8Unorm);
+    renderTargetInfo.setExtent({ 1024, 1024, 1 });
+    renderTargetInfo.setMipLevels(1);
+    renderTargetInfo.setArrayLayers(1);
+    renderTargetInfo.setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled);
+
+    vk::BufferCreateInfo geometryInfo;
+    geometryInfo.setSize(64 * 1024);
+    geometryInfo.setUsage(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer
+        | vk::BufferUsageFlagBits::eTransferDst);
+
+    vk::BufferCreateInfo uploadInfo;
+    uploadInfo.setSize(64 * 1024);
+    uploadInfo.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+
+    for (u32 i = 1; i < (u32)GpuMemoryPool::Count; ++i) {
+        GpuMemoryPool pool = (GpuMemoryPool)i;
+        VmaAllocationCreateInfo allocinfo = {};
+        allocinfo.usage = pool == GpuMemoryPool::StreamingUpload ? VMA_MEMORY_USAGE_CPU_ONLY : VMA_MEMORY_USAGE_GPU_ONLY;
+
+        VkResult result;
+        if (pool == GpuMemoryPool::RenderTargets) {
+            const VkImageCreateInfo& rawinfo = renderTargetInfo;
+            result = vmaFindMemoryTypeIndexForImageInfo(m_allocator, &rawinfo, &allocinfo, &m_poolMemoryTypes[i]);
+        } else {
+            const VkBufferCreateInfo& rawinfo = pool == GpuMemoryPool::StaticGeometry ? geometryInfo : uploadInfo;
+            result = vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &rawinfo, &allocinfo, &m_poolMemoryTypes[i]);
+        }
+        VK_CHECK(vk::Result(result));
+
+        VmaPoolCreateInfo poolinfo = {};
+        poolinfo.memoryTypeIndex = m_poolMemoryTypes[i];
+        poolinfo.blockSize = C_PoolBlockSize;
+        VK_CHECK(vk::Result(vmaCreatePool(m_allocator, &poolinfo, &m_pools[i])));
+    }
+}
+
+VmaAllocationCreateInfo GpuAllocator::getAllocationInfo(GpuMemoryPool _pool, const vk::MemoryRequirements& _requirements) const
+{
+    VmaAllocationCreateInfo allocinfo = {};
+    allocinfo.flags = VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+    allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    if (_pool == GpuMemoryPool::StreamingUpload) {
+        allocinfo.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocinfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    }
+
+    // vma doesn't check that the pool's memory type suits the resource
+    bool fitsPool = _requirements.size <= C_PoolBlockSize / 2
+        && (_requirements.memoryTypeBits & (1u << m_poolMemoryTypes[(u32)_pool]));
+    if (fitsPool)
+        allocinfo.pool = m_pools[(u32)_pool];
+    return allocinfo;
+}
+
+vk::Buffer GpuAllocator::createBuffer(const vk::BufferCreateInfo& _info, GpuMemoryPool _pool, VmaAllocation* _allocation,
+    void** _mappedData)
+{
+    *_allocation = nullptr;
+    if (!m_allocator)
+        return vk::Buffer();
+    vk::Buffer buffer = m_device.createBuffer(_info).value;
+    VmaAllocationCreateInfo allocinfo = getAllocationInfo(_pool, m_device.getBufferMemoryRequirements(buffer));
+
+    VmaAllocationInfo result = {};
+    VkResult allocResult = vmaAllocateMemoryForBuffer(m_allocator, buffer, &allocinfo, _allocation, &result);
+    if (allocResult != VK_SUCCESS) {
+        logError("Failed to allocate a {} byte buffer in the {} pool: {}", _info.size, C_PoolNames[(u32)_pool],
+            vk::to_string(vk::Result(allocResult)));
+        m_device.destroyBuffer(buffer);
+        return vk::Buffer();
+    }
+    VK_CHECK(vk::Result(vmaBindBufferMemory(m_allocator, *_allocation, buffer)));
+
+    recordAllocation(*_allocation);
+    if (_mappedData)
+        *_mappedData = result.pMappedData;
+    if (FrameCapture* capture = globals::getPtr<FrameCapture>())
+        capture->recordBufferCreation(_info, _pool);
+    return buffer;
+}
+
+vk::Image GpuAllocator::createImage(const vk::ImageCreateInfo& _info, GpuMemoryPool _pool, VmaAllocation* _allocation)
+{
+    *_allocation = nullptr;
+    if (!m_allocator)
+        return vk::Image();
+    vk::Image image = m_device.createImage(_info).value;
+    VmaAllocationCreateInfo allocinfo = getAllocationInfo(_pool, m_device.getImageMemoryRequirements(image));
+
+    VkResult allocResult = vmaAllocateMemoryForImage(m_allocator, image, &allocinfo, _allocation, nullptr);
+    if (allocResult != VK_SUCCESS) {
+        logError("Failed to allocate a {}x{} {} image in the {} pool: {}", _info.extent.width, _info.extent.height,
+            vk::to_string(_info.format), C_PoolNames[(u32)_pool], vk::to_string(vk::Result(allocResult)));
+        m_device.destroyImage(image);
+        return vk::Image();
+    }
+    VK_CHECK(vk::Result(vmaBindImageMemory(m_allocator, *_allocation, image)));
+
+    recordAllocation(*_allocation);
+    if (FrameCapture* capture = globals::getPtr<FrameCapture>())
+        capture->recordImageCreation(_info, _pool);
+    return image;
+}
+
+VmaAllocation GpuAllocator::allocateMemory(const vk::MemoryRequirements& _requirements, GpuMemoryPool _pool)
+{
+    if (!m_allocator)
+        return nullptr;
+    VmaAllocationCreateInfo allocinfo = getAllocationInfo(_pool, _requirements);
+    const VkMemoryRequirements& rawRequirements = _requirements;
+
+    VmaAllocation allocation = nullptr;
+    VkResult allocResult = vmaAllocateMemory(m_allocator, &rawRequirements, &allocinfo, &allocation, nullptr);
+    if (allocResult != VK_SUCCESS) {
+        logError("Failed to allocate {} bytes in the {} pool: {}", _requirements.size, C_PoolNames[(u32)_pool],
+            vk::to_string(vk::Result(allocResult)));
+        return nullptr;
+    }
+
+    recordAllocation(allocation);
+    return allocation;
+}
+
+void GpuAllocator::bindImageMemory(vk::Image _image, VmaAllocation _allocation, u64 _offset)
+{
+    if (!m_allocator)
+        return;
+    VK_CHECK(vk::Result(vmaBindImageMemory2(m_allocator, _allocation, _offset, static_cast<VkImage>(_image), nullptr)));
+}
+
+void GpuAllocator::destroyBuffer(vk::Buffer _buffer, VmaAllocation _allocation)
+{
+    if (!m_allocator)
+        return;
+    if (_allocation)
+        recordFree(_allocation);
+    vmaDestroyBuffer(m_allocator, static_cast<VkBuffer>(_buffer), _allocation);
+}
+
+void GpuAllocator::destroyImage(vk::Image _image, VmaAllocation _allocation)
+{
+    if (!m_allocator)
+        return;
+    if (_allocation)
+        recordFree(_allocation);
+    vmaDestroyImage(m_allocator, static_cast<VkImage>(_image), _allocation);
+}
+
+void GpuAllocator::free(VmaAllocation _allocation)
+{
+    if (!m_allocator || !_allocation)
+        return;
+    recordFree(_allocation);
+    vmaFreeMemory(m_allocator, _allocation);
+}
+
+void GpuAllocator::recordAllocation(VmaAllocation _allocation)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(m_allocator, _allocation, &info);
+    m_frameAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    m_frameAllocatedBytes.fetch_add(info.size, std::memory_order_relaxed);
+}
+
+void GpuAllocator::recordFree(VmaAllocation _allocation)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(m_allocator, _allocation, &info);
+    m_frameFreeCount.fetch_add(1, std::memory_order_relaxed);
+    m_frameFreedBytes.fetch_add(info.size, std::memory_order_relaxed);
+}
+
+void GpuAllocator::beginFrame(u64 _frameNum)
+{
+    PROFILE_SCOPE("GpuAllocator::beginFrame");
+
+    m_lastFrameStats.m_allocationCount = m_frameAllocationCount.exchange(0, std::memory_order_relaxed);
+    m_lastFrameStats.m_freeCount = m_frameFreeCount.exchange(0, std::memory_order_relaxed);
+    m_lastFrameStats.m_allocatedBytes = m_frameAllocatedBytes.exchange(0, std::memory_order_relaxed);
+    m_lastFrameStats.m_freedBytes = m_frameFreedBytes.exchange(0, std::memory_order_relaxed);
+    if (!m_allocator)
+        return;
+
+    // Also refreshes the budgets queried from the driver
+    vmaSetCurrentFrameIndex(m_allocator, (u32)_frameNum);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetBudget(m_allocator, budgets);
+    for (u32 heap = 0; heap < m_heapCount; ++heap) {
+        u32 heapBit = 1u << heap;
+        bool overBudget = budgets[heap].usage > budgets[heap].budget;
+        if (overBudget && !(m_overBudgetHeaps & heapBit)) {
+            logError("Gpu heap {} is over budget: {:.1f} MiB used, {:.1f} MiB available", heap,
+                budgets[heap].usage / C_MiB, budgets[heap].budget / C_MiB);
+        }
+        m_overBudgetHeaps = overBudget ? m_overBudgetHeaps | heapBit : m_overBudgetHeaps & ~heapBit;
+    }
+}
+
+std::string GpuAllocator::buildStatsJson(bool _detailedMap)
+{
+    if (!m_allocator)
+        return "{}";
+    char* stats = nullptr;
+    vmaBuildStatsString(m_allocator, &stats, _detailedMap ? VK_TRUE : VK_FALSE);
+    std::string json = stats ? stats : "";
+    vmaFreeStatsString(m_allocator, stats);
+    return json;
+}
+
+void GpuAllocator::logBudgets()
+{
+    if (!m_allocator)
+        return;
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetBudget(m_allocator, budgets);
+    for (u32 heap = 0; heap < m_heapCount; ++heap) {
+        logInfo("Gpu heap {}: {:.1f} MiB used of a {:.1f} MiB budget, {:.1f} MiB in blocks, {:.1f} MiB allocated", heap,
+            budgets[heap].usage / C_MiB, budgets[heap].budget / C_MiB,
+            budgets[heap].blockBytes / C_MiB, budgets[heap].allocationBytes / C_MiB);
+    }
+
+    for (u32 i = 1; i < (u32)GpuMemoryPool::Count; ++i) {
+        VmaPoolStats stats;
+        vmaGetPoolStats(m_allocator, m_pools[i], &stats);
+        logInfo("Gpu {} pool: {} allocations, {:.1f} MiB reserved, {:.1f} MiB unused", C_PoolNames[i],
+            stats.allocationCount, stats.size / C_MiB, stats.unusedSize / C_MiB);
+    }
+}
+
+void GpuAllocator::writeStats(const std::string& _path)
+{
+    logBudgets();
+
+    std::ofstream file(_path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        logError("Failed to write gpu memory statistics {}", _path);
+        return;
+    }
+    file << buildStatsJson(true);
+    logInfo("Gpu memory statistics written to {}", _path);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include <atomic>
+#include <string>
+
+enum class GpuMemoryPool : u8
+{
+    // Device local, anything without a dedicated pool
+    Default,
+    // Device local attachments, recreated on resize
+    RenderTargets,
+    // Device local vertex and index buffers, filled once through a transfer
+    StaticGeometry,
+    // Host visible and persistently mapped, source of transfers to the gpu
+    StreamingUpload,
+    Count
+};
+
+struct GpuFrameMemoryStats
+{
+    u32 m_allocationCount = 0;
+    u32 m_freeCount = 0;
+    u64 m_allocatedBytes = 0;
+    u64 m_freedBytes = 0;
+};
+
+// Owns the VmaAllocator. Resources are created in the pool matching their usage and never past the heap
+// budget reported by VK_EXT_memory_budget, they are null instead. Thread-safe.
+// Without a device, for the null backend, there is no VmaAllocator and every resource is null.
+class GpuAllocator
+{
+public:
+    GpuAllocator(vk::Instance _instance, vk::PhysicalDevice _gpu, vk::Device _device, bool _memoryBudgetSupported);
+    ~GpuAllocator();
+
+    GpuAllocator(const GpuAllocator&) = delete;
+    GpuAllocator& operator=(const GpuAllocator&) = delete;
+
+    VmaAllocator getVmaAllocator() const { return m_allocator; }
+
+    // _mappedData receives the persistent mapping of host visible allocations
+    vk::Buffer createBuffer(const vk::BufferCreateInfo& _info, GpuMemoryPool _pool, VmaAllocation* _allocation,
+        void** _mappedData = nullptr);
+    vk::Image createImage(const vk::ImageCreateInfo& _info, GpuMemoryPool _pool, VmaAllocation* _allocation);
+    // Memory for resources the caller places and binds itself, null when over budget
+    VmaAllocation allocateMemory(const vk::MemoryRequirements& _requirements, GpuMemoryPool _pool);
+    void bindImageMemory(vk::Image _image, VmaAllocation _allocation, u64 _offset);
+    void destroyBuffer(vk::Buffer _buffer, VmaAllocation _allocation);
+    void destroyImage(vk::Image _image, VmaAllocation _allocation);
+    void free(VmaAllocation _allocation);
+
+    // Call at the frame boundary. Refreshes the heap budgets and starts counting the next frame's allocations.
+    void beginFrame(u64 _frameNum);
+    const GpuFrameMemoryStats& getLastFrameStats() const { return m_lastFrameStats; }
+
+    // vmaBuildStatsString output, the detailed map lists every allocation
+    std::string buildStatsJson(bool _detailedMap);
+    void logBudgets();
+    // Logs the budgets and writes the detailed statistics to _path
+    void writeStats(const std::string& _path);
+
+private:
+    vk::Device m_device;
+    VmaAllocator m_allocator = nullptr;
+    VmaPool m_pools[(u32)GpuMemoryPool::Count] = {};
+    u32 m_poolMemoryTypes[(u32)GpuMemoryPool::Count] = {};
+    u32 m_heapCount = 0;
+    // Heaps already reported as over budget, reported again once they are back under
+    u32 m_overBudgetHeaps = 0;
+
+    std::atomic<u32> m_frameAllocationCount = 0;
+    std::atomic<u32> m_frameFreeCount = 0;
+    std::atomic<u64> m_frameAllocatedBytes = 0;
+    std::atomic<u64> m_frameFreedBytes = 0;
+    GpuFrameMemoryStats m_lastFrameStats;
+
+    void createPools();
+    // Resources whose memory requirements exclude the pool's memory type are allocated outside of it
+    VmaAllocationCreateInfo getAllocationInfo(GpuMemoryPool _pool, const vk::MemoryRequirements& _requirements) const;
+    void recordAllocation(VmaAllocation _allocation);
+    void recordFree(VmaAllocation _allocation);
+};
@@ -0,0 +1,136 @@
+#include "common.h"
+
+#include "gpu_profiler.h"
+#include "cmd_context.h"
+#include "driver.h"
+#include "globals.h"
+#include "settings.h"
+#include <cstring>
+#include <string>
+
+static constexpr u32 C_InvalidScope = ~0u;
+
+GpuProfiler::GpuProfiler()
+{
+    if (globals::getRef<Settings>().m_nullBackend) {
+        logInfo("Nothing is submitted with the null backend, gpu profiling is disabled");
+        return;
+    }
+
+    Driver& driver = globals::getRef<Driver>();
+    DriverObjects driverObjects = driver.getDriverObjects();
+
+    u32 validBits = driver.getQueueFamilyProps(driverObjects.m_queueIndex).timestampValidBits;
+    m_enabled = validBits != 0;
+    if (!m_enabled) {
+        logInfo("Timestamps aren't supported on the graphics queue, gpu profiling is disabled");
+        return;
+    }
+
+    m_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    m_nsPerTick = driver.getGpuProps().limits.timestampPeriod;
+
+    for (FrameQueries& frame : m_frames) {
+        vk::QueryPoolCreateInfo poolinfo;
+        poolinfo.setQueryType(vk::QueryType::eTimestamp);
+        poolinfo.setQueryCount(C_MaxScopesPerFrame * 2);
+        frame.m_queryPool = driverObjects.m_device.createQueryPoolUnique(poolinfo).value;
+        frame.m_scopeNames.reserve(C_MaxScopesPerFrame);
+    }
+}
+
+void GpuProfiler::beginFrame(CmdContext& _ctx, u32 _virtualFrameIndex)
+{
+    if (!m_enabled)
+        return;
+
+    m_currentFrame = _virtualFrameIndex;
+    FrameQueries& frame = m_frames[m_currentFrame];
+
+    readback(frame);
+
+    frame.m_scopeNames.clear();
+    _ctx.resetQueryPool(frame.m_queryPool.get(), 0, C_MaxScopesPerFrame * 2);
+}
+
+u32 GpuProfiler::beginScope(CmdContext& _ctx, LiteralString _name)
+{
+    FrameQueries& frame = m_frames[m_currentFrame];
+    if (!m_enabled || frame.m_scopeNames.size() == C_MaxScopesPerFrame)
+        return C_InvalidScope;
+
+    u32 scope = (u32)frame.m_scopeNames.size();
+    frame.m_scopeNames.push_back(_name);
+    _ctx.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.m_queryPool.get(), scope * 2);
+    return scope;
+}
+
+void GpuProfiler::endScope(CmdContext& _ctx, u32 _scope)
+{
+    if (_scope == C_InvalidScope)
+        return;
+
+    FrameQueries& frame = m_frames[m_currentFrame];
+    _ctx.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.m_queryPool.get(), _scope * 2 + 1);
+}
+
+float GpuProfiler::getScopeMs(LiteralString _name) const
+{
+    for (const ScopeTiming& timing : m_lastFrameTimings) {
+        if (!strcmp(timing.m_name, _name))
+            return timing.m_ms;
+    }
+    return -1.0f;
+}
+
+void GpuProfiler::readback(FrameQueries& _frame)
+{
+    u32 queryCount = (u32)_frame.m_scopeNames.size() * 2;
+    if (!queryCount)
+        return;
+
+    // The frame has been retired already, so the results are available and this never waits.
+    // Frames that were recorded but never submitted report eNotReady and are skipped.
+    u64 timestamps[C_MaxScopesPerFrame * 2];
+    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
+    vk::Result result = driver.m_device.getQueryPoolResults(_frame.m_queryPool.get(), 0, queryCount,
+        sizeof(timestamps), timestamps, sizeof(u64), vk::QueryResultFlagBits::e64);
+    if (result != vk::Result::eSuccess)
+        return;
+
+    m_lastFrameTimings.clear();
+    for (u32 i = 0; i < _frame.m_scopeNames.size(); ++i) {
+        u64 ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & m_timestampMask;
+        m_lastFrameTimings.push_back({ _frame.m_scopeNames[i], (float)(ticks * m_nsPerTick * 1e-6) });
+    }
+    m_readbackCount++;
+
+    accumulateAndLog();
+}
+
+void GpuProfiler::accumulateAndLog()
+{
+    for (const ScopeTiming& timing : m_lastFrameTimings) {
+        auto it = std::find_if(m_averages.begin(), m_averages.end(),
+            [&](const ScopeAverage& _avg) { return !strcmp(_avg.m_name, timing.m_name); });
+        if (it == m_averages.end())
+            it = m_averages.insert(m_averages.end(), { timing.m_name, 0.0, 0 });
+
+        it->m_totalMs += timing.m_ms;
+        it->m_count++;
+    }
+
+    if (++m_framesSinceLog < C_LogInterval)
+        return;
+
+    std::string line;
+    for (const ScopeAverage& avg : m_averages) {
+        if (!line.empty())
+            line += " | ";
+        line += fmt::format("{} {:.3f} ms", avg.m_name, avg.m_totalMs / max(1u, avg.m_count));
+    }
+    logInfo("Gpu: {}", line);
+
+    m_averages.clear();
+    m_framesSinceLog = 0;
+}
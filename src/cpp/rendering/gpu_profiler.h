@@ -0,0 +1,80 @@
+#pragma once
+
+#include "platform/vk_common.h"
+
+class CmdContext;
+
+// Timestamp queries around command buffer regions, read back FRAME_LATENCY frames later
+// once the frame has been retired, so the results never stall the queue.
+class GpuProfiler
+{
+public:
+    GpuProfiler();
+
+    // Must be called at the start of the frame's primary command buffer, after its virtual frame was retired
+    void beginFrame(CmdContext& _ctx, u32 _virtualFrameIndex);
+
+    u32 beginScope(CmdContext& _ctx, LiteralString _name);
+    void endScope(CmdContext& _ctx, u32 _scope);
+
+    struct ScopeTiming
+    {
+        LiteralString m_name;
+        float m_ms;
+    };
+
+    // Timings of the most recent frame that finished on the gpu
+    const vector<ScopeTiming>& getLastFrameTimings() const { return m_lastFrameTimings; }
+    // Frames read back so far, the timings changed when it increases
+    u64 getReadbackCount() const { return m_readbackCount; }
+    // Returns a negative value if the scope wasn't recorded in that frame
+    float getScopeMs(LiteralString _name) const;
+
+private:
+    static constexpr u32 C_MaxScopesPerFrame = 64;
+    // Average timings are logged every C_LogInterval frames
+    static constexpr u32 C_LogInterval = 300;
+
+    struct FrameQueries
+    {
+        UniqueHandle<vk::QueryPool> m_queryPool;
+        // Scope i writes queries 2 * i and 2 * i + 1
+        vector<LiteralString> m_scopeNames;
+    };
+    FrameQueries m_frames[FRAME_LATENCY];
+    u32 m_currentFrame = 0;
+
+    bool m_enabled = false;
+    double m_nsPerTick = 0.0;
+    u64 m_timestampMask = 0;
+
+    vector<ScopeTiming> m_lastFrameTimings;
+    u64 m_readbackCount = 0;
+
+    struct ScopeAverage
+    {
+        LiteralString m_name;
+        double m_totalMs;
+        u32 m_count;
+    };
+    vector<ScopeAverage> m_averages;
+    u32 m_framesSinceLog = 0;
+
+    void readback(FrameQueries& _frame);
+    void accumulateAndLog();
+};
+
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(GpuProfiler& _profiler, CmdContext& _ctx, LiteralString _name)
+        : m_profiler(_profiler)
+        , m_ctx(_ctx)
+        , m_scope(_profiler.beginScope(_ctx, _name)) {};
+    ~GpuProfileScope() { m_profiler.endScope(m_ctx, m_scope); }
+
+private:
+    GpuProfiler& m_profiler;
+    CmdContext& m_ctx;
+    u32 m_scope;
+};
@@ -0,0 +1,112 @@
+#include "common.h"
+
+#include "pipeline_layout_cache.h"
+#include "shader.h"
+#include "driver.h"
+#include "globals.h"
+#include <algorithm>
+
+PipelineLayoutCache::~PipelineLayoutCache()
+{
+    if (globals::getRef<Driver>().isNull())
+        return;
+    auto device = globals::getRef<Driver>().getDriverObjects().m_device;
+    for (auto pair : m_pipelineLayouts)
+        device.destroyPipelineLayout(pair.second);
+    for (auto pair : m_setLayouts)
+        device.destroyDescriptorSetLayout(pair.second);
+}
+
+vk::DescriptorSetLayout PipelineLayoutCache::getDescriptorSetLayout(const DescriptorSetLayoutDesc& _desc)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_setLayouts.find(_desc);
+    if (it != m_setLayouts.end())
+        return it->second;
+
+    SmallVector<vk::DescriptorSetLayoutBinding, 16> bindings;
+    for (const DescriptorBindingDesc& desc : _desc.m_bindings) {
+        vk::DescriptorSetLayoutBinding binding;
+        binding.setBinding(desc.m_binding);
+        binding.setDescriptorType(desc.m_type);
+        binding.setDescriptorCount(desc.m_count);
+        binding.setStageFlags(desc.m_stages);
+        bindings.push_back(binding);
+    }
+
+    vk::DescriptorSetLayoutCreateInfo info;
+    info.setBindings({ (u32)bindings.size(), bindings.data() });
+
+    Driver& driver = globals::getRef<Driver>();
+    vk::DescriptorSetLayout layout = driver.isNull() ? makeNullBackendHandle<vk::DescriptorSetLayout>(m_setLayouts.size() + 1)
+        : driver.getDriverObjects().m_device.createDescriptorSetLayout(info).value;
+    m_setLayouts.emplace(_desc, layout);
+    return layout;
+}
+
+vk::PipelineLayout PipelineLayoutCache::getPipelineLayout(const PipelineLayoutDesc& _desc)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pipelineLayouts.find(_desc);
+    if (it != m_pipelineLayouts.end())
+        return it->second;
+
+    vk::PipelineLayoutCreateInfo info;
+    info.setSetLayouts({ (u32)_desc.m_setLayouts.size(), _desc.m_setLayouts.data() });
+    info.setPushConstantRanges({ (u32)_desc.m_pushConstantRanges.size(), _desc.m_pushConstantRanges.data() });
+
+    Driver& driver = globals::getRef<Driver>();
+    vk::PipelineLayout layout = driver.isNull() ? makeNullBackendHandle<vk::PipelineLayout>(m_pipelineLayouts.size() + 1)
+        : driver.getDriverObjects().m_device.createPipelineLayout(info).value;
+    m_pipelineLayouts.emplace(_desc, layout);
+    return layout;
+}
+
+vk::PipelineLayout PipelineLayoutCache::getPipelineLayout(const CompiledShader* _stages, u32 _stageCount)
+{
+    SmallVector<DescriptorSetLayoutDesc, 4> sets;
+    vk::PushConstantRange pushConstants;
+    u32 pushConstantsEnd = 0;
+
+    for (u32 i = 0; i < _stageCount; ++i) {
+        const ShaderReflection& reflection = *_stages[i].m_reflection;
+
+        for (const ShaderReflection::Binding& reflected : reflection.m_bindings) {
+            // Sets skipped by every stage still need an empty layout
+            while (sets.size() <= reflected.m_set)
+                sets.emplace_back();
+
+            auto& bindings = sets[reflected.m_set].m_bindings;
+            auto it = std::find_if(bindings.begin(), bindings.end(),
+                [&](const DescriptorBindingDesc& _b) { return _b.m_binding == reflected.m_binding; });
+            if (it == bindings.end()) {
+                bindings.push_back({ reflected.m_binding, reflected.m_type, reflected.m_count, reflection.m_stage });
+            } else {
+                VERIFY_TRUE_MSG(it->m_type == reflected.m_type && it->m_count == reflected.m_count,
+                    "Stages disagree on set {} binding {}", reflected.m_set, reflected.m_binding);
+                it->m_stages |= reflection.m_stage;
+            }
+        }
+
+        // One range visible to every stage that declares push constants, each stage may only appear once
+        if (reflection.m_pushConstantSize) {
+            u32 end = reflection.m_pushConstantOffset + reflection.m_pushConstantSize;
+            pushConstants.offset = pushConstants.stageFlags ? min(pushConstants.offset, reflection.m_pushConstantOffset)
+                : reflection.m_pushConstantOffset;
+            pushConstantsEnd = max(pushConstantsEnd, end);
+            pushConstants.stageFlags |= reflection.m_stage;
+        }
+    }
+
+    PipelineLayoutDesc desc;
+    for (DescriptorSetLayoutDesc& set : sets) {
+        std::sort(set.m_bindings.begin(), set.m_bindings.end(),
+            [](const DescriptorBindingDesc& _a, const DescriptorBindingDesc& _b) { return _a.m_binding < _b.m_binding; });
+        desc.m_setLayouts.push_back(getDescriptorSetLayout(set));
+    }
+    if (pushConstants.stageFlags) {
+        pushConstants.size = pushConstantsEnd - pushConstants.offset;
+        desc.m_pushConstantRanges.push_back(pushConstants);
+    }
+    return getPipelineLayout(desc);
+}
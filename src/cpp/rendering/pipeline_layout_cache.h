@@ -0,0 +1,93 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "core/hash.h"
+#include "core/flathashmap.h"
+#include <mutex>
+
+struct CompiledShader;
+
+struct DescriptorBindingDesc
+{
+    u32 m_binding;
+    vk::DescriptorType m_type;
+    u32 m_count;
+    vk::ShaderStageFlags m_stages;
+
+    bool operator==(const DescriptorBindingDesc& _o) const
+    {
+        return m_binding == _o.m_binding && m_type == _o.m_type && m_count == _o.m_count && m_stages == _o.m_stages;
+    }
+};
+
+// Bindings are kept sorted so equivalent sets compare equal whatever order they were declared in
+struct DescriptorSetLayoutDesc
+{
+    SmallVector<DescriptorBindingDesc, 16> m_bindings;
+
+    bool operator==(const DescriptorSetLayoutDesc& _o) const { return m_bindings == _o.m_bindings; }
+};
+
+struct PipelineLayoutDesc
+{
+    SmallVector<vk::DescriptorSetLayout, 4> m_setLayouts;
+    SmallVector<vk::PushConstantRange, 2> m_pushConstantRanges;
+
+    bool operator==(const PipelineLayoutDesc& _o) const
+    {
+        return m_setLayouts == _o.m_setLayouts && m_pushConstantRanges == _o.m_pushConstantRanges;
+    }
+};
+
+namespace std {
+template <>
+struct hash<DescriptorSetLayoutDesc> {
+    std::size_t operator()(const DescriptorSetLayoutDesc& _desc) const noexcept
+    {
+        std::size_t h = 0;
+        for (const DescriptorBindingDesc& binding : _desc.m_bindings) {
+            hash_combine(h, binding.m_binding);
+            hash_combine(h, (u32)binding.m_type);
+            hash_combine(h, binding.m_count);
+            hash_combine(h, (u32)binding.m_stages);
+        }
+        return h;
+    }
+};
+
+template <>
+struct hash<PipelineLayoutDesc> {
+    std::size_t operator()(const PipelineLayoutDesc& _desc) const noexcept
+    {
+        std::size_t h = 0;
+        for (vk::DescriptorSetLayout layout : _desc.m_setLayouts)
+            hash_combine(h, (VkDescriptorSetLayout)layout);
+        for (const vk::PushConstantRange& range : _desc.m_pushConstantRanges) {
+            hash_combine(h, (u32)range.stageFlags);
+            hash_combine(h, range.offset);
+            hash_combine(h, range.size);
+        }
+        return h;
+    }
+};
+}
+
+// Hash-consed descriptor set and pipeline layouts. Identical descriptions always return the same object,
+// which lives until the cache is destroyed. Thread-safe.
+class PipelineLayoutCache
+{
+public:
+    ~PipelineLayoutCache();
+
+    vk::DescriptorSetLayout getDescriptorSetLayout(const DescriptorSetLayoutDesc& _desc);
+    vk::PipelineLayout getPipelineLayout(const PipelineLayoutDesc& _desc);
+
+    // Merges the reflected resources of every stage into one layout, resources used by several stages
+    // must agree on their type and count
+    vk::PipelineLayout getPipelineLayout(const CompiledShader* _stages, u32 _stageCount);
+
+private:
+    std::mutex m_mutex;
+    flat_hash_map<DescriptorSetLayoutDesc, vk::DescriptorSetLayout> m_setLayouts;
+    flat_hash_map<PipelineLayoutDesc, vk::PipelineLayout> m_pipelineLayouts;
+};
@@ -83,6 +83,10 @@ Swapchain_DXGI::~Swapchain_DXGI()
 
 void Swapchain_DXGI::resize(uint2 _dims)
 {
+    // ResizeBuffers needs every reference to the old buffers released, the imported images included,
+    // so dxgi can't keep them alive for the frames in flight
+    globals::getRef<Renderer>().waitForGpuIdle();
+
     DXGI_SWAP_CHAIN_DESC desc = {};
     m_d3dSwapchain->GetDesc(&desc);
     ThrowIfFailed(m_d3dSwapchain->ResizeBuffers(FRAME_LATENCY, _dims.x, _dims.y, desc.BufferDesc.Format, desc.Flags));
@@ -93,7 +97,7 @@ void Swapchain_DXGI::flip()
 {
     Renderer& renderer = globals::getRef<Renderer>();
     m_currentIndex = m_d3dSwapchain->GetCurrentBackBufferIndex();
-    renderer.signal(*getPresentSemaphore());
+    renderer.signal(advancePresentSemaphore());
 }
 
 void Swapchain_DXGI::present()
@@ -168,5 +172,5 @@ inline void Swapchain_DXGI::recreateImages(uint2 _dims)
         VK_CHECK(device.bindImageMemory(m_images[i], m_swapchainMemory[i].get(), 0));
 
     }
-    initFrameBuffers(m_images, _dims);
+    initImageViews(m_images);
 }
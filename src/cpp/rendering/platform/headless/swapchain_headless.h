@@ -0,0 +1,24 @@
+#pragma once
+
+#include "rendering/platform/swapchain_base.h"
+#include "vma/vk_mem_alloc.h"
+
+// Offscreen image ring used when there is no window or surface to present to
+class Swapchain_Headless final : public Swapchain_Base
+{
+public:
+    Swapchain_Headless(uint2 _dims);
+    ~Swapchain_Headless();
+
+    void resize(uint2 _dims) override;
+    void flip() override;
+    void present() override;
+    bool needsPresentSync() const override { return false; }
+
+private:
+    std::vector<vk::Image> m_images;
+    VmaAllocation m_allocations[C_SwapchainImageCount] = {};
+
+    void recreateImages(uint2 _dims);
+    void destroyImages();
+};
@@ -0,0 +1,76 @@
+#include "common.h"
+
+#include "swapchain_headless.h"
+#include "globals.h"
+#include "rendering/driver.h"
+#include "rendering/deferred_release.h"
+#include "rendering/swapchain.h"
+
+Swapchain_Headless::Swapchain_Headless(uint2 _dims)
+    : Swapchain_Base(vk::ImageLayout::eTransferSrcOptimal)
+{
+    m_images.resize(C_SwapchainImageCount);
+    recreateImages(_dims);
+}
+
+Swapchain_Headless::~Swapchain_Headless()
+{
+    destroyImages();
+}
+
+void Swapchain_Headless::resize(uint2 _dims)
+{
+    retireImageViews();
+    DeferredReleaseQueue& deferredRelease = globals::getRef<DeferredReleaseQueue>();
+    for (u32 i = 0; i < C_SwapchainImageCount; ++i) {
+        deferredRelease.retire(m_images[i], m_allocations[i]);
+        m_images[i] = vk::Image();
+        m_allocations[i] = nullptr;
+    }
+    recreateImages(_dims);
+}
+
+void Swapchain_Headless::flip()
+{
+    // Nothing to acquire, the ring is cycled in order. Reuse is already
+    // guarded by the renderer waiting on the frame timeline.
+    m_currentIndex = (m_currentIndex + 1) % C_SwapchainImageCount;
+}
+
+void Swapchain_Headless::present()
+{
+}
+
+void Swapchain_Headless::recreateImages(uint2 _dims)
+{
+    GpuAllocator& allocator = globals::getRef<Driver>().getGpuAllocator();
+
+    for (u32 i = 0; i < C_SwapchainImageCount; ++i) {
+        vk::ImageCreateInfo imageinfo;
+        imageinfo.setImageType(vk::ImageType::e2D);
+        imageinfo.setFormat(Swapchain::C_BackBufferFormat);
+        imageinfo.setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc);
+        imageinfo.setArrayLayers(1);
+        imageinfo.setSamples(vk::SampleCountFlagBits::e1);
+        imageinfo.setExtent({ _dims.x, _dims.y, 1 });
+        imageinfo.setMipLevels(1);
+
+        m_images[i] = allocator.createImage(imageinfo, GpuMemoryPool::RenderTargets, &m_allocations[i]);
+        VERIFY_TRUE_MSG((bool)m_images[i], "No gpu memory left for the headless backbuffers");
+    }
+
+    initImageViews(m_images);
+    m_currentIndex = C_SwapchainImageCount - 1;
+}
+
+void Swapchain_Headless::destroyImages()
+{
+    GpuAllocator& allocator = globals::getRef<Driver>().getGpuAllocator();
+
+    for (u32 i = 0; i < m_images.size(); ++i) {
+        if (m_images[i])
+            allocator.destroyImage(m_images[i], m_allocations[i]);
+        m_images[i] = vk::Image();
+        m_allocations[i] = nullptr;
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "rendering/platform/swapchain_base.h"
+
+// Null backend stand-in, there are no images and nothing is presented. The backbuffer is a null image.
+class Swapchain_Null final : public Swapchain_Base
+{
+public:
+    Swapchain_Null();
+
+    void resize(uint2 _dims) override;
+    void flip() override;
+    void present() override;
+    bool needsPresentSync() const override { return false; }
+};
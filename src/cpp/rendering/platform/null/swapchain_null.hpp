@@ -0,0 +1,23 @@
+#include "common.h"
+
+#include "swapchain_null.h"
+
+Swapchain_Null::Swapchain_Null()
+    : Swapchain_Base(vk::ImageLayout::eTransferSrcOptimal)
+{
+    m_currentIndex = C_SwapchainImageCount - 1;
+}
+
+void Swapchain_Null::resize(uint2 /* _dims */)
+{
+}
+
+void Swapchain_Null::flip()
+{
+    // Cycled like the headless ring, so the recorded frames match a headless run
+    m_currentIndex = (m_currentIndex + 1) % C_SwapchainImageCount;
+}
+
+void Swapchain_Null::present()
+{
+}
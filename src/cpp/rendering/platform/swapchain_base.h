@@ -1,39 +1,51 @@
 #pragma once
 
 #include "vk_common.h"
+
 class Swapchain_Base 
 {
 public:
 
+    // Frames in flight may still use the current images, they are retired to the DeferredReleaseQueue
     virtual void resize(uint2 _dims) = 0;
     virtual void flip() = 0;
     virtual void present() = 0;
+    // Whether rendering has to wait on the present semaphore and signal the render semaphore
+    virtual bool needsPresentSync() const { return true; }
 
-    vk::Framebuffer getCurrentFrameBuffer();
+    vk::Image getCurrentImage() const { return m_swapchainImages[m_currentIndex]; }
+    vk::ImageView getCurrentImageView() const { return m_swapchainImageViews[m_currentIndex].get(); }
+    // Layout the backbuffer has to be in at the end of the frame
+    vk::ImageLayout getFinalLayout() const { return m_finalLayout; }
 
-    Swapchain_Base();
+    Swapchain_Base(vk::ImageLayout _finalLayout = vk::ImageLayout::ePresentSrcKHR);
     virtual ~Swapchain_Base() {};
 
-    vk::RenderPass getCompositionRenderPass();
-
+    // Signaled by the last flip, frames wait on it whichever image was acquired
     vk::Semaphore* getPresentSemaphore();
     vk::Semaphore* getRenderSemaphore();
 
 protected:
     static constexpr u32 C_SwapchainImageCount = 3;
 
+    vk::Image m_swapchainImages[C_SwapchainImageCount];
     UniqueHandle<vk::ImageView> m_swapchainImageViews[C_SwapchainImageCount];
-    UniqueHandle<vk::Framebuffer> m_swapchainFrameBuffers[C_SwapchainImageCount];
-    UniqueHandle<vk::RenderPass> m_finalPass;
     u32 m_currentIndex = 0;
+    vk::ImageLayout m_finalLayout;
+
+    // Hands the current views to the DeferredReleaseQueue, backends retire the objects they own
+    void retireImageViews();
 
-    void initFrameBuffers(std::vector<vk::Image>& _swapchainImages, uint2 _dims);
+    void initImageViews(std::vector<vk::Image>& _swapchainImages);
 
-    vk::Semaphore getNextPresentSemaphore();
+    // Moves to the next acquire semaphore, called once per flip
+    vk::Semaphore advancePresentSemaphore();
 
 private:
     // Wait until the image has been presented to render new stuff onto it
+    // Cycled by flip independently of the image index, which restarts when the swapchain is recreated
     UniqueHandle<vk::Semaphore> m_presentSemaphores[C_SwapchainImageCount];
+    u32 m_presentSemaphoreIndex = 0;
     // Wait until the image has been renderered to present it
     UniqueHandle<vk::Semaphore> m_renderSemaphores[C_SwapchainImageCount];
 };
\ No newline at end of file
@@ -14,7 +14,7 @@ public:
     static const vk::Format C_BackBufferFormat = vk::Format::eB8G8R8A8Srgb;
 
 private:
-    void recreateSwapchain(uint2 _dims);
+    void recreateSwapchain(uint2 _dims, vk::SwapchainKHR _oldSwapchain);
 
     UniqueHandle<vk::SwapchainKHR> m_swapchain;
 };
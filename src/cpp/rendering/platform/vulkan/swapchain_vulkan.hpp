@@ -3,35 +3,41 @@
 #include "swapchain_vulkan.h"
 #include "globals.h"
 #include "rendering/driver.h"
+#include "rendering/deferred_release.h"
 
 Swapchain_Vulkan::Swapchain_Vulkan(uint2 _dims)
 {
-    recreateSwapchain(_dims);
+    recreateSwapchain(_dims, nullptr);
+    m_currentIndex = C_SwapchainImageCount - 1;
 }
 
 void Swapchain_Vulkan::resize(uint2 _dims)
 {
-    recreateSwapchain(_dims);
+    // The old swapchain may still be presenting, it is handed over as oldSwapchain and retired with the old views.
+    // The acquire semaphores cycle on their own, the first image acquired from the new swapchain doesn't matter.
+    retireImageViews();
+    vk::SwapchainKHR oldSwapchain = m_swapchain.release();
+    globals::getRef<DeferredReleaseQueue>().retire(oldSwapchain);
+    recreateSwapchain(_dims, oldSwapchain);
 }
 
 void Swapchain_Vulkan::flip()
 {
     DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-    m_currentIndex = driver.m_device.acquireNextImageKHR(m_swapchain.get(), C_nsGpuTimeout, getNextPresentSemaphore()).value;
+    vk::Semaphore acquireSemaphore = advancePresentSemaphore();
+    m_currentIndex = driver.m_device.acquireNextImageKHR(m_swapchain.get(), C_nsGpuTimeout, acquireSemaphore).value;
 }
 
 void Swapchain_Vulkan::present()
 {
-    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-
     vk::PresentInfoKHR presentinfo;
     presentinfo.setSwapchains({ 1, &m_swapchain.get() });
     presentinfo.setWaitSemaphores({ 1, getRenderSemaphore() });
     presentinfo.setImageIndices({ 1, &m_currentIndex });
-    VK_CHECK(driver.m_gQueue.presentKHR(presentinfo));
+    VK_CHECK(globals::getRef<Driver>().present(presentinfo));
 }
 
-void Swapchain_Vulkan::recreateSwapchain(uint2 _dims)
+void Swapchain_Vulkan::recreateSwapchain(uint2 _dims, vk::SwapchainKHR _oldSwapchain)
 {
     Driver& driver = globals::getRef<Driver>();
     auto driverObjects = driver.getDriverObjects();
@@ -51,12 +57,10 @@ void Swapchain_Vulkan::recreateSwapchain(uint2 _dims)
     swapchaininfo.setPresentMode(vk::PresentModeKHR::eFifoRelaxed);
     swapchaininfo.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
     swapchaininfo.setQueueFamilyIndices({ 0, nullptr });
-    swapchaininfo.setOldSwapchain(m_swapchain.get());
+    swapchaininfo.setOldSwapchain(_oldSwapchain);
 
     m_swapchain = device.createSwapchainKHRUnique(swapchaininfo).value;
 
     auto swapchainImages = device.getSwapchainImagesKHR(m_swapchain.get()).value;
-    initFrameBuffers(swapchainImages, _dims);
-
-    m_currentIndex = C_SwapchainImageCount - 1;
+    initImageViews(swapchainImages);
 }
@@ -0,0 +1,522 @@
+#include "common.h"
+
+#include "pso_manager.h"
+#include "pipeline_layout_cache.h"
+#include "driver.h"
+#include "deferred_release.h"
+#include "globals.h"
+#include "core/job_system.h"
+#include "core/cpu_profiler.h"
+#include "core/binary_stream.h"
+#include "settings.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+// Bump when GraphicsPipelineDesc or ShaderID change
+constexpr u32 C_PsoManifestMagic = 0x4e4d5045; // "EPMN"
+constexpr u32 C_PsoManifestVersion = 1;
+// More than any description has, a bigger count means the data is corrupted
+constexpr u32 C_MaxSerializedColorFormats = 8;
+
+// Values at or above _end invalidate the reader, corrupted enums never reach the compiler or Vulkan
+static u32 readBounded(BinaryReader& _reader, u32 _end)
+{
+    u32 value = _reader.readU32();
+    if (value >= _end) {
+        _reader.m_valid = false;
+        return 0;
+    }
+    return value;
+}
+
+static void writeShaderID(BinaryWriter& _writer, const ShaderID& _id)
+{
+    _writer.writeU32(toUnderlyingType(_id.m_type));
+    _writer.writeString(_id.m_name);
+    _writer.writeString(_id.m_entryPoint);
+    _writer.writeU32((u32)_id.m_defines.size());
+    for (LiteralString define : _id.m_defines)
+        _writer.writeString(define);
+}
+
+static ShaderID readShaderID(BinaryReader& _reader, ShaderType _expectedType)
+{
+    ShaderType type = (ShaderType)_reader.readU32();
+    if (type != _expectedType)
+        _reader.m_valid = false;
+    LiteralString name = _reader.readString();
+    LiteralString entryPoint = _reader.readString();
+    ShaderID id(name, type, entryPoint);
+    u32 defineCount = _reader.readU32();
+    for (u32 i = 0; i < defineCount && _reader.m_valid; ++i)
+        id.addDefine(_reader.readString());
+    return id;
+}
+
+void writePipelineDesc(BinaryWriter& _writer, const GraphicsPipelineDesc& _desc)
+{
+    writeShaderID(_writer, _desc.m_vs);
+    writeShaderID(_writer, _desc.m_ps);
+    _writer.writeU32((u32)_desc.m_topology);
+    _writer.writeU32((u32)_desc.m_polygonMode);
+    _writer.writeU32((u32)_desc.m_cullMode);
+    _writer.writeU32((u32)_desc.m_frontFace);
+    _writer.writeU32(_desc.m_blendEnable);
+    _writer.writeU32((u32)_desc.m_srcColorBlendFactor);
+    _writer.writeU32((u32)_desc.m_dstColorBlendFactor);
+    _writer.writeU32((u32)_desc.m_colorBlendOp);
+    _writer.writeU32((u32)_desc.m_srcAlphaBlendFactor);
+    _writer.writeU32((u32)_desc.m_dstAlphaBlendFactor);
+    _writer.writeU32((u32)_desc.m_alphaBlendOp);
+    _writer.writeU32(_desc.m_depthTestEnable);
+    _writer.writeU32(_desc.m_depthWriteEnable);
+    _writer.writeU32((u32)_desc.m_depthCompareOp);
+    _writer.writeU32((u32)_desc.m_colorFormats.size());
+    for (vk::Format format : _desc.m_colorFormats)
+        _writer.writeU32((u32)format);
+    _writer.writeU32((u32)_desc.m_depthFormat);
+}
+
+GraphicsPipelineDesc readPipelineDesc(BinaryReader& _reader)
+{
+    // Only core enum values are accepted
+    constexpr u32 C_TopologyEnd = (u32)vk::PrimitiveTopology::ePatchList + 1;
+    constexpr u32 C_PolygonModeEnd = (u32)vk::PolygonMode::ePoint + 1;
+    constexpr u32 C_CullModeEnd = (u32)vk::CullModeFlagBits::eFrontAndBack + 1;
+    constexpr u32 C_FrontFaceEnd = (u32)vk::FrontFace::eClockwise + 1;
+    constexpr u32 C_BlendFactorEnd = (u32)vk::BlendFactor::eOneMinusSrc1Alpha + 1;
+    constexpr u32 C_BlendOpEnd = (u32)vk::BlendOp::eMax + 1;
+    constexpr u32 C_CompareOpEnd = (u32)vk::CompareOp::eAlways + 1;
+    constexpr u32 C_FormatEnd = (u32)vk::Format::eAstc12x12SrgbBlock + 1;
+
+    ShaderID vs = readShaderID(_reader, ShaderType::vs);
+    ShaderID ps = readShaderID(_reader, ShaderType::ps);
+    GraphicsPipelineDesc desc(vs, ps);
+    desc.m_topology = (vk::PrimitiveTopology)readBounded(_reader, C_TopologyEnd);
+    desc.m_polygonMode = (vk::PolygonMode)readBounded(_reader, C_PolygonModeEnd);
+    desc.m_cullMode = (vk::CullModeFlags)readBounded(_reader, C_CullModeEnd);
+    desc.m_frontFace = (vk::FrontFace)readBounded(_reader, C_FrontFaceEnd);
+    desc.m_blendEnable = readBounded(_reader, 2);
+    desc.m_srcColorBlendFactor = (vk::BlendFactor)readBounded(_reader, C_BlendFactorEnd);
+    desc.m_dstColorBlendFactor = (vk::BlendFactor)readBounded(_reader, C_BlendFactorEnd);
+    desc.m_colorBlendOp = (vk::BlendOp)readBounded(_reader, C_BlendOpEnd);
+    desc.m_srcAlphaBlendFactor = (vk::BlendFactor)readBounded(_reader, C_BlendFactorEnd);
+    desc.m_dstAlphaBlendFactor = (vk::BlendFactor)readBounded(_reader, C_BlendFactorEnd);
+    desc.m_alphaBlendOp = (vk::BlendOp)readBounded(_reader, C_BlendOpEnd);
+    desc.m_depthTestEnable = readBounded(_reader, 2);
+    desc.m_depthWriteEnable = readBounded(_reader, 2);
+    desc.m_depthCompareOp = (vk::CompareOp)readBounded(_reader, C_CompareOpEnd);
+    u32 colorCount = readBounded(_reader, C_MaxSerializedColorFormats + 1);
+    for (u32 c = 0; c < colorCount && _reader.m_valid; ++c)
+        desc.m_colorFormats.push_back((vk::Format)readBounded(_reader, C_FormatEnd));
+    desc.m_depthFormat = (vk::Format)readBounded(_reader, C_FormatEnd);
+    return desc;
+}
+
+static bool hasDepth(vk::Format _format)
+{
+    return _format == vk::Format::eD16Unorm || _format == vk::Format::eX8D24UnormPack32
+        || _format == vk::Format::eD32Sfloat || _format == vk::Format::eD16UnormS8Uint
+        || _format == vk::Format::eD24UnormS8Uint || _format == vk::Format::eD32SfloatS8Uint;
+}
+
+static bool hasStencil(vk::Format _format)
+{
+    return _format == vk::Format::eD16UnormS8Uint || _format == vk::Format::eD24UnormS8Uint
+        || _format == vk::Format::eD32SfloatS8Uint || _format == vk::Format::eS8Uint;
+}
+
+PsoManager::PsoManager()
+{
+    m_handles.reserve(256);
+}
+
+PsoManager::~PsoManager()
+{
+    // Batch jobs reference this
+    globals::getRef<JobSystem>().wait(m_batchesInFlight);
+
+    const std::string& manifestPath = globals::getRef<Settings>().m_psoManifestPath;
+    if (!manifestPath.empty()) {
+        logInfo("Pipeline warm-up avoided {} hitches, {} pipelines were still being created on first use and {} were not in the manifest",
+            m_warmUpReadyOnRequest, m_warmUpStillCreating, m_coldRequests);
+        saveManifest(manifestPath);
+    }
+
+    if (globals::getRef<Driver>().isNull())
+        return;
+    auto device = globals::getRef<Driver>().getDriverObjects().m_device;
+    for (const CreatedPipeline& created : m_createdPipelines)
+        device.destroyPipeline(created.m_pipeline);
+    for (const PipelineEntry& entry : m_pipelines)
+        device.destroyPipeline(entry.m_pipeline);
+}
+
+PipelineHandle PsoManager::requestPipeline(const GraphicsPipelineDesc& _desc)
+{
+    auto it = m_handles.find(_desc);
+    PipelineHandle handle = it != m_handles.end() ? it->second : addPipeline(_desc);
+
+    PipelineEntry& entry = m_pipelines[handle];
+    bool failedWarmUp = entry.m_failed;
+    // Dropped warm-up entries are created again, this time the shaders get the retry prompt
+    if (failedWarmUp) {
+        entry.m_failed = false;
+        entry.m_queued = true;
+        m_pendingHandles.push_back(handle);
+    }
+    if (!entry.m_requested) {
+        entry.m_requested = true;
+        if (!entry.m_fromWarmUp || failedWarmUp)
+            ++m_coldRequests;
+        else if (entry.m_pipeline)
+            ++m_warmUpReadyOnRequest;
+        else
+            ++m_warmUpStillCreating;
+    }
+    return handle;
+}
+
+PipelineHandle PsoManager::addPipeline(const GraphicsPipelineDesc& _desc)
+{
+    PipelineHandle handle = (PipelineHandle)m_pipelines.size();
+    m_pipelines.push_back({ _desc });
+    m_pipelines.back().m_queued = true;
+    m_pendingHandles.push_back(handle);
+    m_handles.emplace(_desc, handle);
+    return handle;
+}
+
+void PsoManager::warmUp()
+{
+    PROFILE_SCOPE("PsoManager::warmUp");
+    const Settings& settings = globals::getRef<Settings>();
+
+    vector<GraphicsPipelineDesc> descs;
+    if (settings.m_psoManifestPath.empty() || !loadManifest(settings.m_psoManifestPath, descs))
+        return;
+
+    m_warmUpStart = std::chrono::steady_clock::now();
+    for (const GraphicsPipelineDesc& desc : descs) {
+        if (m_handles.find(desc) != m_handles.end())
+            continue;
+        m_pipelines[addPipeline(desc)].m_fromWarmUp = true;
+        ++m_warmUpRemaining;
+    }
+
+    logInfo("Warming up {} pipelines {}", m_warmUpRemaining,
+        settings.m_psoWarmUpProgressive ? "in the background" : "before the first frame");
+    if (!settings.m_psoWarmUpProgressive)
+        flush();
+}
+
+bool PsoManager::loadManifest(const std::string& _path, vector<GraphicsPipelineDesc>& _descs) const
+{
+    std::ifstream file(_path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    BinaryReader reader = { data.data(), data.data() + data.size() };
+    if (reader.readU32() != C_PsoManifestMagic || reader.readU32() != C_PsoManifestVersion) {
+        logInfo("Discarding pipeline manifest {}, it was written by another version", _path);
+        return false;
+    }
+
+    u32 count = reader.readU32();
+    for (u32 i = 0; i < count && reader.m_valid; ++i)
+        _descs.push_back(readPipelineDesc(reader));
+
+    if (!reader.m_valid) {
+        logError("Discarding pipeline manifest {}, it is truncated", _path);
+        _descs.clear();
+        return false;
+    }
+    return true;
+}
+
+void PsoManager::saveManifest(const std::string& _path) const
+{
+    BinaryWriter writer;
+    writer.writeU32(C_PsoManifestMagic);
+    writer.writeU32(C_PsoManifestVersion);
+    u32 count = 0;
+    for (const PipelineEntry& entry : m_pipelines)
+        count += entry.m_failed ? 0 : 1;
+    writer.writeU32(count);
+
+    // Warmed up pipelines are kept even if unused this run, they may be needed by other content
+    for (const PipelineEntry& entry : m_pipelines) {
+        if (!entry.m_failed)
+            writePipelineDesc(writer, entry.m_desc);
+    }
+
+    // Write next to the destination and swap it in, so an interrupted write never leaves a truncated manifest
+    std::string tmpPath = _path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write(writer.m_data.data(), writer.m_data.size())) {
+            logError("Failed to write pipeline manifest {}", tmpPath);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, _path, error);
+    if (error)
+        logError("Failed to write pipeline manifest {}: {}", _path, error.message());
+}
+
+void PsoManager::update()
+{
+    PROFILE_SCOPE("PsoManager::update");
+    publishCreatedPipelines();
+    startBatch();
+}
+
+void PsoManager::flush()
+{
+    PROFILE_SCOPE("PsoManager::flush");
+    startBatch();
+    globals::getRef<JobSystem>().wait(m_batchesInFlight);
+    publishCreatedPipelines();
+}
+
+void PsoManager::rebuildPipelines()
+{
+    for (PipelineHandle handle = 0; handle < (PipelineHandle)m_pipelines.size(); ++handle) {
+        if (!m_pipelines[handle].m_queued) {
+            m_pipelines[handle].m_queued = true;
+            m_pendingHandles.push_back(handle);
+        }
+    }
+}
+
+void PsoManager::publishCreatedPipelines()
+{
+    vector<CreatedPipeline> created;
+    {
+        std::lock_guard<std::mutex> lock(m_createdMutex);
+        created.swap(m_createdPipelines);
+    }
+
+    Driver& driver = globals::getRef<Driver>();
+    for (const CreatedPipeline& pipeline : created) {
+        PipelineEntry& entry = m_pipelines[pipeline.m_handle];
+        if (pipeline.m_batch != entry.m_latestBatch) {
+            if (!driver.isNull())
+                driver.getDriverObjects().m_device.destroyPipeline(pipeline.m_pipeline);
+            continue;
+        }
+
+        // Frames already submitted may still be using the previous pipeline
+        if (entry.m_pipeline) {
+            globals::getRef<DeferredReleaseQueue>().retire(entry.m_pipeline);
+        } else if (entry.m_fromWarmUp && m_warmUpRemaining && !--m_warmUpRemaining) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_warmUpStart;
+            logInfo("Pipeline warm-up finished in {:.2f} ms", elapsed.count());
+        }
+
+        // Only warm-up batches skip the retry prompt, the entry is no longer counted as warm-up once it failed
+        if (!pipeline.m_pipeline) {
+            entry.m_fromWarmUp = false;
+            if (entry.m_requested && !entry.m_queued) {
+                entry.m_queued = true;
+                m_pendingHandles.push_back(pipeline.m_handle);
+            } else if (!entry.m_requested) {
+                logError("Dropping pipeline {} / {} from the warm-up manifest, its shaders failed to compile",
+                    entry.m_desc.m_vs.m_name, entry.m_desc.m_ps.m_name);
+                entry.m_failed = true;
+            }
+            continue;
+        }
+        entry.m_pipeline = pipeline.m_pipeline;
+        entry.m_layout = pipeline.m_layout;
+    }
+}
+
+void PsoManager::startBatch()
+{
+    if (m_pendingHandles.empty())
+        return;
+
+    // Manifest entries nobody requested yet may name shaders that were deleted or renamed since
+    vector<PipelineHandle> warmUpHandles;
+    vector<PipelineHandle> handles;
+    for (PipelineHandle handle : m_pendingHandles) {
+        const PipelineEntry& entry = m_pipelines[handle];
+        if (entry.m_fromWarmUp && !entry.m_requested)
+            warmUpHandles.push_back(handle);
+        else
+            handles.push_back(handle);
+    }
+    m_pendingHandles.clear();
+
+    if (!warmUpHandles.empty())
+        queueBatch(std::move(warmUpHandles), true);
+    if (!handles.empty())
+        queueBatch(std::move(handles), false);
+}
+
+void PsoManager::queueBatch(vector<PipelineHandle> _handles, bool _warmUp)
+{
+    u64 batch = ++m_batchCount;
+    vector<PipelineHandle> handles = std::move(_handles);
+
+    vector<GraphicsPipelineDesc> descs;
+    vector<ShaderID> shaderIDs;
+    descs.reserve(handles.size());
+    shaderIDs.reserve(handles.size() * 2);
+    for (PipelineHandle handle : handles) {
+        PipelineEntry& entry = m_pipelines[handle];
+        entry.m_queued = false;
+        entry.m_latestBatch = batch;
+        descs.push_back(entry.m_desc);
+        shaderIDs.push_back(entry.m_desc.m_vs);
+        shaderIDs.push_back(entry.m_desc.m_ps);
+    }
+
+    // Shaders are queued before the batch and the background queue is FIFO, so they are picked up first and the
+    // batch never blocks on work sitting behind it. Background jobs are never run by a thread waiting on a frame job.
+    vector<ShaderModuleFuture> shaders =
+        globals::getRef<ShaderManager>().requestShaderModules(shaderIDs.data(), (u32)shaderIDs.size(), !_warmUp);
+
+    globals::getRef<JobSystem>().run(
+        [this, batch, handles = std::move(handles), descs = std::move(descs), shaders = std::move(shaders)](u32) {
+            createPipelineBatch(batch, handles, descs, shaders);
+        }, &m_batchesInFlight, JobPriority::Background);
+}
+
+void PsoManager::createPipelineBatch(u64 _batch, const vector<PipelineHandle>& _handles,
+    const vector<GraphicsPipelineDesc>& _descs, const vector<ShaderModuleFuture>& _shaders)
+{
+    PROFILE_SCOPE("PsoManager::createPipelineBatch");
+    auto start = std::chrono::steady_clock::now();
+    PipelineLayoutCache& layoutCache = globals::getRef<PipelineLayoutCache>();
+
+    // Every create info points into these, they must outlive the single createGraphicsPipelines call
+    struct PipelineState
+    {
+        vk::PipelineShaderStageCreateInfo m_stages[2];
+        vk::PipelineVertexInputStateCreateInfo m_vertexInput;
+        vk::PipelineInputAssemblyStateCreateInfo m_inputAssembly;
+        vk::PipelineRasterizationStateCreateInfo m_rasterization;
+        vk::PipelineMultisampleStateCreateInfo m_multisample;
+        SmallVector<vk::PipelineColorBlendAttachmentState, 4> m_attachmentBlendStates;
+        vk::PipelineColorBlendStateCreateInfo m_blend;
+        vk::PipelineDepthStencilStateCreateInfo m_depthStencil;
+        vk::PipelineViewportStateCreateInfo m_viewport;
+        vk::PipelineDynamicStateCreateInfo m_dynamic;
+        vk::PipelineRenderingCreateInfoKHR m_rendering;
+    };
+    static const vk::DynamicState C_DynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+
+    u32 count = (u32)_descs.size();
+    vector<PipelineState> states(count);
+    vector<vk::GraphicsPipelineCreateInfo> infos;
+    vector<u32> created;
+    infos.reserve(count);
+    created.reserve(count);
+
+    for (u32 i = 0; i < count; ++i) {
+        const GraphicsPipelineDesc& desc = _descs[i];
+        PipelineState& state = states[i];
+        CompiledShader shaders[] = { _shaders[i * 2].get(), _shaders[i * 2 + 1].get() };
+        // Warm-up shaders are compiled without the retry prompt, a failed one leaves the pipeline null
+        if (!shaders[0].m_module || !shaders[1].m_module)
+            continue;
+
+        state.m_stages[0].setStage(vk::ShaderStageFlagBits::eVertex);
+        state.m_stages[0].setModule(shaders[0].m_module);
+        state.m_stages[0].setPName(desc.m_vs.m_entryPoint);
+        state.m_stages[1].setStage(vk::ShaderStageFlagBits::eFragment);
+        state.m_stages[1].setModule(shaders[1].m_module);
+        state.m_stages[1].setPName(desc.m_ps.m_entryPoint);
+
+        state.m_inputAssembly.setTopology(desc.m_topology);
+
+        state.m_rasterization.setPolygonMode(desc.m_polygonMode);
+        state.m_rasterization.setCullMode(desc.m_cullMode);
+        state.m_rasterization.setFrontFace(desc.m_frontFace);
+        state.m_rasterization.setLineWidth(1.0f);
+
+        vk::PipelineColorBlendAttachmentState attachmentBlendState;
+        attachmentBlendState.setColorWriteMask(vk::ColorComponentFlagBits::eA
+            | vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB);
+        attachmentBlendState.setBlendEnable(desc.m_blendEnable);
+        attachmentBlendState.setSrcColorBlendFactor(desc.m_srcColorBlendFactor);
+        attachmentBlendState.setDstColorBlendFactor(desc.m_dstColorBlendFactor);
+        attachmentBlendState.setColorBlendOp(desc.m_colorBlendOp);
+        attachmentBlendState.setSrcAlphaBlendFactor(desc.m_srcAlphaBlendFactor);
+        attachmentBlendState.setDstAlphaBlendFactor(desc.m_dstAlphaBlendFactor);
+        attachmentBlendState.setAlphaBlendOp(desc.m_alphaBlendOp);
+        for (size_t a = 0; a < desc.m_colorFormats.size(); ++a)
+            state.m_attachmentBlendStates.push_back(attachmentBlendState);
+
+        state.m_blend.setLogicOpEnable(false);
+        state.m_blend.setLogicOp(vk::LogicOp::eCopy);
+        state.m_blend.setAttachments({ (u32)state.m_attachmentBlendStates.size(), state.m_attachmentBlendStates.data() });
+
+        state.m_depthStencil.setDepthTestEnable(desc.m_depthTestEnable);
+        state.m_depthStencil.setDepthWriteEnable(desc.m_depthWriteEnable);
+        state.m_depthStencil.setDepthCompareOp(desc.m_depthCompareOp);
+        state.m_depthStencil.setStencilTestEnable(false);
+        state.m_depthStencil.setMinDepthBounds(0.f);
+        state.m_depthStencil.setMaxDepthBounds(1.f);
+        state.m_depthStencil.setDepthBoundsTestEnable(false);
+
+        // Counts only, the values are dynamic
+        state.m_viewport.setViewportCount(1);
+        state.m_viewport.setScissorCount(1);
+        state.m_dynamic.setDynamicStates({ (u32)ARRAY_COUNT(C_DynamicStates), C_DynamicStates });
+
+        created.push_back(i);
+        vk::GraphicsPipelineCreateInfo& info = infos.emplace_back();
+        info.setStages({ 2, state.m_stages });
+        info.setPVertexInputState(&state.m_vertexInput);
+        info.setPInputAssemblyState(&state.m_inputAssembly);
+        info.setPRasterizationState(&state.m_rasterization);
+        info.setPMultisampleState(&state.m_multisample);
+        info.setPColorBlendState(&state.m_blend);
+        info.setPDepthStencilState(&state.m_depthStencil);
+        info.setPViewportState(&state.m_viewport);
+        info.setPDynamicState(&state.m_dynamic);
+        info.setLayout(layoutCache.getPipelineLayout(shaders, (u32)ARRAY_COUNT(shaders)));
+
+        // Dynamic rendering, the pipeline only depends on the attachment formats and works with any target using them
+        state.m_rendering.setColorAttachmentFormats({ (u32)desc.m_colorFormats.size(), desc.m_colorFormats.data() });
+        // Each format must be undefined when it has no matching aspect, stencil-only formats have no depth
+        if (hasDepth(desc.m_depthFormat))
+            state.m_rendering.setDepthAttachmentFormat(desc.m_depthFormat);
+        if (hasStencil(desc.m_depthFormat))
+            state.m_rendering.setStencilAttachmentFormat(desc.m_depthFormat);
+        info.setPNext(&state.m_rendering);
+    }
+
+    vector<vk::Pipeline> pipelines(count);
+    if (!infos.empty() && globals::getRef<Driver>().isNull()) {
+        // Batches run concurrently, the batch number keeps the placeholders unique
+        for (size_t i = 0; i < created.size(); ++i)
+            pipelines[created[i]] = makeNullBackendHandle<vk::Pipeline>((_batch << 32) | (created[i] + 1));
+    } else if (!infos.empty()) {
+        DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
+        auto result = driver.m_device.createGraphicsPipelines(driver.m_pipelineCache, infos);
+        VK_CHECK(result.result);
+        for (size_t i = 0; i < created.size(); ++i)
+            pipelines[created[i]] = result.value[i];
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    logInfo("Created {} pipelines in {:.2f} ms", infos.size(), elapsed.count());
+
+    std::lock_guard<std::mutex> lock(m_createdMutex);
+    for (size_t i = 0; i < created.size(); ++i)
+        m_createdPipelines.push_back({ _handles[created[i]], _batch, pipelines[created[i]], infos[i].layout });
+    // Failed entries are published too so the warm-up can drop them
+    for (u32 i = 0; i < count; ++i) {
+        if (!pipelines[i])
+            m_createdPipelines.push_back({ _handles[i], _batch, vk::Pipeline(), vk::PipelineLayout() });
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "shader.h"
+#include "core/flathashmap.h"
+#include "core/job_system.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+// Everything needed to build a graphics pipeline. Viewport and scissor are always dynamic.
+struct GraphicsPipelineDesc
+{
+    GraphicsPipelineDesc(const ShaderID& _vs, const ShaderID& _ps)
+        : m_vs(_vs)
+        , m_ps(_ps) {};
+
+    ShaderID m_vs;
+    ShaderID m_ps;
+
+    vk::PrimitiveTopology m_topology = vk::PrimitiveTopology::eTriangleList;
+    vk::PolygonMode m_polygonMode = vk::PolygonMode::eFill;
+    vk::CullModeFlags m_cullMode = vk::CullModeFlagBits::eBack;
+    vk::FrontFace m_frontFace = vk::FrontFace::eCounterClockwise;
+
+    // Same blend state for every color attachment
+    bool m_blendEnable = false;
+    vk::BlendFactor m_srcColorBlendFactor = vk::BlendFactor::eOne;
+    vk::BlendFactor m_dstColorBlendFactor = vk::BlendFactor::eZero;
+    vk::BlendOp m_colorBlendOp = vk::BlendOp::eAdd;
+    vk::BlendFactor m_srcAlphaBlendFactor = vk::BlendFactor::eOne;
+    vk::BlendFactor m_dstAlphaBlendFactor = vk::BlendFactor::eZero;
+    vk::BlendOp m_alphaBlendOp = vk::BlendOp::eAdd;
+
+    bool m_depthTestEnable = false;
+    bool m_depthWriteEnable = false;
+    vk::CompareOp m_depthCompareOp = vk::CompareOp::eLess;
+
+    SmallVector<vk::Format, 4> m_colorFormats;
+    vk::Format m_depthFormat = vk::Format::eUndefined;
+
+    bool operator==(const GraphicsPipelineDesc& _o) const
+    {
+        return m_vs == _o.m_vs && m_ps == _o.m_ps
+            && m_topology == _o.m_topology && m_polygonMode == _o.m_polygonMode
+            && m_cullMode == _o.m_cullMode && m_frontFace == _o.m_frontFace
+            && m_blendEnable == _o.m_blendEnable
+            && m_srcColorBlendFactor == _o.m_srcColorBlendFactor && m_dstColorBlendFactor == _o.m_dstColorBlendFactor
+            && m_colorBlendOp == _o.m_colorBlendOp
+            && m_srcAlphaBlendFactor == _o.m_srcAlphaBlendFactor && m_dstAlphaBlendFactor == _o.m_dstAlphaBlendFactor
+            && m_alphaBlendOp == _o.m_alphaBlendOp
+            && m_depthTestEnable == _o.m_depthTestEnable && m_depthWriteEnable == _o.m_depthWriteEnable
+            && m_depthCompareOp == _o.m_depthCompareOp
+            && m_colorFormats == _o.m_colorFormats && m_depthFormat == _o.m_depthFormat;
+    }
+};
+
+namespace std {
+template <>
+struct hash<GraphicsPipelineDesc> {
+    std::size_t operator()(const GraphicsPipelineDesc& _desc) const noexcept
+    {
+        std::size_t h = std::hash<ShaderID> {}(_desc.m_vs);
+        hash_combine(h, _desc.m_ps);
+        hash_combine(h, (u32)_desc.m_topology);
+        hash_combine(h, (u32)_desc.m_polygonMode);
+        hash_combine(h, (u32)_desc.m_cullMode);
+        hash_combine(h, (u32)_desc.m_frontFace);
+        hash_combine(h, _desc.m_blendEnable);
+        hash_combine(h, (u32)_desc.m_srcColorBlendFactor);
+        hash_combine(h, (u32)_desc.m_dstColorBlendFactor);
+        hash_combine(h, (u32)_desc.m_colorBlendOp);
+        hash_combine(h, (u32)_desc.m_srcAlphaBlendFactor);
+        hash_combine(h, (u32)_desc.m_dstAlphaBlendFactor);
+        hash_combine(h, (u32)_desc.m_alphaBlendOp);
+        hash_combine(h, _desc.m_depthTestEnable);
+        hash_combine(h, _desc.m_depthWriteEnable);
+        hash_combine(h, (u32)_desc.m_depthCompareOp);
+        for (vk::Format format : _desc.m_colorFormats)
+            hash_combine(h, (u32)format);
+        hash_combine(h, (u32)_desc.m_depthFormat);
+        return h;
+    }
+};
+}
+
+struct BinaryWriter;
+struct BinaryReader;
+
+// Format shared by the pipeline manifest and frame captures. Reading invalidates _reader on out of range values.
+void writePipelineDesc(BinaryWriter& _writer, const GraphicsPipelineDesc& _desc);
+GraphicsPipelineDesc readPipelineDesc(BinaryReader& _reader);
+
+using PipelineHandle = u32;
+
+// Deduplicates pipeline descriptions and creates pipelines in batches on the job system.
+// Requests and lookups happen on the render thread, workers only ever see copies of the descriptions.
+class PsoManager
+{
+public:
+    PsoManager();
+    ~PsoManager();
+
+    // Identical descriptions return the same handle. The pipeline is created by a later update()
+    PipelineHandle requestPipeline(const GraphicsPipelineDesc& _desc);
+
+    // Null until the pipeline is ready, draws using it should be skipped instead of waiting
+    vk::Pipeline getPipeline(PipelineHandle _handle) const { return m_pipelines[_handle].m_pipeline; }
+    vk::PipelineLayout getPipelineLayout(PipelineHandle _handle) const { return m_pipelines[_handle].m_layout; }
+    const GraphicsPipelineDesc& getPipelineDesc(PipelineHandle _handle) const { return m_pipelines[_handle].m_desc; }
+
+    // Call at a frame boundary. Publishes the pipelines created since the last call and starts a batch with
+    // every pending request. Replaced pipelines go to the DeferredReleaseQueue.
+    void update();
+    // Blocks until every requested pipeline is ready, for startup and loading screens
+    void flush();
+    // Recreates every pipeline in the background, the current ones stay in use until then
+    void rebuildPipelines();
+
+    // Requests every pipeline listed in the manifest written by previous runs so they are ready before first use.
+    // Blocks until they are created unless progressive warm-up is enabled in the settings, then they are created
+    // in the background during the first frames. All descriptions requested are written back on destruction,
+    // except manifest entries whose shaders failed to compile.
+    void warmUp();
+
+private:
+    struct PipelineEntry
+    {
+        GraphicsPipelineDesc m_desc;
+        vk::Pipeline m_pipeline;
+        vk::PipelineLayout m_layout;
+        // Set while the handle is in m_pendingHandles
+        bool m_queued = false;
+        // Listed in the warm-up manifest / requested by the renderer since startup
+        bool m_fromWarmUp = false;
+        bool m_requested = false;
+        // A shader failed to compile, the pipeline stays null until requested again
+        bool m_failed = false;
+        // Results of older batches are dropped, a rebuild may finish before the batch it supersedes
+        u64 m_latestBatch = 0;
+    };
+
+    struct CreatedPipeline
+    {
+        PipelineHandle m_handle;
+        u64 m_batch;
+        vk::Pipeline m_pipeline;
+        vk::PipelineLayout m_layout;
+    };
+
+    // Stable addresses, entries are only ever appended
+    std::deque<PipelineEntry> m_pipelines;
+    flat_hash_map<GraphicsPipelineDesc, PipelineHandle> m_handles;
+    vector<PipelineHandle> m_pendingHandles;
+    u64 m_batchCount = 0;
+
+    std::mutex m_createdMutex;
+    vector<CreatedPipeline> m_createdPipelines;
+    JobCounter m_batchesInFlight;
+
+    // Warm-up statistics
+    std::chrono::steady_clock::time_point m_warmUpStart;
+    u32 m_warmUpRemaining = 0;
+    u32 m_warmUpReadyOnRequest = 0;
+    u32 m_warmUpStillCreating = 0;
+    u32 m_coldRequests = 0;
+
+    PipelineHandle addPipeline(const GraphicsPipelineDesc& _desc);
+    bool loadManifest(const std::string& _path, vector<GraphicsPipelineDesc>& _descs) const;
+    void saveManifest(const std::string& _path) const;
+    void startBatch();
+    // Warm-up batches compile their shaders without the retry prompt, pipelines whose shaders fail are dropped
+    void queueBatch(vector<PipelineHandle> _handles, bool _warmUp);
+    void createPipelineBatch(u64 _batch, const vector<PipelineHandle>& _handles,
+        const vector<GraphicsPipelineDesc>& _descs, const vector<ShaderModuleFuture>& _shaders);
+    void publishCreatedPipelines();
+};
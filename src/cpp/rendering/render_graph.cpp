@@ -0,0 +1,421 @@
+#include "common.h"
+
+#include "render_graph.h"
+#include "cmd_context.h"
+#include "gpu_profiler.h"
+#include "globals.h"
+#include "core/cpu_profiler.h"
+
+struct AccessInfo
+{
+    vk::PipelineStageFlags2KHR m_stages;
+    vk::AccessFlags2KHR m_access;
+    // Ignored for buffers
+    vk::ImageLayout m_layout;
+    bool m_write;
+};
+
+static AccessInfo getAccessInfo(RenderGraphAccess _access)
+{
+    using Stage = vk::PipelineStageFlagBits2KHR;
+    using Access = vk::AccessFlagBits2KHR;
+    using Layout = vk::ImageLayout;
+
+    switch (_access) {
+    case RenderGraphAccess::ColorAttachmentWrite:
+        return { Stage::eColorAttachmentOutput, Access::eColorAttachmentRead | Access::eColorAttachmentWrite,
+            Layout::eColorAttachmentOptimal, true };
+    case RenderGraphAccess::DepthAttachmentWrite:
+        return { Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+            Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite, Layout::eDepthStencilAttachmentOptimal, true };
+    case RenderGraphAccess::DepthAttachmentRead:
+        return { Stage::eEarlyFragmentTests | Stage::eLateFragmentTests, Access::eDepthStencilAttachmentRead,
+            Layout::eDepthStencilReadOnlyOptimal, false };
+    case RenderGraphAccess::SampledFragment:
+        return { Stage::eFragmentShader, Access::eShaderSampledRead, Layout::eShaderReadOnlyOptimal, false };
+    case RenderGraphAccess::SampledCompute:
+        return { Stage::eComputeShader, Access::eShaderSampledRead, Layout::eShaderReadOnlyOptimal, false };
+    case RenderGraphAccess::StorageReadCompute:
+        return { Stage::eComputeShader, Access::eShaderStorageRead, Layout::eGeneral, false };
+    case RenderGraphAccess::StorageWriteCompute:
+        return { Stage::eComputeShader, Access::eShaderStorageRead | Access::eShaderStorageWrite, Layout::eGeneral, true };
+    case RenderGraphAccess::TransferRead:
+        return { Stage::eTransfer, Access::eTransferRead, Layout::eTransferSrcOptimal, false };
+    case RenderGraphAccess::TransferWrite:
+        return { Stage::eTransfer, Access::eTransferWrite, Layout::eTransferDstOptimal, true };
+    case RenderGraphAccess::VertexBuffer:
+        return { Stage::eVertexAttributeInput, Access::eVertexAttributeRead, Layout::eUndefined, false };
+    case RenderGraphAccess::IndexBuffer:
+        return { Stage::eIndexInput, Access::eIndexRead, Layout::eUndefined, false };
+    case RenderGraphAccess::IndirectBuffer:
+        return { Stage::eDrawIndirect, Access::eIndirectCommandRead, Layout::eUndefined, false };
+    case RenderGraphAccess::UniformBuffer:
+        return { Stage::eVertexShader | Stage::eFragmentShader | Stage::eComputeShader, Access::eUniformRead,
+            Layout::eUndefined, false };
+    default:
+        ASSERT_TRUE_MSG(false, "Unknown render graph access {}", (u32)_access);
+        return {};
+    }
+}
+
+static bool isBufferAccess(RenderGraphAccess _access)
+{
+    return _access == RenderGraphAccess::VertexBuffer || _access == RenderGraphAccess::IndexBuffer
+        || _access == RenderGraphAccess::IndirectBuffer || _access == RenderGraphAccess::UniformBuffer;
+}
+
+static vk::ImageAspectFlags getBarrierAspectMask(vk::Format _format)
+{
+    switch (_format) {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eD32Sfloat:
+    case vk::Format::eX8D24UnormPack32:
+        return vk::ImageAspectFlagBits::eDepth;
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+        // Without separate depth stencil layouts both aspects transition together
+        return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+    default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+RenderGraphResource RenderGraphPassBuilder::createImage(LiteralString _name, const TransientImageDesc& _desc)
+{
+    return m_graph.createImage(_name, _desc);
+}
+
+void RenderGraphPassBuilder::read(RenderGraphResource _resource, RenderGraphAccess _access)
+{
+    m_graph.addUse(m_pass, _resource, _access, false);
+}
+
+void RenderGraphPassBuilder::write(RenderGraphResource _resource, RenderGraphAccess _access)
+{
+    m_graph.addUse(m_pass, _resource, _access, true);
+}
+
+void RenderGraphPassBuilder::setSideEffects()
+{
+    m_graph.m_passes[m_pass].m_sideEffects = true;
+}
+
+void RenderGraph::beginFrame(u64 _frameNum)
+{
+    m_resources.clear();
+    m_passes.clear();
+    m_livePasses.clear();
+    m_imageBarriers.clear();
+    m_bufferBarriers.clear();
+    m_firstFinalBarrier = 0;
+    m_compiled = false;
+    m_transientAllocator.beginFrame(_frameNum);
+}
+
+RenderGraphResource RenderGraph::importImage(LiteralString _name, const RenderGraphImageImport& _import)
+{
+    ASSERT_TRUE(!m_compiled);
+    Resource& resource = m_resources.emplace_back();
+    resource.m_name = _name;
+    resource.m_isImage = true;
+    resource.m_imported = true;
+    resource.m_image = _import.m_image;
+    resource.m_view = _import.m_view;
+    resource.m_format = _import.m_format;
+    resource.m_finalLayout = _import.m_finalLayout;
+    resource.m_state.m_layout = _import.m_initialLayout;
+    resource.m_state.m_writeStages = _import.m_initialStages;
+    resource.m_state.m_writeAccess = _import.m_initialAccess;
+    return (RenderGraphResource)m_resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::createImage(LiteralString _name, const TransientImageDesc& _desc)
+{
+    ASSERT_TRUE(!m_compiled);
+    Resource& resource = m_resources.emplace_back();
+    resource.m_name = _name;
+    resource.m_isImage = true;
+    resource.m_imported = false;
+    resource.m_format = _desc.m_format;
+    resource.m_transientDesc = _desc;
+    return (RenderGraphResource)m_resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::importBuffer(LiteralString _name, vk::Buffer _buffer, vk::PipelineStageFlags2KHR _initialStages,
+    vk::AccessFlags2KHR _initialAccess)
+{
+    ASSERT_TRUE(!m_compiled);
+    Resource& resource = m_resources.emplace_back();
+    resource.m_name = _name;
+    resource.m_isImage = false;
+    resource.m_imported = true;
+    resource.m_buffer = _buffer;
+    resource.m_state.m_writeStages = _initialStages;
+    resource.m_state.m_writeAccess = _initialAccess;
+    return (RenderGraphResource)m_resources.size() - 1;
+}
+
+RenderGraphPassBuilder RenderGraph::addPass(LiteralString _name, ExecuteFunction _execute)
+{
+    ASSERT_TRUE(!m_compiled);
+    Pass& pass = m_passes.emplace_back();
+    pass.m_name = _name;
+    pass.m_execute = std::move(_execute);
+    return RenderGraphPassBuilder(*this, (u32)m_passes.size() - 1);
+}
+
+void RenderGraph::addUse(u32 _pass, RenderGraphResource _resource, RenderGraphAccess _access, bool _write)
+{
+    ASSERT_TRUE(!m_compiled && _resource < m_resources.size());
+    const Resource& resource = m_resources[_resource];
+    ASSERT_TRUE_MSG(getAccessInfo(_access).m_write == _write, "Pass {} declares {} with an access of the wrong kind",
+        m_passes[_pass].m_name, resource.m_name);
+    ASSERT_TRUE_MSG(isBufferAccess(_access) != resource.m_isImage, "Pass {} uses {} with an access of the wrong resource type",
+        m_passes[_pass].m_name, resource.m_name);
+
+    Pass& pass = m_passes[_pass];
+    for (const ResourceUse& use : pass.m_uses)
+        ASSERT_TRUE_MSG(use.m_resource != _resource, "Pass {} uses {} more than once", pass.m_name, resource.m_name);
+    pass.m_uses.push_back({ _resource, _access });
+}
+
+void RenderGraph::compile()
+{
+    PROFILE_SCOPE("RenderGraph::compile");
+    ASSERT_TRUE(!m_compiled);
+
+    cullPasses();
+    allocateTransients();
+    buildBarriers();
+    m_compiled = true;
+}
+
+void RenderGraph::cullPasses()
+{
+    // Walking backwards, a pass is needed if it writes something a needed pass reads, or an imported resource
+    vector<bool> needed(m_resources.size());
+    for (u32 i = 0; i < m_resources.size(); ++i)
+        needed[i] = m_resources[i].m_imported;
+
+    for (u32 i = (u32)m_passes.size(); i-- > 0;) {
+        Pass& pass = m_passes[i];
+        bool live = pass.m_sideEffects;
+        for (const ResourceUse& use : pass.m_uses) {
+            if (getAccessInfo(use.m_access).m_write && needed[use.m_resource])
+                live = true;
+        }
+
+        pass.m_culled = !live;
+        if (!live)
+            continue;
+
+        for (const ResourceUse& use : pass.m_uses) {
+            if (!getAccessInfo(use.m_access).m_write)
+                needed[use.m_resource] = true;
+        }
+    }
+
+    for (u32 i = 0; i < m_passes.size(); ++i) {
+        if (!m_passes[i].m_culled)
+            m_livePasses.push_back(i);
+    }
+}
+
+void RenderGraph::allocateTransients()
+{
+    for (u32 i = 0; i < m_livePasses.size(); ++i) {
+        for (const ResourceUse& use : m_passes[m_livePasses[i]].m_uses) {
+            Resource& resource = m_resources[use.m_resource];
+            if (resource.m_firstPass == C_NoPass)
+                resource.m_firstPass = i;
+            resource.m_lastPass = i;
+        }
+    }
+
+    bool anyTransient = false;
+    for (Resource& resource : m_resources) {
+        if (!resource.m_imported && resource.m_firstPass != C_NoPass) {
+            resource.m_transientHandle = m_transientAllocator.declareImage(resource.m_transientDesc, resource.m_firstPass,
+                resource.m_lastPass);
+            anyTransient = true;
+        }
+    }
+
+    if (!anyTransient)
+        return;
+
+    m_transientAllocator.allocate();
+    for (Resource& resource : m_resources) {
+        if (!resource.m_imported && resource.m_firstPass != C_NoPass) {
+            resource.m_image = m_transientAllocator.getImage(resource.m_transientHandle);
+            resource.m_view = m_transientAllocator.getImageView(resource.m_transientHandle);
+        }
+    }
+}
+
+void RenderGraph::buildBarriers()
+{
+    vk::PipelineStageFlags2KHR frameTransientStages;
+    vk::AccessFlags2KHR frameTransientAccess;
+
+    for (u32 i = 0; i < m_livePasses.size(); ++i) {
+        Pass& pass = m_passes[m_livePasses[i]];
+        pass.m_firstImageBarrier = (u32)m_imageBarriers.size();
+        pass.m_firstBufferBarrier = (u32)m_bufferBarriers.size();
+
+        for (const ResourceUse& use : pass.m_uses) {
+            Resource& resource = m_resources[use.m_resource];
+            ResourceState& state = resource.m_state;
+            AccessInfo info = getAccessInfo(use.m_access);
+
+            if (!resource.m_imported && resource.m_firstPass == i) {
+                // The contents are discarded, only the earlier users of the memory have to be waited on
+                state = ResourceState();
+                state.m_writeStages = m_previousTransientStages;
+                state.m_writeAccess = m_previousTransientAccess;
+                for (const Resource& other : m_resources) {
+                    if (&other == &resource || other.m_imported || other.m_lastPass == C_NoPass || other.m_lastPass >= i)
+                        continue;
+                    if (m_transientAllocator.aliases(other.m_transientHandle, resource.m_transientHandle)) {
+                        state.m_writeStages |= other.m_state.m_writeStages | other.m_state.m_readStages;
+                        state.m_writeAccess |= other.m_state.m_writeAccess;
+                    }
+                }
+            }
+
+            if (!resource.m_imported) {
+                frameTransientStages |= info.m_stages;
+                frameTransientAccess |= info.m_access;
+            }
+
+            bool layoutChange = resource.m_isImage && state.m_layout != info.m_layout;
+            if (info.m_write || layoutChange) {
+                // Write after read only needs the readers to finish, write after write also needs their writes available
+                vk::PipelineStageFlags2KHR srcStages = state.m_writeStages | state.m_readStages;
+                if (srcStages || layoutChange)
+                    addBarrier(resource, srcStages, state.m_writeAccess, info.m_stages, info.m_access, info.m_layout);
+
+                // A transition to a read layout counts as a write, visible to this pass only
+                state.m_writeStages = info.m_stages;
+                state.m_writeAccess = info.m_write ? info.m_access : vk::AccessFlags2KHR();
+                state.m_readStages = info.m_write ? vk::PipelineStageFlags2KHR() : info.m_stages;
+                state.m_visibleStages = state.m_readStages;
+                state.m_visibleAccess = info.m_write ? vk::AccessFlags2KHR() : info.m_access;
+                continue;
+            }
+
+            // Read after read, only a read from stages the last write wasn't made visible to needs a barrier
+            bool visible = (info.m_stages & state.m_visibleStages) == info.m_stages
+                && (info.m_access & state.m_visibleAccess) == info.m_access;
+            if (!visible && state.m_writeStages) {
+                addBarrier(resource, state.m_writeStages, state.m_writeAccess, info.m_stages, info.m_access, state.m_layout);
+                state.m_visibleStages |= info.m_stages;
+                state.m_visibleAccess |= info.m_access;
+            }
+            state.m_readStages |= info.m_stages;
+        }
+
+        pass.m_imageBarrierCount = (u32)m_imageBarriers.size() - pass.m_firstImageBarrier;
+        pass.m_bufferBarrierCount = (u32)m_bufferBarriers.size() - pass.m_firstBufferBarrier;
+    }
+
+    // Whatever consumes the imported images after the graph waits on a semaphore, only layouts need changing
+    m_firstFinalBarrier = (u32)m_imageBarriers.size();
+    for (Resource& resource : m_resources) {
+        ResourceState& state = resource.m_state;
+        if (!resource.m_imported || !resource.m_isImage || resource.m_finalLayout == vk::ImageLayout::eUndefined
+            || resource.m_finalLayout == state.m_layout)
+            continue;
+
+        addBarrier(resource, state.m_writeStages | state.m_readStages, state.m_writeAccess, {}, {}, resource.m_finalLayout);
+    }
+
+    // Frames without transient images don't touch their memory, the previous stages still have to be waited on
+    if (frameTransientStages) {
+        m_previousTransientStages = frameTransientStages;
+        m_previousTransientAccess = frameTransientAccess;
+    }
+}
+
+void RenderGraph::addBarrier(Resource& _resource, vk::PipelineStageFlags2KHR _srcStages, vk::AccessFlags2KHR _srcAccess,
+    vk::PipelineStageFlags2KHR _dstStages, vk::AccessFlags2KHR _dstAccess, vk::ImageLayout _newLayout)
+{
+    if (!_resource.m_isImage) {
+        vk::BufferMemoryBarrier2KHR& barrier = m_bufferBarriers.emplace_back();
+        barrier.setSrcStageMask(_srcStages);
+        barrier.setSrcAccessMask(_srcAccess);
+        barrier.setDstStageMask(_dstStages);
+        barrier.setDstAccessMask(_dstAccess);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setBuffer(_resource.m_buffer);
+        barrier.setSize(VK_WHOLE_SIZE);
+        return;
+    }
+
+    vk::ImageSubresourceRange sr;
+    sr.setAspectMask(getBarrierAspectMask(_resource.m_format));
+    sr.setLevelCount(VK_REMAINING_MIP_LEVELS);
+    sr.setLayerCount(VK_REMAINING_ARRAY_LAYERS);
+
+    vk::ImageMemoryBarrier2KHR& barrier = m_imageBarriers.emplace_back();
+    barrier.setSrcStageMask(_srcStages);
+    barrier.setSrcAccessMask(_srcAccess);
+    barrier.setDstStageMask(_dstStages);
+    barrier.setDstAccessMask(_dstAccess);
+    barrier.setOldLayout(_resource.m_state.m_layout);
+    barrier.setNewLayout(_newLayout);
+    barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+    barrier.setImage(_resource.m_image);
+    barrier.setSubresourceRange(sr);
+    _resource.m_state.m_layout = _newLayout;
+}
+
+void RenderGraph::execute(CmdContext& _ctx, GpuProfiler& _profiler)
+{
+    PROFILE_SCOPE("RenderGraph::execute");
+    ASSERT_TRUE(m_compiled);
+
+    for (u32 passIndex : m_livePasses) {
+        Pass& pass = m_passes[passIndex];
+        recordBarriers(_ctx, pass.m_firstImageBarrier, pass.m_imageBarrierCount, pass.m_firstBufferBarrier,
+            pass.m_bufferBarrierCount);
+
+        GpuProfileScope scope(_profiler, _ctx, pass.m_name);
+        pass.m_execute(_ctx, *this);
+    }
+
+    recordBarriers(_ctx, m_firstFinalBarrier, (u32)m_imageBarriers.size() - m_firstFinalBarrier, 0, 0);
+}
+
+void RenderGraph::recordBarriers(CmdContext& _ctx, u32 _firstImageBarrier, u32 _imageBarrierCount,
+    u32 _firstBufferBarrier, u32 _bufferBarrierCount)
+{
+    if (!_imageBarrierCount && !_bufferBarrierCount)
+        return;
+
+    vk::DependencyInfoKHR info;
+    info.setImageMemoryBarriers({ _imageBarrierCount, m_imageBarriers.data() + _firstImageBarrier });
+    info.setBufferMemoryBarriers({ _bufferBarrierCount, m_bufferBarriers.data() + _firstBufferBarrier });
+    _ctx.pipelineBarrier(info);
+}
+
+vk::Image RenderGraph::getImage(RenderGraphResource _resource) const
+{
+    ASSERT_TRUE(m_resources[_resource].m_isImage);
+    return m_resources[_resource].m_image;
+}
+
+vk::ImageView RenderGraph::getImageView(RenderGraphResource _resource) const
+{
+    ASSERT_TRUE(m_resources[_resource].m_isImage);
+    return m_resources[_resource].m_view;
+}
+
+vk::Buffer RenderGraph::getBuffer(RenderGraphResource _resource) const
+{
+    ASSERT_TRUE(!m_resources[_resource].m_isImage);
+    return m_resources[_resource].m_buffer;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "transient_allocator.h"
+#include <functional>
+
+class CmdContext;
+class GpuProfiler;
+class RenderGraph;
+
+// How a pass uses a resource, each one maps to the stages, access and image layout its barriers target
+enum class RenderGraphAccess : u8
+{
+    ColorAttachmentWrite,
+    DepthAttachmentWrite,
+    DepthAttachmentRead,
+    SampledFragment,
+    SampledCompute,
+    StorageReadCompute,
+    StorageWriteCompute,
+    TransferRead,
+    TransferWrite,
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+    UniformBuffer,
+    Count
+};
+
+using RenderGraphResource = u32;
+
+// State of an imported image before the graph and the layout it's left in, an undefined final layout keeps
+// whatever the last pass used. The initial stages are the ones already synchronized with, e.g. by a semaphore wait.
+struct RenderGraphImageImport
+{
+    vk::Image m_image;
+    vk::ImageView m_view;
+    vk::Format m_format = vk::Format::eUndefined;
+    vk::ImageLayout m_initialLayout = vk::ImageLayout::eUndefined;
+    vk::PipelineStageFlags2KHR m_initialStages;
+    vk::AccessFlags2KHR m_initialAccess;
+    vk::ImageLayout m_finalLayout = vk::ImageLayout::eUndefined;
+};
+
+class RenderGraphPassBuilder
+{
+public:
+    RenderGraphPassBuilder(RenderGraph& _graph, u32 _pass) : m_graph(_graph), m_pass(_pass) {};
+
+    // Transient images live from the first to the last pass using them and start with undefined contents
+    RenderGraphResource createImage(LiteralString _name, const TransientImageDesc& _desc);
+    void read(RenderGraphResource _resource, RenderGraphAccess _access);
+    void write(RenderGraphResource _resource, RenderGraphAccess _access);
+    // Passes writing only to transient resources nobody reads are culled unless they have side effects
+    void setSideEffects();
+
+private:
+    RenderGraph& m_graph;
+    u32 m_pass;
+};
+
+// Rebuilt every frame. Passes declare the resources they read and write, compile() culls the passes that
+// don't contribute to an imported resource and derives the barriers between the remaining ones. Each pass
+// gets a single vkCmdPipelineBarrier2 before it runs, waiting only on the stages that last touched its resources.
+class RenderGraph
+{
+public:
+    using ExecuteFunction = std::function<void(CmdContext& _ctx, const RenderGraph& _graph)>;
+
+    RenderGraph() = default;
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Drops the passes and resources of the previous frame
+    void beginFrame(u64 _frameNum);
+
+    RenderGraphResource importImage(LiteralString _name, const RenderGraphImageImport& _import);
+    // Same as RenderGraphPassBuilder::createImage, for images the pass functions need before their pass is added
+    RenderGraphResource createImage(LiteralString _name, const TransientImageDesc& _desc);
+    RenderGraphResource importBuffer(LiteralString _name, vk::Buffer _buffer, vk::PipelineStageFlags2KHR _initialStages,
+        vk::AccessFlags2KHR _initialAccess);
+    // Passes run in the order they are added
+    RenderGraphPassBuilder addPass(LiteralString _name, ExecuteFunction _execute);
+
+    void compile();
+    void execute(CmdContext& _ctx, GpuProfiler& _profiler);
+
+    vk::Image getImage(RenderGraphResource _resource) const;
+    vk::ImageView getImageView(RenderGraphResource _resource) const;
+    vk::Buffer getBuffer(RenderGraphResource _resource) const;
+
+    const TransientImageAllocator& getTransientAllocator() const { return m_transientAllocator; }
+
+private:
+    friend class RenderGraphPassBuilder;
+
+    static constexpr u32 C_NoPass = ~0u;
+
+    struct ResourceState
+    {
+        vk::ImageLayout m_layout = vk::ImageLayout::eUndefined;
+        // Last write, layout transitions included
+        vk::PipelineStageFlags2KHR m_writeStages;
+        vk::AccessFlags2KHR m_writeAccess;
+        // Reads since the last write, and where the last write was made visible
+        vk::PipelineStageFlags2KHR m_readStages;
+        vk::PipelineStageFlags2KHR m_visibleStages;
+        vk::AccessFlags2KHR m_visibleAccess;
+    };
+
+    struct Resource
+    {
+        LiteralString m_name;
+        bool m_isImage;
+        bool m_imported;
+        vk::Image m_image;
+        vk::ImageView m_view;
+        vk::Buffer m_buffer;
+        vk::Format m_format = vk::Format::eUndefined;
+        vk::ImageLayout m_finalLayout = vk::ImageLayout::eUndefined;
+        TransientImageDesc m_transientDesc;
+        TransientImageHandle m_transientHandle = 0;
+        ResourceState m_state;
+        // Live passes using the resource, in execution order
+        u32 m_firstPass = C_NoPass;
+        u32 m_lastPass = C_NoPass;
+    };
+
+    struct ResourceUse
+    {
+        RenderGraphResource m_resource;
+        RenderGraphAccess m_access;
+    };
+
+    struct Pass
+    {
+        LiteralString m_name;
+        ExecuteFunction m_execute;
+        SmallVector<ResourceUse, 8> m_uses;
+        bool m_sideEffects = false;
+        bool m_culled = false;
+        // Barriers issued before the pass, ranges of m_imageBarriers and m_bufferBarriers
+        u32 m_firstImageBarrier = 0;
+        u32 m_imageBarrierCount = 0;
+        u32 m_firstBufferBarrier = 0;
+        u32 m_bufferBarrierCount = 0;
+    };
+
+    vector<Resource> m_resources;
+    vector<Pass> m_passes;
+    // Indices in m_passes of the passes left after culling
+    vector<u32> m_livePasses;
+    vector<vk::ImageMemoryBarrier2KHR> m_imageBarriers;
+    vector<vk::BufferMemoryBarrier2KHR> m_bufferBarriers;
+    // Transitions of the imported images to their final layouts, after the last pass
+    u32 m_firstFinalBarrier = 0;
+    bool m_compiled = false;
+
+    TransientImageAllocator m_transientAllocator;
+    // Every stage and access that touched transient memory in the last frame using any, the first use
+    // of a transient image waits on them since the memory is shared with the previous frames
+    vk::PipelineStageFlags2KHR m_previousTransientStages;
+    vk::AccessFlags2KHR m_previousTransientAccess;
+
+    void addUse(u32 _pass, RenderGraphResource _resource, RenderGraphAccess _access, bool _write);
+    void cullPasses();
+    void allocateTransients();
+    void buildBarriers();
+    void addBarrier(Resource& _resource, vk::PipelineStageFlags2KHR _srcStages, vk::AccessFlags2KHR _srcAccess,
+        vk::PipelineStageFlags2KHR _dstStages, vk::AccessFlags2KHR _dstAccess, vk::ImageLayout _newLayout);
+    void recordBarriers(CmdContext& _ctx, u32 _firstImageBarrier, u32 _imageBarrierCount, u32 _firstBufferBarrier,
+        u32 _bufferBarrierCount);
+};
@@ -4,14 +4,40 @@
 #include "window/window.h"
 #include "driver.h"
 #include "globals.h"
-#include "vma/vk_mem_alloc.h"
 #include "shader.h"
-
-Renderer::Renderer(const Window& _window)
+#include "pso_manager.h"
+#include "deferred_release.h"
+#include "upload_manager.h"
+#include "settings.h"
+#include "core/job_system.h"
+#include "core/cpu_profiler.h"
+#include "core/string_pool.h"
+#include <chrono>
+#include <string>
+
+// Recording has a fixed cost per secondary command buffer, don't split below this
+static constexpr u32 C_MinDrawsPerChunk = 16;
+// Null backend stats are logged every C_NullStatsLogInterval frames
+static constexpr u32 C_NullStatsLogInterval = 300;
+// Draw packets emitted by each job of the built-in workload
+static constexpr u32 C_DrawEmitGrainSize = 1024;
+// Draw submission stats are logged every C_DrawStatsLogInterval frames
+static constexpr u32 C_DrawStatsLogInterval = 300;
+
+Renderer::Renderer(uint2 _dims)
 {
     DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
+    m_nullBackend = globals::getRef<Settings>().m_nullBackend;
 
     for (u32 i = 0; i < FRAME_LATENCY; ++i) {
+        u32 threadCount = globals::getRef<JobSystem>().getThreadCount();
+        m_virtualFrames[i].m_recordingThreads.resize(threadCount);
+
+        if (m_nullBackend) {
+            m_virtualFrames[i].m_defaultContext = std::make_unique<StateCachingCmdContext>(std::make_unique<RecordingCmdContext>());
+            continue;
+        }
+
         vk::CommandPoolCreateInfo poolinfo;
         poolinfo.setQueueFamilyIndex(driver.m_queueIndex);
         poolinfo.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
@@ -23,88 +49,160 @@ Renderer::Renderer(const Window& _window)
         allocateinfo.setLevel(vk::CommandBufferLevel::ePrimary);
         auto cmdBuffers = driver.m_device.allocateCommandBuffersUnique(allocateinfo).value;
         m_virtualFrames[i].m_defaultCmdBuffer = std::move(cmdBuffers[0]);
+        m_virtualFrames[i].m_defaultContext = std::make_unique<StateCachingCmdContext>(
+            std::make_unique<VulkanCmdContext>(m_virtualFrames[i].m_defaultCmdBuffer.get()));
+
+        for (RecordingThread& thread : m_virtualFrames[i].m_recordingThreads) {
+            vk::CommandPoolCreateInfo threadpoolinfo;
+            threadpoolinfo.setQueueFamilyIndex(driver.m_queueIndex);
+            threadpoolinfo.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+            thread.m_cmdBufferPool = driver.m_device.createCommandPoolUnique(threadpoolinfo).value;
+        }
     }
 
-    for (u32 i = 0; i < FRAME_LATENCY; ++i) {
-        vk::FenceCreateInfo fenceinfo;
-        m_virtualFrames[i].m_renderFence = driver.m_device.createFenceUnique(fenceinfo).value;
+    {
+        m_drawCount = max(1u, globals::getRef<Settings>().m_drawCount);
     }
 
     {
-        m_viewportDims = _window.getDims();
+        m_viewportDims = _dims;
         createResolutionDependentResources();
     }
 
     {
+        globals::getRef<PsoManager>().warmUp();
         initPSO();
     }
 }
 
 Renderer::~Renderer()
 {
+    if (m_nullStats.m_frameCount)
+        logNullBackendStats();
+    if (m_drawStats.m_frameCount)
+        logDrawStats();
     waitForGpuIdle();
 }
 
 void Renderer::RenderFrame()
 {
+    PROFILE_SCOPE("Renderer::RenderFrame");
     Window* window = globals::getPtr<Window>();
-    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-    if (window->isMinimized())
-        return;
 
-    uint2 windowDims = window->getDims();
+    // Headless rendering keeps the dims it was created with
+    if (window) {
+        if (window->isMinimized())
+            return;
 
-    uint2 newDims = windowDims;
-    if (newDims.x != m_viewportDims.x || newDims.y != m_viewportDims.y) {
-        resize(newDims);
+        // The window only records its latest size, resize events are coalesced to one swapchain recreation per frame
+        uint2 newDims = window->getDims();
+        if (newDims.x != m_viewportDims.x || newDims.y != m_viewportDims.y) {
+            resize(newDims);
+        }
     }
 
-    m_swapChain->flip();
-    driver.m_device.resetCommandPool(getCurrentVirtualFrame().m_cmdBufferPool.get());
-    getDefaultCmdBuffer().reset();
+    // The null backend only times building the draw list and recording, there is no device behind the frame
+    // boundary but it still runs for the pipeline and release bookkeeping
+    auto start = std::chrono::steady_clock::now();
+    updateDrawList();
+    std::chrono::duration<double, std::milli> recordingMs = std::chrono::steady_clock::now() - start;
+
+    if (FrameCapture* capture = globals::getPtr<FrameCapture>())
+        capture->recordFrame(m_viewportDims, m_drawPackets.getSortedPackets());
+
+    // Frame boundary, nothing is being recorded so pipelines can be swapped
+    {
+        globals::getRef<DeferredReleaseQueue>().update(m_frameNum, getCompletedTimelineValue());
+        // Nothing is allocated per frame with the null backend, the budgets don't need querying
+        if (!m_nullBackend)
+            globals::getRef<Driver>().getGpuAllocator().beginFrame(m_frameNum);
+        globals::getRef<UploadManager>().beginFrame();
+
+        PsoManager& psoManager = globals::getRef<PsoManager>();
+        if (globals::getRef<ShaderManager>().update())
+            psoManager.rebuildPipelines();
+        psoManager.update();
+    }
 
+    {
+        PROFILE_SCOPE("Swapchain::flip");
+        m_swapChain->flip();
+    }
+
+    start = std::chrono::steady_clock::now();
+    resetCommandPools();
     recordCommands();
+    recordingMs += std::chrono::steady_clock::now() - start;
+
+    accumulateDrawStats();
+
+    if (m_nullBackend) {
+        accumulateNullBackendStats(recordingMs.count());
+        completeFrame();
+        return;
+    }
+
+    getCurrentVirtualFrame().m_timelineValue = getFrameTimelineValue(m_frameNum);
 
-    vk::SubmitInfo submitinfo;
-    submitinfo.setCommandBuffers({ 1, &getDefaultCmdBuffer() });
-    submitinfo.setSignalSemaphores({ 1, m_swapChain->getRenderSemaphore() });
-    submitinfo.setWaitSemaphores({ 1, m_swapChain->getPresentSemaphore() });
-    vk::PipelineStageFlags dstmask = vk::PipelineStageFlagBits::eBottomOfPipe;
-    submitinfo.setPWaitDstStageMask(&dstmask);
-    VK_CHECK(driver.m_gQueue.submit(submitinfo, getCurrentVirtualFrame().m_renderFence.get()));
+    // The binary semaphores are only needed to sync with presentation, the graphics timeline is always signaled
+    QueueSubmission submission;
+    submission.m_cmdBuffers.push_back(getDefaultCmdBuffer());
+    if (m_swapChain->needsPresentSync()) {
+        vk::SemaphoreSubmitInfoKHR& wait = submission.m_waitSemaphores.emplace_back();
+        wait.setSemaphore(*m_swapChain->getPresentSemaphore());
+        wait.setStageMask(vk::PipelineStageFlagBits2KHR::eColorAttachmentOutput);
+
+        vk::SemaphoreSubmitInfoKHR& signal = submission.m_signalSemaphores.emplace_back();
+        signal.setSemaphore(*m_swapChain->getRenderSemaphore());
+        signal.setStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+    }
+    // Uploads acquired this frame have already completed, the wait only orders the acquire after the release
+    if (u64 uploadValue = globals::getRef<UploadManager>().getFrameWaitValue())
+        submission.m_queueWaits.push_back({ QueueType::Transfer, uploadValue, vk::PipelineStageFlagBits2KHR::eAllCommands });
+    {
+        PROFILE_SCOPE("Queue::submit");
+        u64 timelineValue = globals::getRef<Driver>().submit(QueueType::Graphics, submission);
+        ASSERT_TRUE_MSG(timelineValue == getCurrentVirtualFrame().m_timelineValue,
+            "Frame {} signaled timeline value {}, something else signaled the graphics timeline", m_frameNum, timelineValue);
+    }
 
     completeFrame();
 }
 
 void Renderer::await(vk::Semaphore _sem)
 {
-    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-    vk::SubmitInfo submitinfo;
-    submitinfo.setCommandBuffers({ 0, nullptr });
-    submitinfo.setSignalSemaphores({ 0, VK_NULL_HANDLE });
-    submitinfo.setWaitSemaphores({ 1, &_sem });
-    vk::PipelineStageFlags dstmask = vk::PipelineStageFlagBits::eTopOfPipe;
-    submitinfo.setPWaitDstStageMask(&dstmask);
-    VK_CHECK(driver.m_gQueue.submit(submitinfo));   
+    // Nothing submitted after this runs before the semaphore is signaled
+    QueueSubmission submission;
+    vk::SemaphoreSubmitInfoKHR& wait = submission.m_waitSemaphores.emplace_back();
+    wait.setSemaphore(_sem);
+    wait.setStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+    submission.m_signalTimeline = false;
+    globals::getRef<Driver>().submit(QueueType::Graphics, submission);
 }
 
 void Renderer::signal(vk::Semaphore _sem)
 {
-    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-    vk::SubmitInfo submitinfo;
-    submitinfo.setCommandBuffers({ 0, nullptr });
-    submitinfo.setSignalSemaphores({ 1, &_sem });
-    submitinfo.setWaitSemaphores({ 0, VK_NULL_HANDLE });
-    vk::PipelineStageFlags dstmask = vk::PipelineStageFlagBits::eTopOfPipe;
-    submitinfo.setPWaitDstStageMask(&dstmask);
-    VK_CHECK(driver.m_gQueue.submit(submitinfo));
+    QueueSubmission submission;
+    vk::SemaphoreSubmitInfoKHR& signal = submission.m_signalSemaphores.emplace_back();
+    signal.setSemaphore(_sem);
+    signal.setStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+    submission.m_signalTimeline = false;
+    {
+        PROFILE_SCOPE("Queue::submit");
+        globals::getRef<Driver>().submit(QueueType::Graphics, submission);
+    }
 }
 
 
 void Renderer::createResolutionDependentResources()
 {
     if (!m_swapChain) {
-        m_swapChain = std::make_unique<Swapchain>(m_viewportDims);
+        if (m_nullBackend)
+            m_swapChain = std::make_unique<Swapchain_Null>();
+        else if (globals::getRef<Driver>().isHeadless())
+            m_swapChain = std::make_unique<Swapchain_Headless>(m_viewportDims);
+        else
+            m_swapChain = std::make_unique<Swapchain>(m_viewportDims);
     } else {
         m_swapChain->resize(m_viewportDims);
     };
@@ -114,55 +212,298 @@ void Renderer::resize(uint2 _newDims)
 {
     m_viewportDims = _newDims;
     logInfo("Renderer resize to {}x{}", m_viewportDims.x, m_viewportDims.y);
-    waitForGpuIdle();
+    // No gpu wait, frames in flight keep the old images alive until they have finished
     createResolutionDependentResources();
 }
 
 void Renderer::waitForGpuIdle()
 {
+    if (m_nullBackend)
+        return;
     DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
     VK_CHECK(driver.m_device.waitIdle());
 }
 
 void Renderer::completeFrame()
 {
-    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-
-    m_swapChain->present();
+    {
+        PROFILE_SCOPE("Swapchain::present");
+        m_swapChain->present();
+    }
 
     m_currentFrameIndex = (m_currentFrameIndex + 1) % FRAME_LATENCY;
     m_frameNum++;
 
-    // The resources for the first FRAME_LATENCY frames are ready, but there is nothing to signal the fence
-    // TODO: find a more elegant way to handle it
-    if (m_frameNum >= FRAME_LATENCY) {
-        VK_CHECK(driver.m_device.waitForFences({ 1, &getCurrentVirtualFrame().m_renderFence.get() }, true, C_nsGpuTimeout));
-        driver.m_device.resetFences({ 1, &getCurrentVirtualFrame().m_renderFence.get() });
+    // Wait for frame m_frameNum - FRAME_LATENCY, the last one to use this virtual frame.
+    // Virtual frames that were never submitted hold 0, which the timeline starts at.
+    waitForTimelineValue(getCurrentVirtualFrame().m_timelineValue);
+}
+
+u64 Renderer::getCompletedTimelineValue()
+{
+    // Nothing is submitted, every frame before the current one is complete
+    if (m_nullBackend)
+        return m_frameNum;
+    return globals::getRef<Driver>().getCompletedTimelineValue(QueueType::Graphics);
+}
+
+void Renderer::waitForTimelineValue(u64 _value)
+{
+    PROFILE_SCOPE("Renderer::waitForTimelineValue");
+    if (m_nullBackend)
+        return;
+    globals::getRef<Driver>().waitForTimelineValue(QueueType::Graphics, _value);
+}
+
+void Renderer::resetCommandPools()
+{
+    DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
+
+    // Command logs are cleared when recording begins
+    VirtualFrame& frame = getCurrentVirtualFrame();
+    if (!m_nullBackend)
+        driver.m_device.resetCommandPool(frame.m_cmdBufferPool.get());
+    for (RecordingThread& thread : frame.m_recordingThreads) {
+        if (!m_nullBackend)
+            driver.m_device.resetCommandPool(thread.m_cmdBufferPool.get());
+        thread.m_usedSecondaryCount = 0;
     }
 }
 
-void Renderer::recordCommands()
+CmdContext& Renderer::acquireSecondaryContext(u32 _threadIndex)
+{
+    RecordingThread& thread = getCurrentVirtualFrame().m_recordingThreads[_threadIndex];
+
+    if (thread.m_usedSecondaryCount < thread.m_secondaryContexts.size())
+        return *thread.m_secondaryContexts[thread.m_usedSecondaryCount++];
+
+    if (m_nullBackend) {
+        thread.m_secondaryContexts.push_back(std::make_unique<StateCachingCmdContext>(std::make_unique<RecordingCmdContext>()));
+    } else {
+        DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
+
+        vk::CommandBufferAllocateInfo allocateinfo;
+        allocateinfo.setCommandBufferCount(1);
+        allocateinfo.setCommandPool(thread.m_cmdBufferPool.get());
+        allocateinfo.setLevel(vk::CommandBufferLevel::eSecondary);
+        auto cmdBuffers = driver.m_device.allocateCommandBuffersUnique(allocateinfo).value;
+        thread.m_secondaryCmdBuffers.push_back(std::move(cmdBuffers[0]));
+        thread.m_secondaryContexts.push_back(std::make_unique<StateCachingCmdContext>(
+            std::make_unique<VulkanCmdContext>(thread.m_secondaryCmdBuffers.back().get())));
+    }
+
+    return *thread.m_secondaryContexts[thread.m_usedSecondaryCount++];
+}
+
+void Renderer::recordCommands(u32 _maxThreads)
 {
+    PROFILE_SCOPE("Renderer::recordCommands");
+    JobSystem& jobSystem = globals::getRef<JobSystem>();
+
+    // Sorted packets are split in contiguous chunks recorded in parallel into secondary command buffers.
+    // The primary executes them in chunk order, so the draw order doesn't depend on scheduling.
+    u32 drawCount = (u32)m_drawPackets.getSortedPackets().size();
+    u32 maxChunks = min(jobSystem.getThreadCount(), max(1u, _maxThreads));
+    u32 drawsPerChunk = max(C_MinDrawsPerChunk, divideRoundingUp(drawCount, maxChunks));
+    u32 chunkCount = divideRoundingUp(drawCount, drawsPerChunk);
+    m_drawChunkContexts.resize(chunkCount);
+
+    // One chunk per job, at most chunkCount threads record at once
+    jobSystem.parallelFor(chunkCount, 1, [&](u32 _chunk, u32 _threadIndex) {
+        CmdContext& ctx = acquireSecondaryContext(_threadIndex);
+        u32 firstDraw = _chunk * drawsPerChunk;
+        recordDrawChunk(ctx, firstDraw, min(drawsPerChunk, drawCount - firstDraw));
+        m_drawChunkContexts[_chunk] = &ctx;
+    });
+
+    buildRenderGraph();
+
     vk::CommandBufferBeginInfo cmdBeginInfo;
     cmdBeginInfo.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-    VK_CHECK(getDefaultCmdBuffer().begin(cmdBeginInfo));
+    CmdContext& ctx = getDefaultContext();
+    ctx.begin(cmdBeginInfo);
+    m_gpuProfiler.beginFrame(ctx, m_currentFrameIndex);
+    globals::getRef<UploadManager>().recordAcquireBarriers(ctx);
+
+    {
+        GpuProfileScope frameScope(m_gpuProfiler, ctx, "frame");
+        m_renderGraph.execute(ctx, m_gpuProfiler);
+    }
+
+    ctx.end();
+}
+
+void Renderer::updateDrawList()
+{
+    PROFILE_SCOPE("Renderer::updateDrawList");
+    auto start = std::chrono::steady_clock::now();
+    m_drawPackets.reset();
+
+    if (!m_replay) {
+        // Cycling through the variants interleaves the pipelines in emission order, the depth keeps the draws of
+        // a pipeline in that order once sorted
+        u32 variantCount = (u32)m_psos.size();
+        globals::getRef<JobSystem>().parallelFor(m_drawCount, C_DrawEmitGrainSize, [&](u32 _index, u32 _threadIndex) {
+            DrawPacket packet;
+            packet.m_sortKey = makeDrawSortKey(0, m_psos[_index % variantCount], 0, (float)_index / m_drawCount);
+            packet.m_vertexCount = 3;
+            packet.m_instanceCount = 1;
+            packet.m_firstVertex = 0;
+            packet.m_firstInstance = _index;
+            m_drawPackets.emit(_threadIndex, packet);
+        });
+    } else {
+        uint2 dims = m_viewportDims;
+        m_replay->nextFrame(dims, m_drawPackets);
+        if (!globals::getPtr<Window>() && (dims.x != m_viewportDims.x || dims.y != m_viewportDims.y))
+            resize(dims);
+    }
 
-    vk::ClearValue clearValue;
-    float flash = abs(sin(m_frameNum / 144.f));
-    clearValue.color.setFloat32({ { 0.1f, flash, 0.2f, 1.0f } });
-    vk::Rect2D area;
-    area.setOffset({ 0, 0 });
-    area.setExtent({ m_viewportDims.x, m_viewportDims.y });
+    auto emitted = std::chrono::steady_clock::now();
+    m_drawPackets.sort();
+    auto sorted = std::chrono::steady_clock::now();
+
+    m_drawStats.m_emitMs += std::chrono::duration<double, std::milli>(emitted - start).count();
+    m_drawStats.m_sortMs += std::chrono::duration<double, std::milli>(sorted - emitted).count();
+    m_drawStats.m_packets += m_drawPackets.getSortedPackets().size();
+    m_drawStats.m_unsortedPipelineChanges += m_drawPackets.getUnsortedPipelineChanges();
+    m_drawStats.m_sortedPipelineChanges += m_drawPackets.getSortedPipelineChanges();
+}
 
-    vk::RenderPassBeginInfo rpinfo;
-    rpinfo.setClearValues({ 1, &clearValue });
-    rpinfo.setRenderPass(m_swapChain->getCompositionRenderPass());
-    rpinfo.setRenderArea(area);
-    rpinfo.setFramebuffer(m_swapChain->getCurrentFrameBuffer());
+void Renderer::buildRenderGraph()
+{
+    m_renderGraph.beginFrame(m_frameNum);
+
+    // The submission waits for the acquire at the color output stage, the first write only has to wait there too
+    RenderGraphImageImport backbufferImport;
+    backbufferImport.m_image = m_swapChain->getCurrentImage();
+    backbufferImport.m_view = m_swapChain->getCurrentImageView();
+    backbufferImport.m_format = Swapchain::C_BackBufferFormat;
+    backbufferImport.m_initialStages = vk::PipelineStageFlagBits2KHR::eColorAttachmentOutput;
+    backbufferImport.m_finalLayout = m_swapChain->getFinalLayout();
+    RenderGraphResource backbuffer = m_renderGraph.importImage("backbuffer", backbufferImport);
+
+    // Lays down the depth of the fullscreen triangles, the main pass only tests against it.
+    // The target only lives between the two passes, its memory is shared with any transient used outside of them.
+    TransientImageDesc depthDesc;
+    depthDesc.m_format = C_DepthFormat;
+    depthDesc.m_dims = m_viewportDims;
+    depthDesc.m_usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    RenderGraphResource depth = m_renderGraph.createImage("depth", depthDesc);
+
+    RenderGraphPassBuilder depthPrepass = m_renderGraph.addPass("depth_prepass", [this, depth](CmdContext& _ctx, const RenderGraph& _graph) {
+        vk::Rect2D area;
+        area.setOffset({ 0, 0 });
+        area.setExtent({ m_viewportDims.x, m_viewportDims.y });
+
+        vk::RenderingAttachmentInfoKHR depthAttachment;
+        depthAttachment.setImageView(_graph.getImageView(depth));
+        depthAttachment.setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+        depthAttachment.setLoadOp(vk::AttachmentLoadOp::eClear);
+        depthAttachment.setStoreOp(vk::AttachmentStoreOp::eStore);
+        depthAttachment.setClearValue(vk::ClearDepthStencilValue(1.0f, 0));
+
+        vk::RenderingInfoKHR renderinginfo;
+        renderinginfo.setRenderArea(area);
+        renderinginfo.setLayerCount(1);
+        renderinginfo.setPDepthAttachment(&depthAttachment);
+
+        _ctx.beginRendering(renderinginfo);
+        if (vk::Pipeline pipeline = globals::getRef<PsoManager>().getPipeline(m_depthPrepassPso)) {
+            setViewportAndScissor(_ctx);
+            _ctx.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            _ctx.draw(3, 1, 0, 0);
+        }
+        _ctx.endRendering();
+    });
+    depthPrepass.write(depth, RenderGraphAccess::DepthAttachmentWrite);
+
+    RenderGraphPassBuilder mainPass = m_renderGraph.addPass("main_pass", [this, backbuffer, depth](CmdContext& _ctx, const RenderGraph& _graph) {
+        vk::ClearValue clearValue;
+        float flash = abs(sin(m_frameNum / 144.f));
+        clearValue.color.setFloat32({ { 0.1f, flash, 0.2f, 1.0f } });
+        vk::Rect2D area;
+        area.setOffset({ 0, 0 });
+        area.setExtent({ m_viewportDims.x, m_viewportDims.y });
+
+        vk::RenderingAttachmentInfoKHR colorAttachment;
+        colorAttachment.setImageView(_graph.getImageView(backbuffer));
+        colorAttachment.setImageLayout(vk::ImageLayout::eColorAttachmentOptimal);
+        colorAttachment.setLoadOp(vk::AttachmentLoadOp::eClear);
+        colorAttachment.setStoreOp(vk::AttachmentStoreOp::eStore);
+        colorAttachment.setClearValue(clearValue);
+
+        // Nothing reads the depth after this pass
+        vk::RenderingAttachmentInfoKHR depthAttachment;
+        depthAttachment.setImageView(_graph.getImageView(depth));
+        depthAttachment.setImageLayout(vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+        depthAttachment.setLoadOp(vk::AttachmentLoadOp::eLoad);
+        depthAttachment.setStoreOp(vk::AttachmentStoreOp::eDontCare);
+
+        vk::RenderingInfoKHR renderinginfo;
+        renderinginfo.setFlags(vk::RenderingFlagBitsKHR::eContentsSecondaryCommandBuffers);
+        renderinginfo.setRenderArea(area);
+        renderinginfo.setLayerCount(1);
+        renderinginfo.setColorAttachments({ 1, &colorAttachment });
+        renderinginfo.setPDepthAttachment(&depthAttachment);
+
+        _ctx.beginRendering(renderinginfo);
+        if (!m_drawChunkContexts.empty())
+            _ctx.executeCommands(m_drawChunkContexts.data(), (u32)m_drawChunkContexts.size());
+        _ctx.endRendering();
+    });
+    mainPass.write(backbuffer, RenderGraphAccess::ColorAttachmentWrite);
+    mainPass.read(depth, RenderGraphAccess::DepthAttachmentRead);
+
+    m_renderGraph.compile();
+}
 
-    getDefaultCmdBuffer().beginRenderPass(rpinfo, vk::SubpassContents::eInline);
+void Renderer::recordDrawChunk(CmdContext& _ctx, u32 _firstDraw, u32 _drawCount)
+{
+    PROFILE_SCOPE("Renderer::recordDrawChunk");
+    // Rendering flags other than the secondary contents have to match the primary's vkCmdBeginRendering
+    vk::Format colorFormat = Swapchain::C_BackBufferFormat;
+    vk::CommandBufferInheritanceRenderingInfoKHR renderinginfo;
+    renderinginfo.setColorAttachmentFormats({ 1, &colorFormat });
+    renderinginfo.setDepthAttachmentFormat(C_DepthFormat);
+    renderinginfo.setRasterizationSamples(vk::SampleCountFlagBits::e1);
 
-    getDefaultCmdBuffer().bindPipeline(vk::PipelineBindPoint::eGraphics, m_pso.get());
+    vk::CommandBufferInheritanceInfo inheritinfo;
+    inheritinfo.setPNext(&renderinginfo);
+
+    vk::CommandBufferBeginInfo cmdBeginInfo;
+    cmdBeginInfo.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue);
+    cmdBeginInfo.setPInheritanceInfo(&inheritinfo);
+    _ctx.begin(cmdBeginInfo);
+
+    // Viewport and scissor are dynamic in every pipeline, binding one keeps them
+    setViewportAndScissor(_ctx);
+
+    // The render thread is waiting for the chunks, nothing modifies the pipelines meanwhile
+    // Sorted packets sharing a pipeline are contiguous, the pipeline is only looked up when the handle changes
+    const PsoManager& psoManager = globals::getRef<PsoManager>();
+    const vector<DrawPacket>& packets = m_drawPackets.getSortedPackets();
+    PipelineHandle boundHandle = ~0u;
+    vk::Pipeline bound;
+    for (u32 i = _firstDraw; i < _firstDraw + _drawCount; ++i) {
+        const DrawPacket& packet = packets[i];
+        PipelineHandle handle = getSortKeyPipeline(packet.m_sortKey);
+        if (handle != boundHandle) {
+            // Draws whose pipeline is still being created are skipped rather than waited for
+            boundHandle = handle;
+            bound = psoManager.getPipeline(boundHandle);
+            if (bound)
+                _ctx.bindPipeline(vk::PipelineBindPoint::eGraphics, bound);
+        }
+        if (bound)
+            _ctx.draw(packet.m_vertexCount, packet.m_instanceCount, packet.m_firstVertex, packet.m_firstInstance);
+    }
+
+    _ctx.end();
+}
+
+void Renderer::setViewportAndScissor(CmdContext& _ctx)
+{
     vk::Viewport vp;
     vp.width  = static_cast<float>(m_viewportDims.x);
 
@@ -176,110 +517,157 @@ void Renderer::recordCommands()
     vk::Rect2D scissor;
     scissor.extent.setWidth(m_viewportDims.x);
     scissor.extent.setHeight(m_viewportDims.y);
-    getDefaultCmdBuffer().setViewport(0, vp);
-    getDefaultCmdBuffer().setScissor(0, scissor);
-    getDefaultCmdBuffer().draw(3, 1, 0, 0);
-
-    getDefaultCmdBuffer().endRenderPass();
-    VK_CHECK(getDefaultCmdBuffer().end());
+    _ctx.setViewport(vp);
+    _ctx.setScissor(scissor);
 }
 
-void Renderer::initPSO()
+void Renderer::benchmarkRecording()
 {
-    ShaderManager shaderManager = globals::getRef<ShaderManager>();
+    static constexpr u32 C_Iterations = 64;
+    u32 threadCount = globals::getRef<JobSystem>().getThreadCount();
 
-    {
-        vk::PipelineShaderStageCreateInfo stageinfo[2];
-        ShaderID vsID("depth_pass.hlsl", ShaderType::vs, "vs_main");
-        {
-            vk::ShaderModule s = shaderManager.getShaderModule(vsID);
-            vk::PipelineShaderStageCreateInfo vsinfo;
-            vsinfo.setModule(s);
-            vsinfo.setPName(vsID.m_entryPoint);
-            vsinfo.setStage(vk::ShaderStageFlagBits::eVertex);
-            stageinfo[0] = vsinfo;
+    // Nothing is submitted, the current virtual frame is just re-recorded
+    waitForGpuIdle();
+    updateDrawList();
+    m_drawStats = DrawStats();
+
+    double singleThreadMs = 0.0;
+    for (u32 threads = 1; threads <= threadCount; ++threads) {
+        auto start = std::chrono::steady_clock::now();
+        for (u32 i = 0; i < C_Iterations; ++i) {
+            resetCommandPools();
+            recordCommands(threads);
         }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
 
-        ShaderID psID("depth_pass.hlsl", ShaderType::ps, "ps_main");
-        {
-            vk::ShaderModule s = shaderManager.getShaderModule(psID);
-            vk::PipelineShaderStageCreateInfo psinfo;
-            psinfo.setModule(s);
-            psinfo.setPName(psID.m_entryPoint);
-            psinfo.setStage(vk::ShaderStageFlagBits::eFragment);
-            stageinfo[1] = psinfo;
+        double ms = elapsed.count() / C_Iterations;
+        if (threads == 1)
+            singleThreadMs = ms;
+
+        logInfo("Recorded {} draws on {} threads in {:.3f} ms, {:.2f}x speedup", m_drawPackets.getSortedPackets().size(),
+            threads, ms, singleThreadMs / ms);
+    }
+}
+
+void Renderer::accumulateNullBackendStats(double _recordingMs)
+{
+    auto accumulate = [&](const StateCachingCmdContext& _ctx) {
+        // Every context wraps a RecordingCmdContext with the null backend
+        const CommandLog& log = static_cast<const RecordingCmdContext&>(_ctx.getInner()).getLog();
+        for (u32 type = 0; type < (u32)CmdType::Count; ++type)
+            m_nullStats.m_commandCounts[type] += log.getCount((CmdType)type);
+        m_nullStats.m_logBytes += log.getSizeBytes();
+    };
+
+    VirtualFrame& frame = getCurrentVirtualFrame();
+    accumulate(*frame.m_defaultContext);
+    for (const RecordingThread& thread : frame.m_recordingThreads) {
+        for (u32 i = 0; i < thread.m_usedSecondaryCount; ++i)
+            accumulate(*thread.m_secondaryContexts[i]);
+    }
+
+    m_nullStats.m_recordingMs += _recordingMs;
+    if (++m_nullStats.m_frameCount == C_NullStatsLogInterval)
+        logNullBackendStats();
+}
+
+void Renderer::logNullBackendStats()
+{
+    double frames = m_nullStats.m_frameCount;
+    u64 totalCommands = 0;
+    std::string counts;
+    for (u32 type = 0; type < (u32)CmdType::Count; ++type) {
+        u64 count = m_nullStats.m_commandCounts[type];
+        totalCommands += count;
+        if (count)
+            counts += fmt::format(" | {} {:.1f}", getCmdTypeName((CmdType)type), count / frames);
+    }
+
+    logInfo("Null backend over {} frames: {:.3f} ms building and recording/frame, {:.1f} commands/frame in {:.1f} KiB{}",
+        m_nullStats.m_frameCount, m_nullStats.m_recordingMs / frames, totalCommands / frames,
+        m_nullStats.m_logBytes / frames / 1024.0, counts);
+
+    m_nullStats = NullBackendStats();
+}
+
+void Renderer::accumulateDrawStats()
+{
+    auto accumulate = [&](const StateCachingCmdContext& _ctx) {
+        for (u32 type = 0; type < (u32)CmdType::Count; ++type) {
+            m_drawStats.m_issuedCounts[type] += _ctx.getIssuedCount((CmdType)type);
+            m_drawStats.m_elidedCounts[type] += _ctx.getElidedCount((CmdType)type);
         }
-        
-        vk::PipelineVertexInputStateCreateInfo vtxinfo;
-        vk::PipelineInputAssemblyStateCreateInfo iainfo;
-        iainfo.setTopology(vk::PrimitiveTopology::eTriangleList);
-
-        vk::PipelineRasterizationStateCreateInfo rastinfo;
-        rastinfo.setPolygonMode(vk::PolygonMode::eFill);
-        rastinfo.setCullMode(vk::CullModeFlagBits::eBack);
-        rastinfo.setLineWidth(1.0f);
-        rastinfo.setFrontFace(vk::FrontFace::eCounterClockwise);
-
-        
-
-        vk::PipelineMultisampleStateCreateInfo msinfo;
-        vk::PipelineColorBlendAttachmentState attachmentBlendState;
-        attachmentBlendState.setColorWriteMask(vk::ColorComponentFlagBits::eA
-            | vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB);
-        attachmentBlendState.setBlendEnable(false);
-        attachmentBlendState.setSrcColorBlendFactor(vk::BlendFactor::eOne);
-        attachmentBlendState.setDstColorBlendFactor(vk::BlendFactor::eZero);
-        attachmentBlendState.setColorBlendOp(vk::BlendOp::eAdd);
-        attachmentBlendState.setSrcAlphaBlendFactor(vk::BlendFactor::eOne);
-        attachmentBlendState.setDstAlphaBlendFactor(vk::BlendFactor::eZero);
-        attachmentBlendState.setAlphaBlendOp(vk::BlendOp::eAdd);
-
-        vk::PipelineColorBlendStateCreateInfo blendState;
-        blendState.setLogicOpEnable(false);
-        blendState.setLogicOp(vk::LogicOp::eCopy);
-        blendState.setAttachments({ 1, &attachmentBlendState });
-
-        vk::PipelineDepthStencilStateCreateInfo depthState;
-        depthState.setDepthTestEnable(false);
-        depthState.setDepthWriteEnable(false);
-        depthState.setDepthCompareOp(vk::CompareOp::eLess);
-        depthState.setStencilTestEnable(false);
-        depthState.setMinDepthBounds(0.f);
-        depthState.setMaxDepthBounds(1.f);
-        depthState.setDepthBoundsTestEnable(true);
-
-        vk::PipelineDynamicStateCreateInfo dynamicStateInfo;
-        SmallVector<vk::DynamicState, 4> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
-        dynamicStateInfo.setDynamicStates({ dynamicStates.size(), dynamicStates.data() });
-
-        vk::PipelineLayoutCreateInfo layoutinfo;
-        DriverObjects driver = globals::getRef<Driver>().getDriverObjects();
-        m_pipelineLayout = driver.m_device.createPipelineLayoutUnique(layoutinfo).value;
-
-        vk::PipelineViewportStateCreateInfo viewportState;
-        vk::Viewport viewport;
-        vk::Rect2D scissor;
-        viewportState.setViewports({ 1, &viewport });
-        viewportState.setScissors({ 1, &scissor });
-        
-
-        vk::GraphicsPipelineCreateInfo pipelineinfo;
-        pipelineinfo.setStages({ 2, stageinfo });
-        pipelineinfo.setPVertexInputState(&vtxinfo);
-        pipelineinfo.setPInputAssemblyState(&iainfo);
-        pipelineinfo.setPRasterizationState(&rastinfo);
-        pipelineinfo.setPMultisampleState(&msinfo);
-        pipelineinfo.setPColorBlendState(&blendState);
-        pipelineinfo.setPDepthStencilState(&depthState);
-        pipelineinfo.setPDynamicState(&dynamicStateInfo);
-        pipelineinfo.setPViewportState(&viewportState);
-        
-        pipelineinfo.setLayout(m_pipelineLayout.get());
-
-        // Framebuffers and graphics pipelines are created based on a specific render pass object.
-        // They must only be used with that render pass object, or one compatible with it.
-        pipelineinfo.setRenderPass(m_swapChain->getCompositionRenderPass());
-
-        m_pso = driver.m_device.createGraphicsPipelineUnique(nullptr, pipelineinfo).value;
+    };
+
+    VirtualFrame& frame = getCurrentVirtualFrame();
+    accumulate(*frame.m_defaultContext);
+    for (const RecordingThread& thread : frame.m_recordingThreads) {
+        for (u32 i = 0; i < thread.m_usedSecondaryCount; ++i)
+            accumulate(*thread.m_secondaryContexts[i]);
+    }
+
+    if (++m_drawStats.m_frameCount == C_DrawStatsLogInterval)
+        logDrawStats();
+}
+
+void Renderer::logDrawStats()
+{
+    double frames = m_drawStats.m_frameCount;
+    double packetsPerMs = m_drawStats.m_packets / max(m_drawStats.m_emitMs + m_drawStats.m_sortMs, 1e-6);
+    logInfo("Draw packets over {} frames: {:.1f} packets/frame, emit {:.3f} ms, sort {:.3f} ms, {:.2f} Mpackets/s | "
+        "{:.1f} pipeline binds/frame, {:.1f} pipeline changes/frame sorted and {:.1f} in emission order",
+        m_drawStats.m_frameCount, m_drawStats.m_packets / frames, m_drawStats.m_emitMs / frames,
+        m_drawStats.m_sortMs / frames, packetsPerMs / 1000.0,
+        m_drawStats.m_issuedCounts[(u32)CmdType::BindPipeline] / frames, m_drawStats.m_sortedPipelineChanges / frames,
+        m_drawStats.m_unsortedPipelineChanges / frames);
+
+    // Only the state commands, the others are never elided
+    u64 issued = 0;
+    u64 elided = 0;
+    std::string counts;
+    for (CmdType type : { CmdType::BindPipeline, CmdType::BindDescriptorSets, CmdType::PushConstants,
+             CmdType::SetViewport, CmdType::SetScissor, CmdType::BindVertexBuffers, CmdType::BindIndexBuffer }) {
+        u64 typeIssued = m_drawStats.m_issuedCounts[(u32)type];
+        u64 typeElided = m_drawStats.m_elidedCounts[(u32)type];
+        issued += typeIssued;
+        elided += typeElided;
+        if (typeIssued || typeElided)
+            counts += fmt::format(" | {} {:.1f}/{:.1f}", getCmdTypeName(type), typeIssued / frames, typeElided / frames);
     }
+    logInfo("State commands per frame: {:.1f} issued, {:.1f} elided ({:.1f}%), issued/elided by type{}",
+        issued / frames, elided / frames, issued + elided ? 100.0 * elided / (issued + elided) : 0.0, counts);
+
+    m_drawStats = DrawStats();
+}
+
+void Renderer::initPSO()
+{
+    PsoManager& psoManager = globals::getRef<PsoManager>();
+
+    GraphicsPipelineDesc desc(ShaderID("depth_pass.hlsl", ShaderType::vs, "vs_main"), ShaderID("depth_pass.hlsl", ShaderType::ps, "ps_main"));
+    desc.m_depthTestEnable = true;
+    desc.m_depthCompareOp = vk::CompareOp::eLess;
+    desc.m_depthWriteEnable = true;
+    desc.m_depthFormat = C_DepthFormat;
+    m_depthPrepassPso = psoManager.requestPipeline(desc);
+
+    // The main pass tests against the pre-pass depth without writing it
+    desc.m_depthCompareOp = vk::CompareOp::eLessOrEqual;
+    desc.m_depthWriteEnable = false;
+    desc.m_colorFormats.push_back(Swapchain::C_BackBufferFormat);
+    m_psos.push_back(psoManager.requestPipeline(desc));
+
+    // The defines are unused by the shader, each variant is still its own pipeline
+    u32 variantCount = max(1u, globals::getRef<Settings>().m_pipelineVariantCount);
+    for (u32 i = 1; i < variantCount; ++i) {
+        GraphicsPipelineDesc variant = desc;
+        variant.m_ps.addDefine(internString(fmt::format("DRAW_VARIANT_{}", i)));
+        m_psos.push_back(psoManager.requestPipeline(variant));
+    }
+
+    // Nothing to show until the startup pipelines exist, later requests are created in the background
+    auto start = std::chrono::steady_clock::now();
+    psoManager.flush();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    logInfo("Created startup pipelines in {:.2f} ms", elapsed.count());
 }
@@ -2,43 +2,127 @@
 
 #include "platform/vk_common.h"
 #include "swapchain.h"
+#include "gpu_profiler.h"
+#include "pso_manager.h"
+#include "render_graph.h"
+#include "cmd_context.h"
+#include "frame_capture.h"
+#include "draw_packets.h"
 #include "GLFW/glfw3.h"
 
 class Renderer 
 {
 public:
-    Renderer(const class Window& _window);
+    Renderer(uint2 _dims);
     ~Renderer();
 
     void RenderFrame();
+    void waitForGpuIdle();
+    // Logs how command recording time scales with the number of recording threads
+    void benchmarkRecording();
 
     void await(vk::Semaphore _sem);
     void signal(vk::Semaphore _sem);
 
+    u64 getFrameNum() const { return m_frameNum; }
+    // Value of the graphics queue timeline once frame _frameNum has finished on the gpu
+    static u64 getFrameTimelineValue(u64 _frameNum) { return _frameNum + 1; }
+    u64 getCompletedTimelineValue();
+    void waitForTimelineValue(u64 _value);
+
+    const GpuProfiler& getGpuProfiler() const { return m_gpuProfiler; }
+
+    // Draws the frames of _replay instead of the built-in workload, and follows their dims without a window.
+    // Null goes back to the built-in workload.
+    void setReplay(FrameReplay* _replay) { m_replay = _replay; }
+
 private:
-    unique_ptr<Swapchain> m_swapChain;
+    unique_ptr<Swapchain_Base> m_swapChain;
+
+    struct RecordingThread
+    {
+        UniqueHandle<vk::CommandPool> m_cmdBufferPool;
+        vector<UniqueHandle<vk::CommandBuffer>> m_secondaryCmdBuffers;
+        // Wrap the secondary command buffers, or own a command log each with the null backend
+        vector<unique_ptr<StateCachingCmdContext>> m_secondaryContexts;
+        u32 m_usedSecondaryCount = 0;
+    };
 
     struct VirtualFrame 
     {
         UniqueHandle<vk::CommandPool> m_cmdBufferPool;
         UniqueHandle<vk::CommandBuffer> m_defaultCmdBuffer;
-        UniqueHandle<vk::Fence> m_renderFence;
+        unique_ptr<StateCachingCmdContext> m_defaultContext;
+        // Command pools can't be used concurrently, so each recording thread has its own
+        vector<RecordingThread> m_recordingThreads;
+        // Timeline value signaled by the last submission using this frame, 0 if never submitted
+        u64 m_timelineValue = 0;
     };
     VirtualFrame m_virtualFrames[FRAME_LATENCY];
 
+    // Frames are recorded into command logs and never submitted
+    bool m_nullBackend = false;
     u64 m_frameNum = 0;
     u32 m_currentFrameIndex = 0;
     uint2 m_viewportDims;
+    u32 m_drawCount;
+    // Draws of the current frame, recorded in sort key order
+    DrawPacketQueue m_drawPackets;
+    FrameReplay* m_replay = nullptr;
+    // Secondary contexts of the current frame, in draw order
+    vector<CmdContext*> m_drawChunkContexts;
+
+    GpuProfiler m_gpuProfiler;
+    RenderGraph m_renderGraph;
 
-    UniqueHandle<vk::PipelineLayout> m_pipelineLayout;
-    UniqueHandle<vk::Pipeline> m_pso;
+    // Transient depth target written by the depth pre-pass and tested against by the main pass
+    static constexpr vk::Format C_DepthFormat = vk::Format::eD32Sfloat;
+
+    // Variants of the built-in workload's pipeline
+    vector<PipelineHandle> m_psos;
+    PipelineHandle m_depthPrepassPso;
+
+    // Draw submission totals since they were last logged
+    struct DrawStats
+    {
+        u64 m_packets = 0;
+        u64 m_unsortedPipelineChanges = 0;
+        u64 m_sortedPipelineChanges = 0;
+        // Calls that reached the command buffers and calls the state caching dropped
+        u64 m_issuedCounts[(u32)CmdType::Count] = {};
+        u64 m_elidedCounts[(u32)CmdType::Count] = {};
+        double m_emitMs = 0.0;
+        double m_sortMs = 0.0;
+        u32 m_frameCount = 0;
+    };
+    DrawStats m_drawStats;
+
+    // Null backend totals since they were last logged
+    struct NullBackendStats
+    {
+        double m_recordingMs = 0.0;
+        u64 m_commandCounts[(u32)CmdType::Count] = {};
+        u64 m_logBytes = 0;
+        u32 m_frameCount = 0;
+    };
+    NullBackendStats m_nullStats;
 
     void createResolutionDependentResources();
     void resize(uint2 _newDims);
-    void waitForGpuIdle();
     void completeFrame();
-    void recordCommands();
+    void resetCommandPools();
+    void recordCommands(u32 _maxThreads = ~0u);
+    void buildRenderGraph();
+    void updateDrawList();
+    void recordDrawChunk(CmdContext& _ctx, u32 _firstDraw, u32 _drawCount);
+    void setViewportAndScissor(CmdContext& _ctx);
+    CmdContext& acquireSecondaryContext(u32 _threadIndex);
+    void accumulateNullBackendStats(double _recordingMs);
+    void logNullBackendStats();
+    void accumulateDrawStats();
+    void logDrawStats();
     void initPSO();
     VirtualFrame& getCurrentVirtualFrame() { return m_virtualFrames[m_currentFrameIndex]; }
     vk::CommandBuffer& getDefaultCmdBuffer() { return getCurrentVirtualFrame().m_defaultCmdBuffer.get(); };
+    CmdContext& getDefaultContext() { return *getCurrentVirtualFrame().m_defaultContext; }
 };
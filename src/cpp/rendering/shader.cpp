@@ -6,10 +6,20 @@
 #include "dxc/dxcapi.h"
 #include "SPIRV-Reflect/spirv_reflect.h"
 #include <fstream>
+#include <filesystem>
 
 #include "globals.h"
+#include "settings.h"
+#include "core/job_system.h"
+#include "core/cpu_profiler.h"
+#include "core/file_watcher.h"
+#include <algorithm>
+#include <chrono>
 #include "rendering/driver.h"
 
+// Bump when anything that affects the compiled output but is not part of the cache key changes
+constexpr u32 C_ShaderCacheVersion = 1;
+
 const wchar_t* shaderTypeToProfile(ShaderType _shaderType)
 {
     switch (_shaderType) 
@@ -25,21 +35,63 @@ const wchar_t* shaderTypeToProfile(ShaderType _shaderType)
     return L"";
 }
 
+struct ShaderCompiler::DxcContext
+{
+    Microsoft::WRL::ComPtr<IDxcCompiler2> m_compiler;
+    Microsoft::WRL::ComPtr<IDxcLibrary> m_lib;
+};
+
 DxcCreateInstanceProc createDxcInstance;
-ShaderCompiler::ShaderCompiler()
+ShaderCompiler::ShaderCompiler(u32 _threadCount)
 {
     LiteralString dxcPath = "dxcompiler.dll";
     m_dxcDll = ::LoadLibraryA(dxcPath);
     VERIFY_TRUE_MSG(m_dxcDll, "{} is missing from binary dir", dxcPath);
     createDxcInstance = (DxcCreateInstanceProc)::GetProcAddress((HMODULE)m_dxcDll, "DxcCreateInstance");
     ASSERT_TRUE(createDxcInstance);
+
+    // A compiler update invalidates every cached binary
+    Microsoft::WRL::ComPtr<IDxcCompiler2> compiler;
+    Microsoft::WRL::ComPtr<IDxcVersionInfo> versionInfo;
+    VERIFY_TRUE(SUCCEEDED(createDxcInstance(CLSID_DxcCompiler, IID_PPV_ARGS(compiler.GetAddressOf()))));
+    if (SUCCEEDED(compiler.As(&versionInfo))) {
+        UINT32 major = 0, minor = 0;
+        versionInfo->GetVersion(&major, &minor);
+        m_compilerVersion = (u64(major) << 32) | minor;
+    }
+
+    // Created lazily, most workers never compile anything once the disk cache is warm
+    m_contexts.resize(_threadCount + 1);
+
+    m_cacheDir = globals::getRef<Settings>().m_shaderCachePath;
+    if (!m_cacheDir.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(m_cacheDir, error);
+        if (error) {
+            logError("Can't create shader cache dir {}: {}, caching disabled", m_cacheDir, error.message());
+            m_cacheDir.clear();
+        }
+    }
 }
 
 ShaderCompiler::~ShaderCompiler()
 {
+    m_contexts.clear();
     FreeLibrary((HMODULE)m_dxcDll);
 }
 
+ShaderCompiler::DxcContext& ShaderCompiler::getContext(u32 _threadIndex)
+{
+    ASSERT_TRUE(_threadIndex < m_contexts.size());
+    std::unique_ptr<DxcContext>& context = m_contexts[_threadIndex];
+    if (!context) {
+        context = std::make_unique<DxcContext>();
+        VERIFY_TRUE(SUCCEEDED(createDxcInstance(CLSID_DxcCompiler, IID_PPV_ARGS(context->m_compiler.GetAddressOf()))));
+        VERIFY_TRUE(SUCCEEDED(createDxcInstance(CLSID_DxcLibrary, IID_PPV_ARGS(context->m_lib.GetAddressOf()))));
+    }
+    return *context;
+}
+
 size_t getFileSize(std::ifstream& _file)
 {
     _file.ignore(std::numeric_limits<std::streamsize>::max());
@@ -74,6 +126,18 @@ std::string resolveShaderPath(LiteralString _shaderName)
     return path + _shaderName;
 }
 
+// DXC names includes like "./common.hlsli" or ".\common.hlsli" while the watcher reports "common.hlsli", the
+// dependency graph keys on this form: relative to the shader folder with forward slashes and no dot segments
+static std::string normalizeShaderPath(const std::string& _path)
+{
+    std::string path = _path;
+    std::replace(path.begin(), path.end(), '\\', '/');
+    std::filesystem::path normal = std::filesystem::path(path).lexically_normal();
+    if (normal.is_absolute())
+        normal = normal.lexically_relative(std::filesystem::path(resolveShaderPath("")).lexically_normal());
+    return normal.generic_string();
+}
+
 std::wstring to_wstring(const std::string& _str)
 {
     if (_str.empty())
@@ -88,10 +152,14 @@ std::wstring to_wstring(const std::string& _str)
 interface DefaultIncluder : public IDxcIncludeHandler
 {
     IDxcLibrary* m_lib;
+    vector<std::string>* m_includes;
+    bool m_retryOnError;
 
 public:
-    DefaultIncluder(IDxcLibrary * _lib)
+    DefaultIncluder(IDxcLibrary * _lib, vector<std::string>* _includes, bool _retryOnError)
         : m_lib(_lib)
+        , m_includes(_includes)
+        , m_retryOnError(_retryOnError)
     {
     }
     HRESULT QueryInterface(const IID&, void**) { return S_OK; }
@@ -102,16 +170,23 @@ public:
         char charPath[2048];
         sprintf_s<2048>(charPath, ("%ws"), _fileName);
         std::string fullPath = resolveShaderPath(charPath);
+        if (m_includes)
+            m_includes->push_back(charPath);
 
         IDxcBlobEncoding* encodedShader;
         u32 codePage = CP_UTF8;
-        VERIFY_TRUE(SUCCEEDED(m_lib->CreateBlobFromFile(to_wstring(fullPath).c_str(), &codePage, &encodedShader)));
+        HRESULT status = m_lib->CreateBlobFromFile(to_wstring(fullPath).c_str(), &codePage, &encodedShader);
+        // Hot reload sees includes that don't exist yet, the preprocessor then reports the error
+        if (FAILED(status) && !m_retryOnError) {
+            logError("Missing shader include {}", fullPath);
+            return status;
+        }
+        VERIFY_TRUE(SUCCEEDED(status));
         *_output = encodedShader;
         return S_OK;
     }
 };
 
-using ArgsVector = SmallVector<const wchar_t*, 8>;
 ArgsVector getDefaultArgs()
 {
     ArgsVector args;
@@ -125,7 +200,75 @@ ArgsVector getDefaultArgs()
     return args;
 }
 
-void handleShaderCompileError(IDxcLibrary* _lib, IDxcBlob* _errorBlob, LiteralString _shaderName)
+// Key is everything that goes into the compiler: the source after includes and defines are resolved,
+// the entry point, the profile and the arguments. Comment or include-only edits that preprocess
+// to the same text keep hitting the cache.
+Hash128 ShaderCompiler::computeCacheKey(const ShaderID& _id, const void* _preprocessed, size_t _size,
+    const ArgsVector& _args) const
+{
+    std::string key;
+    key.reserve(_size + 256);
+    key.append((const char*)&C_ShaderCacheVersion, sizeof(C_ShaderCacheVersion));
+    key.append((const char*)&m_compilerVersion, sizeof(m_compilerVersion));
+    key.append(_id.m_entryPoint).push_back('\0');
+    for (const wchar_t* profile = shaderTypeToProfile(_id.m_type); *profile; ++profile)
+        key.push_back((char)*profile);
+    key.push_back('\0');
+    for (const wchar_t* arg : _args) {
+        for (; *arg; ++arg)
+            key.push_back((char)*arg);
+        key.push_back('\0');
+    }
+    key.append((const char*)_preprocessed, _size);
+    return hash128(key.data(), key.size());
+}
+
+std::string ShaderCompiler::getCachePath(const Hash128& _key) const
+{
+    return m_cacheDir + "/" + _key.toString() + ".spv";
+}
+
+bool ShaderCompiler::loadCachedShader(const Hash128& _key, vector<u32>& _code) const
+{
+    if (m_cacheDir.empty())
+        return false;
+
+    std::ifstream file(getCachePath(_key), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    std::streamsize size = file.tellg();
+    if (size <= 0 || size % sizeof(u32))
+        return false;
+
+    _code.resize((size_t)size / sizeof(u32));
+    file.seekg(0, std::ios_base::beg);
+    return (bool)file.read((char*)_code.data(), size);
+}
+
+void ShaderCompiler::storeCachedShader(const Hash128& _key, const vector<u32>& _code) const
+{
+    if (m_cacheDir.empty())
+        return;
+
+    // Write to a temp file first so an interrupted run never leaves a truncated binary under the final name
+    std::string path = getCachePath(_key);
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write((const char*)_code.data(), _code.size() * sizeof(u32))) {
+            logError("Failed to write shader cache file {}", tmpPath);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error)
+        logError("Failed to write shader cache file {}: {}", path, error.message());
+}
+
+void handleShaderCompileError(IDxcLibrary* _lib, IDxcBlob* _errorBlob, LiteralString _shaderName, bool _break)
 {
     Microsoft::WRL::ComPtr<IDxcBlobEncoding> pErrorUtf8;
     _lib->GetBlobAsUtf8(_errorBlob, &pErrorUtf8);
@@ -133,18 +276,26 @@ void handleShaderCompileError(IDxcLibrary* _lib, IDxcBlob* _errorBlob, LiteralSt
     logError("Error compiling shader: {}", _shaderName);
 
     std::string errMsg = std::string((char*)pErrorUtf8->GetBufferPointer(), pErrorUtf8->GetBufferSize());
-    VERIFY_TRUE_MSG(false, "{}You may edit the shader and continue to attempt recompilation.", errMsg);
+    if (_break)
+        VERIFY_TRUE_MSG(false, "{}You may edit the shader and continue to attempt recompilation.", errMsg);
+    else
+        logError("{}", errMsg);
 }
 
-vector<u32> ShaderCompiler::compileShader(const ShaderID& _id)
+vector<u32> ShaderCompiler::compileShader(const ShaderID& _id, u32 _threadIndex, const ShaderCompileOptions& _options)
 {
-    Microsoft::WRL::ComPtr<IDxcCompiler2> compiler;
-    VERIFY_TRUE(SUCCEEDED(createDxcInstance(CLSID_DxcCompiler, IID_PPV_ARGS(compiler.GetAddressOf()))));
+    PROFILE_SCOPE("ShaderCompiler::compileShader");
 
-    Microsoft::WRL::ComPtr<IDxcLibrary> lib;
-    VERIFY_TRUE(SUCCEEDED(createDxcInstance(CLSID_DxcLibrary, IID_PPV_ARGS(lib.GetAddressOf()))));
+    // Every thread outside the job system shares the last slot
+    std::unique_lock<std::mutex> externalLock(m_externalSlotMutex, std::defer_lock);
+    if (_threadIndex == getExternalSlot())
+        externalLock.lock();
 
-    DefaultIncluder includer(lib.Get());
+    DxcContext& context = getContext(_threadIndex);
+    IDxcCompiler2* compiler = context.m_compiler.Get();
+    IDxcLibrary* lib = context.m_lib.Get();
+
+    DefaultIncluder includer(lib, _options.m_includes, _options.m_retryOnError);
 
     LiteralString name = _id.m_name;
     SmallVector<std::wstring, 8> wcharDefines; 
@@ -160,7 +311,16 @@ vector<u32> ShaderCompiler::compileShader(const ShaderID& _id)
     vector<u32> result;
     bool recompile = false;
 
+    // Stale requests, like a warm-up manifest naming a deleted shader, fail instead of asserting
+    if (!_options.m_retryOnError && !std::filesystem::exists(shaderPath)) {
+        logError("Missing shader file {}", shaderPath);
+        return result;
+    }
+
     do {
+        if (_options.m_includes)
+            _options.m_includes->clear();
+
         // Preprocess
         Microsoft::WRL::ComPtr<IDxcBlobEncoding> shaderSrcPreprocessed;
         Microsoft::WRL::ComPtr<IDxcBlobEncoding> shaderSrc;
@@ -183,7 +343,9 @@ vector<u32> ShaderCompiler::compileShader(const ShaderID& _id)
         {
             Microsoft::WRL::ComPtr<IDxcBlobEncoding> errorBlob;
             preprocessResult->GetErrorBuffer(errorBlob.GetAddressOf());
-            handleShaderCompileError(lib.Get(), errorBlob.Get(), name);
+            handleShaderCompileError(lib, errorBlob.Get(), name, _options.m_retryOnError);
+            if (!_options.m_retryOnError)
+                return {};
         }
 
         VERIFY_TRUE(SUCCEEDED(lib->CreateBlobWithEncodingFromPinned(
@@ -191,12 +353,17 @@ vector<u32> ShaderCompiler::compileShader(const ShaderID& _id)
             CP_UTF8, shaderSrcPreprocessed.GetAddressOf())));
 
         // print((char*)shaderSrcPreprocessed->GetBufferPointer());
-        // todo: cache using preprocessor output hash
+
+        auto args = getDefaultArgs();
+        Hash128 cacheKey = computeCacheKey(_id, preProcessedHlsl->GetBufferPointer(), preProcessedHlsl->GetBufferSize(), args);
+        if (_options.m_useDiskCache && loadCachedShader(cacheKey, result)) {
+            recompile = false;
+            continue;
+        }
 
         // Compile
         Microsoft::WRL::ComPtr<IDxcOperationResult> compilationResult;
 
-        auto args = getDefaultArgs();
         VERIFY_TRUE(SUCCEEDED(compiler->Compile(shaderSrcPreprocessed.Get(),
             shaderName.c_str(), to_wstring(_id.m_entryPoint).c_str(),
             shaderTypeToProfile(_id.m_type), args.data(), (u32)args.size(), nullptr, 0, &includer, compilationResult.GetAddressOf())));
@@ -205,54 +372,272 @@ vector<u32> ShaderCompiler::compileShader(const ShaderID& _id)
         compilationResult->GetStatus(&compileStatus);
         
         if (FAILED(compileStatus)) {
-            recompile = true;
+            recompile = _options.m_retryOnError;
             Microsoft::WRL::ComPtr<IDxcBlobEncoding> errorBlob;
             compilationResult->GetErrorBuffer(errorBlob.GetAddressOf());
-            handleShaderCompileError(lib.Get(), errorBlob.Get(), name);
+            handleShaderCompileError(lib, errorBlob.Get(), name, _options.m_retryOnError);
         } else {
             recompile = false;
             Microsoft::WRL::ComPtr<IDxcBlob> code;
             VERIFY_TRUE(SUCCEEDED(compilationResult->GetResult(code.GetAddressOf())));
             result.resize(code->GetBufferSize() / sizeof(result[0]));
             memcpy(result.data(), code->GetBufferPointer(), code->GetBufferSize());
+            if (_options.m_useDiskCache)
+                storeCachedShader(cacheKey, result);
         }
     } while (recompile);
 
     return result;
 }
 
-vk::ShaderModule ShaderManager::getShaderModule(const ShaderID& _id)
+unique_ptr<ShaderReflection> reflectShader(const vector<u32>& _code)
 {
-    auto device = globals::getRef<Driver>().getDriverObjects().m_device;
-
-    auto it = m_cache.find(_id);
-    if (it == m_cache.end()) {
-        vector<u32> code = m_compiler.compileShader(_id);
+    SpvReflectShaderModule reflectModule;
+    VERIFY_TRUE(SPV_REFLECT_RESULT_SUCCESS ==
+        spvReflectCreateShaderModule(_code.size() * sizeof(u32), _code.data(), &reflectModule));
+
+    auto reflection = std::make_unique<ShaderReflection>();
+    // SPIRV-Reflect enums mirror the Vulkan ones
+    reflection->m_stage = (vk::ShaderStageFlagBits)reflectModule.shader_stage;
+
+    for (u32 i = 0; i < reflectModule.descriptor_binding_count; ++i) {
+        const SpvReflectDescriptorBinding& binding = reflectModule.descriptor_bindings[i];
+        ShaderReflection::Binding reflected;
+        reflected.m_set = binding.set;
+        reflected.m_binding = binding.binding;
+        reflected.m_type = (vk::DescriptorType)binding.descriptor_type;
+        // Runtime sized arrays report 0
+        reflected.m_count = max(1u, binding.count);
+        reflection->m_bindings.push_back(reflected);
+    }
 
-        {
-            // TODO: reflect spirv
-            //SpvReflectShaderModule reflectModule;
-            //VERIFY_TRUE(SPV_REFLECT_RESULT_SUCCESS ==
-            //    spvReflectCreateShaderModule(code.size() * 4, code.data(), &reflectModule));
-            //logInfo("{}", reflectModule.descriptor_binding_count);
-        }
+    for (u32 i = 0; i < reflectModule.push_constant_block_count; ++i) {
+        const SpvReflectBlockVariable& block = reflectModule.push_constant_blocks[i];
+        u32 end = max(reflection->m_pushConstantOffset + reflection->m_pushConstantSize, block.offset + block.size);
+        reflection->m_pushConstantOffset = i ? min(reflection->m_pushConstantOffset, block.offset) : block.offset;
+        reflection->m_pushConstantSize = end - reflection->m_pushConstantOffset;
+    }
 
+    spvReflectDestroyShaderModule(&reflectModule);
+    return reflection;
+}
 
+CompiledShader ShaderManager::createShaderModule(const ShaderID& _id, u32 _threadIndex, bool _retryOnError)
+{
+    vector<std::string> includes;
+    ShaderCompileOptions options;
+    options.m_retryOnError = _retryOnError;
+    options.m_includes = &includes;
+    vector<u32> code = m_compiler.compileShader(_id, _threadIndex, options);
+
+    recordDependencies(_id, includes);
+    if (code.empty())
+        return {};
+
+    // Permutations whose defines don't change the output share one module
+    Hash128 codeHash = hash128(code.data(), code.size() * sizeof(u32));
+
+    std::lock_guard<std::mutex> lock(m_modulesMutex);
+    auto it = m_modulesByCode.find(codeHash);
+    if (it == m_modulesByCode.end()) {
+        Driver& driver = globals::getRef<Driver>();
         vk::ShaderModuleCreateInfo info;
         info.setCode(code);
-        it = m_cache.emplace(_id, device.createShaderModule(info).value).first;
+
+        // The null backend still compiles and reflects, only the module is a placeholder
+        ShaderModuleEntry entry;
+        entry.m_module = driver.isNull() ? makeNullBackendHandle<vk::ShaderModule>(m_modulesByCode.size() + 1)
+            : driver.getDriverObjects().m_device.createShaderModule(info).value;
+        entry.m_reflection = reflectShader(code);
+        it = m_modulesByCode.emplace(codeHash, std::move(entry)).first;
+    }
+    return { it->second.m_module, it->second.m_reflection.get() };
+}
+
+// Edges are only ever added, a shader that stops including a file still gets recompiled when it changes
+void ShaderManager::recordDependencies(const ShaderID& _id, const vector<std::string>& _includes)
+{
+    std::lock_guard<std::mutex> lock(m_dependencyMutex);
+    m_dependents[normalizeShaderPath(_id.m_name)].insert(_id);
+    for (const std::string& include : _includes)
+        m_dependents[normalizeShaderPath(include)].insert(_id);
+}
+
+CompiledShader ShaderManager::getShaderModule(const ShaderID& _id)
+{
+    std::promise<CompiledShader> promise;
+    ShaderModuleFuture future;
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        auto it = m_cache.find(_id);
+        if (it != m_cache.end()) {
+            future = it->second;
+        } else {
+            // Publish the future before compiling so concurrent requests wait instead of compiling twice
+            m_cache.emplace(_id, promise.get_future().share());
+        }
+    }
+
+    if (future.valid())
+        return future.get();
+
+    CompiledShader shader = createShaderModule(_id, m_compiler.getExternalSlot());
+    promise.set_value(shader);
+    return shader;
+}
+
+vector<ShaderModuleFuture> ShaderManager::requestShaderModules(const ShaderID* _ids, u32 _count, bool _retryOnError)
+{
+    JobSystem& jobSystem = globals::getRef<JobSystem>();
+
+    vector<ShaderModuleFuture> futures;
+    futures.reserve(_count);
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    for (u32 i = 0; i < _count; ++i) {
+        auto it = m_cache.find(_ids[i]);
+        bool failed = it != m_cache.end() && _retryOnError
+            && it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !it->second.get().m_module;
+        if (it == m_cache.end() || failed) {
+            auto promise = std::make_shared<std::promise<CompiledShader>>();
+            it = m_cache.insert_or_assign(_ids[i], promise->get_future().share()).first;
+            jobSystem.run([this, id = _ids[i], promise, _retryOnError](u32 _threadIndex) {
+                promise->set_value(createShaderModule(id, _threadIndex, _retryOnError));
+            }, nullptr, JobPriority::Background);
+        }
+        futures.push_back(it->second);
+    }
+    return futures;
+}
+
+void ShaderManager::benchmarkCompilation(u32 _permutationCount)
+{
+    JobSystem& jobSystem = globals::getRef<JobSystem>();
+
+    // Each permutation gets a unique define, the defines must outlive the ShaderIDs pointing at them
+    vector<std::string> defines(_permutationCount);
+    vector<ShaderID> ids;
+    ids.reserve(_permutationCount);
+    for (u32 i = 0; i < _permutationCount; ++i) {
+        defines[i] = fmt::format("BENCH_PERMUTATION_{}", i);
+        ids.emplace_back("depth_pass.hlsl", i % 2 ? ShaderType::ps : ShaderType::vs, i % 2 ? "ps_main" : "vs_main");
+        ids.back().addDefine(defines[i].c_str());
+    }
+
+    ShaderCompileOptions options;
+    options.m_useDiskCache = false;
+    u32 callerIndex = jobSystem.getCurrentThreadIndex();
+    u32 callerSlot = callerIndex != ~0u ? callerIndex : m_compiler.getExternalSlot();
+
+    double singleThreadMs = 0.0;
+    for (u32 threads : { 1u, jobSystem.getThreadCount() }) {
+        auto start = std::chrono::steady_clock::now();
+        if (threads == 1) {
+            for (const ShaderID& id : ids)
+                m_compiler.compileShader(id, callerSlot, options);
+        } else {
+            jobSystem.parallelFor(_permutationCount, 1, [&](u32 _index, u32 _threadIndex) {
+                m_compiler.compileShader(ids[_index], _threadIndex, options);
+            });
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        double ms = elapsed.count();
+        if (threads == 1)
+            singleThreadMs = ms;
+
+        logInfo("Compiled {} shaders on {} threads in {:.2f} ms, {:.2f}x speedup", _permutationCount, threads, ms, singleThreadMs / ms);
+    }
+}
+
+bool ShaderManager::update()
+{
+    if (m_watcher) {
+        vector<std::string> changedFiles = m_watcher->consumeChanges();
+        if (!changedFiles.empty())
+            queueReloads(changedFiles);
+    }
+    return applyReloads();
+}
+
+void ShaderManager::queueReloads(const vector<std::string>& _changedFiles)
+{
+    std::unordered_set<ShaderID> affected;
+    {
+        std::lock_guard<std::mutex> lock(m_dependencyMutex);
+        for (const std::string& file : _changedFiles) {
+            auto it = m_dependents.find(normalizeShaderPath(file));
+            if (it != m_dependents.end())
+                affected.insert(it->second.begin(), it->second.end());
+        }
+    }
+
+    JobSystem& jobSystem = globals::getRef<JobSystem>();
+    for (const ShaderID& id : affected) {
+        logInfo("Reloading {} {}", id.m_name, id.m_entryPoint);
+
+        // Only the newest request for a shader is applied, whatever order the compilations finish in
+        u64 requestIndex = ++m_reloadRequestCount;
+        m_latestReloadRequest.insert_or_assign(id, requestIndex);
+
+        jobSystem.run([this, id, requestIndex](u32 _threadIndex) {
+            // Errors keep the previous module so a typo doesn't take the shader down
+            CompiledShader shader = createShaderModule(id, _threadIndex, false);
+            if (shader.m_module) {
+                std::lock_guard<std::mutex> lock(m_reloadMutex);
+                m_reloadedShaders.push_back({ id, shader, requestIndex });
+            }
+        }, &m_reloadsInFlight, JobPriority::Background);
+    }
+}
+
+bool ShaderManager::applyReloads()
+{
+    vector<ReloadedShader> reloaded;
+    {
+        std::lock_guard<std::mutex> lock(m_reloadMutex);
+        reloaded.swap(m_reloadedShaders);
+    }
+
+    bool anyApplied = false;
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    for (const ReloadedShader& shader : reloaded) {
+        if (m_latestReloadRequest[shader.m_id] != shader.m_requestIndex)
+            continue;
+
+        std::promise<CompiledShader> promise;
+        promise.set_value(shader.m_shader);
+        m_cache.insert_or_assign(shader.m_id, promise.get_future().share());
+        anyApplied = true;
     }
-    return it->second;
+    return anyApplied;
 }
 
 ShaderManager::ShaderManager()
+    : m_compiler(globals::getRef<JobSystem>().getThreadCount())
 {
     m_cache.reserve(256);
+    m_modulesByCode.reserve(256);
+
+#ifdef DEVELOPMENT_MODE
+    if (globals::getRef<Settings>().m_shaderHotReload)
+        m_watcher = std::make_unique<FileWatcher>(SHADERS_FOLDER);
+#endif
 }
 
 ShaderManager::~ShaderManager()
 {
+    m_watcher.reset();
+
+    // Jobs still compiling reference this
+    globals::getRef<JobSystem>().wait(m_reloadsInFlight);
+    for (auto& pair : m_cache)
+        pair.second.wait();
+
+    // Replaced modules are never destroyed before this point, other ShaderIDs may share them
+    if (globals::getRef<Driver>().isNull())
+        return;
     auto device = globals::getRef<Driver>().getDriverObjects().m_device;
-    for (auto pair : m_cache)
-        device.destroyShaderModule(pair.second);
+    for (auto& pair : m_modulesByCode)
+        device.destroyShaderModule(pair.second.m_module);
 }
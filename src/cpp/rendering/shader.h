@@ -2,6 +2,15 @@
 
 #include "platform/vk_common.h"
 #include "core/hash.h"
+#include "core/flathashmap.h"
+#include "core/job_system.h"
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <unordered_set>
+
+class FileWatcher;
 
 enum class ShaderType : u8
 {
@@ -19,10 +28,18 @@ struct ShaderID
 
     void addDefine(LiteralString _define) { m_defines.push_back(_define); }
 
+    // Compares contents, IDs built from literals and from interned strings loaded at runtime are interchangeable
     bool operator==(const ShaderID& _o) const
     {
-        return m_name == _o.m_name && m_entryPoint == _o.m_entryPoint // strcmp instead of ptr compare?
-            && m_type == _o.m_type && m_defines == _o.m_defines;
+        if (m_type != _o.m_type || m_defines.size() != _o.m_defines.size()
+            || strcmp(m_name, _o.m_name) || strcmp(m_entryPoint, _o.m_entryPoint))
+            return false;
+
+        for (size_t i = 0; i < m_defines.size(); ++i) {
+            if (strcmp(m_defines[i], _o.m_defines[i]))
+                return false;
+        }
+        return true;
     }
 
     LiteralString m_name;
@@ -38,13 +55,13 @@ struct hash<ShaderID> {
     std::size_t operator()(ShaderID const& s) const noexcept
     {
         std::size_t h = std::hash<u8> {}(toUnderlyingType(s.m_type));
-        hash_combine(h, (s.m_name)); // hash with content instead of ptr?
-        hash_combine(h, (s.m_entryPoint));
+        hash_combine(h, hash_literal_string(s.m_name));
+        hash_combine(h, hash_literal_string(s.m_entryPoint));
         //hash_combine_array(h, s.m_defines);
         // hash defines in an order-independent way
         std::size_t definesHash = 0;
         for (LiteralString def : s.m_defines) {
-            definesHash += std::hash<LiteralString> ()(def);
+            definesHash += hash_literal_string(def);
         }
         hash_combine(h, definesHash);
         return h;
@@ -52,28 +69,138 @@ struct hash<ShaderID> {
 };
 }
 
+using ArgsVector = SmallVector<const wchar_t*, 8>;
+
+struct ShaderCompileOptions
+{
+    bool m_useDiskCache = true;
+    // Break into the debugger on errors and compile again once resumed, otherwise errors return empty code
+    bool m_retryOnError = true;
+    // Receives the name of every file included while compiling, relative to the shaders folder
+    vector<std::string>* m_includes = nullptr;
+};
+
 class ShaderCompiler 
 {
 public:
-    ShaderCompiler();
+    // Up to _threadCount + 1 compilations can run concurrently: one per job system thread plus one
+    // shared by every thread outside it
+    ShaderCompiler(u32 _threadCount);
     ~ShaderCompiler();
 
-    vector<u32> compileShader(const ShaderID& _id);
+    // _threadIndex selects the DXC instances to use, it must be exclusive to the calling thread.
+    // Pass getExternalSlot() from threads outside the job system
+    vector<u32> compileShader(const ShaderID& _id, u32 _threadIndex, const ShaderCompileOptions& _options = {});
+    u32 getExternalSlot() const { return (u32)m_contexts.size() - 1; }
 
 private:
+    // DXC compiler and library are not thread-safe, each slot gets its own
+    struct DxcContext;
+
+    Hash128 computeCacheKey(const ShaderID& _id, const void* _preprocessed, size_t _size, const ArgsVector& _args) const;
+    std::string getCachePath(const Hash128& _key) const;
+    bool loadCachedShader(const Hash128& _key, vector<u32>& _code) const;
+    void storeCachedShader(const Hash128& _key, const vector<u32>& _code) const;
+
+    DxcContext& getContext(u32 _threadIndex);
+
     void* m_dxcDll;
+    vector<std::unique_ptr<DxcContext>> m_contexts;
+    std::mutex m_externalSlotMutex;
+    u64 m_compilerVersion = 0;
+    // Compiled SPIR-V keyed on the preprocessed source, empty disables the disk cache
+    std::string m_cacheDir;
+};
+
+// Resources a shader stage declares, extracted from its SPIR-V
+struct ShaderReflection
+{
+    struct Binding
+    {
+        u32 m_set;
+        u32 m_binding;
+        vk::DescriptorType m_type;
+        u32 m_count;
+    };
+
+    vk::ShaderStageFlagBits m_stage;
+    SmallVector<Binding, 16> m_bindings;
+    // 0 size when the stage has no push constants
+    u32 m_pushConstantOffset = 0;
+    u32 m_pushConstantSize = 0;
 };
 
+struct CompiledShader
+{
+    vk::ShaderModule m_module;
+    // Owned by the ShaderManager, shared by every ShaderID compiling to the same code
+    const ShaderReflection* m_reflection = nullptr;
+};
+
+using ShaderModuleFuture = std::shared_future<CompiledShader>;
+
 class ShaderManager 
 
 {
 public:
-    vk::ShaderModule getShaderModule(const ShaderID& _id);
+    // Compiles on the calling thread if nobody else has requested _id yet, otherwise waits for that compilation.
+    // Safe to call from any thread
+    CompiledShader getShaderModule(const ShaderID& _id);
+
+    // Queues every shader that isn't cached or in flight on the job system and returns immediately.
+    // Batch everything needed up front so compilation overlaps instead of running one shader at a time.
+    // Without _retryOnError a failed compile gives a null module, requests with it compile that shader again.
+    vector<ShaderModuleFuture> requestShaderModules(const ShaderID* _ids, u32 _count, bool _retryOnError = true);
+
+    // Starts background recompilation of the shaders affected by files edited since the last call and
+    // swaps in the ones that finished. Call once per frame, returns true if any shader module changed
+    bool update();
+
+    // Compiles _permutationCount distinct shaders on 1 thread then on every worker, bypassing all caches
+    void benchmarkCompilation(u32 _permutationCount);
 
     ShaderManager();
     ~ShaderManager();
 
+    ShaderManager(const ShaderManager&) = delete;
+    ShaderManager& operator=(const ShaderManager&) = delete;
+
 private:
+    struct ReloadedShader
+    {
+        ShaderID m_id;
+        CompiledShader m_shader;
+        u64 m_requestIndex;
+    };
+
+    struct ShaderModuleEntry
+    {
+        vk::ShaderModule m_module;
+        // Heap allocated so CompiledShader pointers survive rehashing
+        unique_ptr<ShaderReflection> m_reflection;
+    };
+
+    CompiledShader createShaderModule(const ShaderID& _id, u32 _threadIndex, bool _retryOnError = true);
+    void recordDependencies(const ShaderID& _id, const vector<std::string>& _includes);
+    void queueReloads(const vector<std::string>& _changedFiles);
+    bool applyReloads();
+
     ShaderCompiler m_compiler;
-    std::unordered_map<ShaderID, vk::ShaderModule> m_cache;
+
+    std::mutex m_cacheMutex;
+    std::unordered_map<ShaderID, ShaderModuleFuture> m_cache;
+    // Owns the modules, m_cache entries with identical bytecode point at the same one
+    std::mutex m_modulesMutex;
+    flat_hash_map<Hash128, ShaderModuleEntry> m_modulesByCode;
+
+    // Hot reload, only in development builds
+    unique_ptr<FileWatcher> m_watcher;
+    // Shaders to recompile when a file changes, including the shader's own source file
+    std::mutex m_dependencyMutex;
+    std::unordered_map<std::string, std::unordered_set<ShaderID>> m_dependents;
+    u64 m_reloadRequestCount = 0;
+    std::unordered_map<ShaderID, u64> m_latestReloadRequest;
+    JobCounter m_reloadsInFlight;
+    std::mutex m_reloadMutex;
+    vector<ReloadedShader> m_reloadedShaders;
 };
\ No newline at end of file
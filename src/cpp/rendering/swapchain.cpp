@@ -6,4 +6,7 @@
 #include "platform/dxgi/swapchain_dxgi.hpp"
 #else
 #include "platform/vulkan/swapchain_vulkan.hpp"
-#endif
\ No newline at end of file
+#endif
+
+#include "platform/headless/swapchain_headless.hpp"
+#include "platform/null/swapchain_null.hpp"
@@ -16,3 +16,6 @@ using Swapchain = Swapchain_DXGI;
 #include "platform/vulkan/swapchain_vulkan.h"
 using Swapchain = Swapchain_Vulkan;
 #endif
+
+#include "platform/headless/swapchain_headless.h"
+#include "platform/null/swapchain_null.h"
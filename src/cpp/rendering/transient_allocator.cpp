@@ -0,0 +1,239 @@
+#include "common.h"
+
+#include "transient_allocator.h"
+#include "driver.h"
+#include "deferred_release.h"
+#include "globals.h"
+#include "core/cpu_profiler.h"
+#include <algorithm>
+
+// Layouts of declarations that stopped showing up, e.g. from before a resize, are released after this many frames
+static constexpr u64 C_LayoutRetireFrames = 120;
+
+static constexpr double C_MiB = 1024.0 * 1024.0;
+
+static u64 alignUp(u64 _value, u64 _alignment)
+{
+    return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+static vk::ImageAspectFlags getAspectMask(vk::Format _format)
+{
+    switch (_format) {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eD32Sfloat:
+    case vk::Format::eX8D24UnormPack32:
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+        // Views of depth stencil images only ever sample depth
+        return vk::ImageAspectFlagBits::eDepth;
+    default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+TransientImageAllocator::~TransientImageAllocator()
+{
+    if (m_peakUnaliasedBytes) {
+        logInfo("Transient images peaked at {:.1f} MiB with aliasing, {:.1f} MiB without",
+            m_peakAliasedBytes / C_MiB, m_peakUnaliasedBytes / C_MiB);
+    }
+
+    for (auto& pair : m_layouts)
+        retireLayout(*pair.second);
+}
+
+void TransientImageAllocator::beginFrame(u64 _frameNum)
+{
+    m_frameNum = _frameNum;
+    m_declarations.clear();
+    m_currentLayout = nullptr;
+
+    for (auto it = m_layouts.begin(); it != m_layouts.end();) {
+        if (it->second->m_lastUsedFrame + C_LayoutRetireFrames < _frameNum) {
+            retireLayout(*it->second);
+            it = m_layouts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+TransientImageHandle TransientImageAllocator::declareImage(const TransientImageDesc& _desc, u32 _firstPass, u32 _lastPass)
+{
+    ASSERT_TRUE(!m_currentLayout && _firstPass <= _lastPass);
+    m_declarations.push_back({ _desc, _firstPass, _lastPass });
+    return (TransientImageHandle)m_declarations.size() - 1;
+}
+
+void TransientImageAllocator::allocate()
+{
+    PROFILE_SCOPE("TransientImageAllocator::allocate");
+
+    Hash128 key = hashDeclarations();
+    auto it = m_layouts.find(key);
+    if (it == m_layouts.end())
+        it = m_layouts.emplace(key, createLayout()).first;
+
+    m_currentLayout = it->second.get();
+    m_currentLayout->m_lastUsedFrame = m_frameNum;
+}
+
+bool TransientImageAllocator::aliases(TransientImageHandle _a, TransientImageHandle _b) const
+{
+    const Placement& a = m_currentLayout->m_placements[_a];
+    const Placement& b = m_currentLayout->m_placements[_b];
+    return a.m_block == b.m_block && a.m_offset < b.m_offset + b.m_size && b.m_offset < a.m_offset + a.m_size;
+}
+
+Hash128 TransientImageAllocator::hashDeclarations() const
+{
+    vector<u32> key;
+    key.reserve(m_declarations.size() * 8);
+    for (const Declaration& declaration : m_declarations) {
+        const TransientImageDesc& desc = declaration.m_desc;
+        key.insert(key.end(), { (u32)desc.m_format, desc.m_dims.x, desc.m_dims.y, (u32)desc.m_usage, desc.m_mipCount,
+            (u32)desc.m_samples, declaration.m_firstPass, declaration.m_lastPass });
+    }
+    return hash128(key.data(), key.size() * sizeof(u32));
+}
+
+unique_ptr<TransientImageAllocator::Layout> TransientImageAllocator::createLayout()
+{
+    vk::Device device = globals::getRef<Driver>().getDriverObjects().m_device;
+    GpuAllocator& allocator = globals::getRef<Driver>().getGpuAllocator();
+
+    unique_ptr<Layout> layout = std::make_unique<Layout>();
+    u32 imageCount = (u32)m_declarations.size();
+
+    // The null backend has no device, the images stay null and nothing is placed or aliased
+    if (globals::getRef<Driver>().isNull()) {
+        layout->m_images.resize(imageCount);
+        layout->m_views.resize(imageCount);
+        layout->m_placements.resize(imageCount);
+        layout->m_stats.m_imageCount = imageCount;
+        return layout;
+    }
+
+    vector<vk::MemoryRequirements> requirements(imageCount);
+
+    for (u32 i = 0; i < imageCount; ++i) {
+        const TransientImageDesc& desc = m_declarations[i].m_desc;
+        vk::ImageCreateInfo imageinfo;
+        imageinfo.setImageType(vk::ImageType::e2D);
+        imageinfo.setFormat(desc.m_format);
+        imageinfo.setExtent({ desc.m_dims.x, desc.m_dims.y, 1 });
+        imageinfo.setMipLevels(desc.m_mipCount);
+        imageinfo.setArrayLayers(1);
+        imageinfo.setSamples(desc.m_samples);
+        imageinfo.setUsage(desc.m_usage);
+        layout->m_images.push_back(device.createImage(imageinfo).value);
+        requirements[i] = device.getImageMemoryRequirements(layout->m_images[i]);
+        layout->m_stats.m_unaliasedBytes += requirements[i].size;
+    }
+
+    struct Block
+    {
+        u32 m_memoryTypeBits;
+        u64 m_size;
+        u64 m_alignment;
+    };
+    vector<Block> blocks;
+    vector<Placement>& placements = layout->m_placements;
+    placements.resize(imageCount);
+
+    // Largest first, each image goes to the lowest offset not used by a placed image whose lifetime overlaps
+    vector<u32> order(imageCount);
+    for (u32 i = 0; i < imageCount; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](u32 _a, u32 _b) { return requirements[_a].size > requirements[_b].size; });
+
+    vector<u32> placed;
+    vector<std::pair<u64, u64>> usedRanges;
+    for (u32 image : order) {
+        const vk::MemoryRequirements& req = requirements[image];
+        const Declaration& declaration = m_declarations[image];
+
+        u32 blockIndex = 0;
+        while (blockIndex < blocks.size() && !(blocks[blockIndex].m_memoryTypeBits & req.memoryTypeBits))
+            ++blockIndex;
+        if (blockIndex == blocks.size())
+            blocks.push_back({ req.memoryTypeBits, 0, 1 });
+
+        usedRanges.clear();
+        for (u32 other : placed) {
+            const Declaration& otherDeclaration = m_declarations[other];
+            bool overlaps = declaration.m_firstPass <= otherDeclaration.m_lastPass
+                && otherDeclaration.m_firstPass <= declaration.m_lastPass;
+            if (overlaps && placements[other].m_block == blockIndex) {
+                u64 begin = placements[other].m_offset;
+                usedRanges.push_back({ begin, begin + requirements[other].size });
+            }
+        }
+        std::sort(usedRanges.begin(), usedRanges.end());
+
+        u64 offset = 0;
+        for (const std::pair<u64, u64>& range : usedRanges) {
+            if (alignUp(offset, req.alignment) + req.size <= range.first)
+                break;
+            offset = max(offset, range.second);
+        }
+        offset = alignUp(offset, req.alignment);
+
+        Block& block = blocks[blockIndex];
+        block.m_memoryTypeBits &= req.memoryTypeBits;
+        block.m_size = max(block.m_size, offset + req.size);
+        block.m_alignment = max(block.m_alignment, req.alignment);
+        placements[image] = { blockIndex, offset, req.size };
+        placed.push_back(image);
+    }
+
+    for (const Block& block : blocks) {
+        vk::MemoryRequirements blockRequirements;
+        blockRequirements.setSize(block.m_size);
+        blockRequirements.setAlignment(block.m_alignment);
+        blockRequirements.setMemoryTypeBits(block.m_memoryTypeBits);
+
+        VmaAllocation allocation = allocator.allocateMemory(blockRequirements, GpuMemoryPool::RenderTargets);
+        VERIFY_TRUE_MSG(allocation, "No gpu memory left for {:.1f} MiB of transient images", block.m_size / C_MiB);
+        layout->m_blocks.push_back(allocation);
+        layout->m_stats.m_aliasedBytes += block.m_size;
+    }
+
+    for (u32 i = 0; i < imageCount; ++i) {
+        allocator.bindImageMemory(layout->m_images[i], layout->m_blocks[placements[i].m_block], placements[i].m_offset);
+
+        const TransientImageDesc& desc = m_declarations[i].m_desc;
+        vk::ImageViewCreateInfo viewinfo;
+        viewinfo.setViewType(vk::ImageViewType::e2D);
+        viewinfo.setImage(layout->m_images[i]);
+        viewinfo.setFormat(desc.m_format);
+        vk::ImageSubresourceRange sr;
+        sr.setAspectMask(getAspectMask(desc.m_format));
+        sr.setLevelCount(desc.m_mipCount);
+        sr.setLayerCount(1);
+        viewinfo.setSubresourceRange(sr);
+        layout->m_views.push_back(device.createImageView(viewinfo).value);
+    }
+
+    layout->m_stats.m_imageCount = imageCount;
+    m_peakAliasedBytes = max(m_peakAliasedBytes, layout->m_stats.m_aliasedBytes);
+    m_peakUnaliasedBytes = max(m_peakUnaliasedBytes, layout->m_stats.m_unaliasedBytes);
+
+    logInfo("Transient images: {} images in {} blocks, {:.1f} MiB with aliasing, {:.1f} MiB without",
+        imageCount, blocks.size(), layout->m_stats.m_aliasedBytes / C_MiB, layout->m_stats.m_unaliasedBytes / C_MiB);
+    return layout;
+}
+
+void TransientImageAllocator::retireLayout(Layout& _layout)
+{
+    // Images go first, they are bound to the blocks
+    DeferredReleaseQueue& deferredRelease = globals::getRef<DeferredReleaseQueue>();
+    for (vk::ImageView view : _layout.m_views)
+        deferredRelease.retire(view, _layout.m_lastUsedFrame);
+    for (vk::Image image : _layout.m_images)
+        deferredRelease.retire(image, _layout.m_lastUsedFrame);
+    for (VmaAllocation block : _layout.m_blocks)
+        deferredRelease.retire(block, _layout.m_lastUsedFrame);
+}
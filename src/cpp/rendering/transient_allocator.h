@@ -0,0 +1,92 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include "core/hash.h"
+#include "core/flathashmap.h"
+
+struct TransientImageDesc
+{
+    vk::Format m_format = vk::Format::eUndefined;
+    uint2 m_dims = { 0, 0 };
+    vk::ImageUsageFlags m_usage;
+    u32 m_mipCount = 1;
+    vk::SampleCountFlagBits m_samples = vk::SampleCountFlagBits::e1;
+};
+
+using TransientImageHandle = u32;
+
+struct TransientMemoryStats
+{
+    u32 m_imageCount = 0;
+    // Memory the images need each in their own allocation, and placed in shared blocks
+    u64 m_unaliasedBytes = 0;
+    u64 m_aliasedBytes = 0;
+};
+
+// Images living for part of a frame, given as a range of pass indices. Images whose lifetimes don't overlap
+// share memory. A frame declaring the same images as an earlier one reuses its images and memory, so they
+// are shared by consecutive frames and passes must discard the previous contents on first use.
+class TransientImageAllocator
+{
+public:
+    TransientImageAllocator() = default;
+    ~TransientImageAllocator();
+
+    TransientImageAllocator(const TransientImageAllocator&) = delete;
+    TransientImageAllocator& operator=(const TransientImageAllocator&) = delete;
+
+    // Starts declaring the images of _frameNum, the handles of the previous frame are invalid from here
+    void beginFrame(u64 _frameNum);
+    // _firstPass and _lastPass are inclusive
+    TransientImageHandle declareImage(const TransientImageDesc& _desc, u32 _firstPass, u32 _lastPass);
+    // Creates or reuses the images of every declaration since beginFrame()
+    void allocate();
+
+    vk::Image getImage(TransientImageHandle _handle) const { return m_currentLayout->m_images[_handle]; }
+    vk::ImageView getImageView(TransientImageHandle _handle) const { return m_currentLayout->m_views[_handle]; }
+    // Whether the two images share memory, the later one has to wait for the accesses of the earlier one
+    bool aliases(TransientImageHandle _a, TransientImageHandle _b) const;
+
+    // Of the images allocated this frame
+    const TransientMemoryStats& getStats() const { return m_currentLayout->m_stats; }
+    u64 getPeakAliasedBytes() const { return m_peakAliasedBytes; }
+    u64 getPeakUnaliasedBytes() const { return m_peakUnaliasedBytes; }
+
+private:
+    struct Declaration
+    {
+        TransientImageDesc m_desc;
+        u32 m_firstPass;
+        u32 m_lastPass;
+    };
+
+    struct Placement
+    {
+        u32 m_block;
+        u64 m_offset;
+        u64 m_size;
+    };
+
+    // Images and memory for one set of declarations
+    struct Layout
+    {
+        vector<vk::Image> m_images;
+        vector<vk::ImageView> m_views;
+        vector<Placement> m_placements;
+        vector<VmaAllocation> m_blocks;
+        TransientMemoryStats m_stats;
+        u64 m_lastUsedFrame = 0;
+    };
+
+    vector<Declaration> m_declarations;
+    flat_hash_map<Hash128, unique_ptr<Layout>> m_layouts;
+    Layout* m_currentLayout = nullptr;
+    u64 m_frameNum = 0;
+    u64 m_peakAliasedBytes = 0;
+    u64 m_peakUnaliasedBytes = 0;
+
+    Hash128 hashDeclarations() const;
+    unique_ptr<Layout> createLayout();
+    void retireLayout(Layout& _layout);
+};
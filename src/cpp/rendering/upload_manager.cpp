@@ -0,0 +1,419 @@
+#include "common.h"
+
+#include "upload_manager.h"
+#include "cmd_context.h"
+#include "frame_capture.h"
+#include "driver.h"
+#include "globals.h"
+#include "settings.h"
+#include "core/cpu_profiler.h"
+#include <algorithm>
+#include <cstring>
+
+static constexpr double C_MiB = 1024.0 * 1024.0;
+
+static u64 alignUp(u64 _value, u64 _alignment)
+{
+    return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+static u64 getHandleKey(vk::Buffer _buffer)
+{
+    return (u64)static_cast<VkBuffer>(_buffer);
+}
+
+static u64 getHandleKey(vk::Image _image)
+{
+    return (u64)static_cast<VkImage>(_image);
+}
+
+static vk::ImageSubresourceRange getSubresourceRange(const vk::ImageSubresourceLayers& _layers)
+{
+    vk::ImageSubresourceRange sr;
+    sr.setAspectMask(_layers.aspectMask);
+    sr.setBaseMipLevel(_layers.mipLevel);
+    sr.setLevelCount(1);
+    sr.setBaseArrayLayer(_layers.baseArrayLayer);
+    sr.setLayerCount(_layers.layerCount);
+    return sr;
+}
+
+UploadManager::UploadManager()
+{
+    Driver& driver = globals::getRef<Driver>();
+    m_transferFamily = driver.getQueueFamily(QueueType::Transfer);
+    m_graphicsFamily = driver.getQueueFamily(QueueType::Graphics);
+
+    m_nullBackend = globals::getRef<Settings>().m_nullBackend;
+    if (m_nullBackend) {
+        logInfo("Upload manager: null backend, uploads are dropped");
+        return;
+    }
+
+    vk::BufferCreateInfo bufferinfo;
+    bufferinfo.setSize(C_StagingRingSize);
+    bufferinfo.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+
+    void* mappedData = nullptr;
+    m_ring = driver.getGpuAllocator().createBuffer(bufferinfo, GpuMemoryPool::StreamingUpload, &m_ringAllocation, &mappedData);
+    VERIFY_TRUE_MSG((bool)m_ring, "No memory left for the {:.1f} MiB staging ring", C_StagingRingSize / C_MiB);
+    m_ringData = (u8*)mappedData;
+
+    logInfo("Upload manager: {:.1f} MiB staging ring, {}", C_StagingRingSize / C_MiB,
+        needsOwnershipTransfer() ? "ownership transfers to the graphics family" : "transfer queue in the graphics family");
+}
+
+UploadManager::~UploadManager()
+{
+    if (m_nullBackend)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    submitPendingBatch();
+    if (m_lastSubmittedValue)
+        globals::getRef<Driver>().waitForTimelineValue(QueueType::Transfer, m_lastSubmittedValue);
+    retireCompletedBatches();
+    ASSERT_TRUE(m_submittedBatches.empty());
+
+    globals::getRef<Driver>().getGpuAllocator().destroyBuffer(m_ring, m_ringAllocation);
+}
+
+u64 UploadManager::uploadBuffer(vk::Buffer _dst, u64 _dstOffset, const void* _data, u64 _size)
+{
+    if (FrameCapture* capture = globals::getPtr<FrameCapture>())
+        capture->recordUpload(CaptureUploadType::Buffer, _size);
+    if (m_nullBackend)
+        return 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    u64 srcOffset = 0;
+    vk::Buffer src = stage(lock, _data, _size, &srcOffset);
+
+    Batch& batch = getPendingBatch();
+    batch.m_bufferCopies.push_back({ src, _dst, vk::BufferCopy(srcOffset, _dstOffset, _size) });
+    return batch.m_timelineValue;
+}
+
+u64 UploadManager::uploadImage(vk::Image _dst, const vk::BufferImageCopy& _region, const void* _data, u64 _size,
+    vk::ImageLayout _finalLayout)
+{
+    if (FrameCapture* capture = globals::getPtr<FrameCapture>())
+        capture->recordUpload(CaptureUploadType::Image, _size);
+    if (m_nullBackend)
+        return 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    u64 srcOffset = 0;
+    vk::Buffer src = stage(lock, _data, _size, &srcOffset);
+
+    vk::BufferImageCopy region = _region;
+    region.setBufferOffset(srcOffset);
+
+    Batch& batch = getPendingBatch();
+    batch.m_imageCopies.push_back({ src, _dst, region, _finalLayout });
+    return batch.m_timelineValue;
+}
+
+u64 UploadManager::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    submitPendingBatch();
+    return m_lastSubmittedValue;
+}
+
+void UploadManager::beginFrame()
+{
+    PROFILE_SCOPE("UploadManager::beginFrame");
+    if (m_nullBackend)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    submitPendingBatch();
+    retireCompletedBatches();
+
+    m_frameImageAcquires.clear();
+    m_frameBufferAcquires.clear();
+    m_frameImageAcquires.swap(m_completedImageAcquires);
+    m_frameBufferAcquires.swap(m_completedBufferAcquires);
+
+    // Even without ownership transfers the frame waits on the timeline, it makes the copies visible
+    m_frameWaitValue = m_lastCompletedValue > m_availableValue ? m_lastCompletedValue : 0;
+    m_availableValue = m_lastCompletedValue;
+}
+
+void UploadManager::recordAcquireBarriers(CmdContext& _ctx)
+{
+    if (m_frameImageAcquires.empty() && m_frameBufferAcquires.empty())
+        return;
+
+    vk::DependencyInfoKHR info;
+    info.setImageMemoryBarriers({ (u32)m_frameImageAcquires.size(), m_frameImageAcquires.data() });
+    info.setBufferMemoryBarriers({ (u32)m_frameBufferAcquires.size(), m_frameBufferAcquires.data() });
+    _ctx.pipelineBarrier(info);
+}
+
+UploadManager::Batch& UploadManager::getPendingBatch()
+{
+    if (!m_pendingBatch) {
+        if (!m_spareBatches.empty()) {
+            m_pendingBatch = std::move(m_spareBatches.back());
+            m_spareBatches.pop_back();
+        } else {
+            vk::Device device = globals::getRef<Driver>().getDriverObjects().m_device;
+            m_pendingBatch = std::make_unique<Batch>();
+
+            vk::CommandPoolCreateInfo poolinfo;
+            poolinfo.setQueueFamilyIndex(m_transferFamily);
+            poolinfo.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+            m_pendingBatch->m_cmdPool = device.createCommandPoolUnique(poolinfo).value;
+
+            vk::CommandBufferAllocateInfo allocateinfo;
+            allocateinfo.setCommandBufferCount(1);
+            allocateinfo.setCommandPool(m_pendingBatch->m_cmdPool.get());
+            allocateinfo.setLevel(vk::CommandBufferLevel::ePrimary);
+            m_pendingBatch->m_cmd = device.allocateCommandBuffers(allocateinfo).value[0];
+        }
+        // Nothing else submits to the transfer timeline, the batch signals the next value
+        m_pendingBatch->m_timelineValue = m_lastSubmittedValue + 1;
+    }
+    return *m_pendingBatch;
+}
+
+vk::Buffer UploadManager::stage(std::unique_lock<std::mutex>& _lock, const void* _data, u64 _size, u64* _offset)
+{
+    ASSERT_TRUE(_size);
+    if (_size > C_MaxRingUploadSize) {
+        vk::BufferCreateInfo bufferinfo;
+        bufferinfo.setSize(_size);
+        bufferinfo.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+
+        VmaAllocation allocation = nullptr;
+        void* mappedData = nullptr;
+        vk::Buffer buffer = globals::getRef<Driver>().getGpuAllocator().createBuffer(bufferinfo,
+            GpuMemoryPool::StreamingUpload, &allocation, &mappedData);
+        VERIFY_TRUE_MSG((bool)buffer, "No memory left to stage a {:.1f} MiB upload", _size / C_MiB);
+
+        memcpy(mappedData, _data, _size);
+        getPendingBatch().m_dedicatedStaging.push_back({ buffer, allocation });
+        *_offset = 0;
+        return buffer;
+    }
+
+    u64 offset = reserveRing(_lock, _size);
+    memcpy(m_ringData + offset, _data, _size);
+    *_offset = offset;
+    return m_ring;
+}
+
+u64 UploadManager::reserveRing(std::unique_lock<std::mutex>& _lock, u64 _size)
+{
+    for (;;) {
+        // Allocations don't wrap around, the end of the ring is skipped instead
+        u64 position = alignUp(m_ringHead, C_StagingAlignment);
+        if (position % C_StagingRingSize + _size > C_StagingRingSize)
+            position = alignUp(position, C_StagingRingSize);
+
+        // Nothing in use, the tail can skip ahead too
+        if (m_ringTail == m_ringHead)
+            m_ringTail = position;
+
+        if (position + _size - m_ringTail <= C_StagingRingSize) {
+            m_ringHead = position + _size;
+            return position % C_StagingRingSize;
+        }
+
+        // The ring is full, the oldest batch has to finish. Other threads can record and flush meanwhile.
+        if (m_submittedBatches.empty())
+            submitPendingBatch();
+        ASSERT_TRUE(!m_submittedBatches.empty());
+        u64 value = m_submittedBatches.front()->m_timelineValue;
+
+        _lock.unlock();
+        {
+            PROFILE_SCOPE("UploadManager::waitForStaging");
+            globals::getRef<Driver>().waitForTimelineValue(QueueType::Transfer, value);
+        }
+        _lock.lock();
+        retireCompletedBatches();
+    }
+}
+
+void UploadManager::submitPendingBatch()
+{
+    if (!m_pendingBatch || (m_pendingBatch->m_bufferCopies.empty() && m_pendingBatch->m_imageCopies.empty()))
+        return;
+
+    PROFILE_SCOPE("UploadManager::submit");
+    Batch& batch = *m_pendingBatch;
+    batch.m_ringEnd = m_ringHead;
+    recordBatch(batch);
+
+    QueueSubmission submission;
+    submission.m_cmdBuffers.push_back(batch.m_cmd);
+    u64 value = globals::getRef<Driver>().submit(QueueType::Transfer, submission);
+    ASSERT_TRUE_MSG(value == batch.m_timelineValue, "Upload batch signaled {} instead of {}", value, batch.m_timelineValue);
+
+    m_lastSubmittedValue = value;
+    m_submittedBatches.push_back(std::move(m_pendingBatch));
+}
+
+void UploadManager::recordBatch(Batch& _batch)
+{
+    const vk::DispatchLoaderDynamic& loader = globals::getRef<Driver>().getLoader();
+    vk::CommandBuffer cmd = _batch.m_cmd;
+
+    vk::CommandBufferBeginInfo cmdBeginInfo;
+    cmdBeginInfo.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    VK_CHECK(cmd.begin(cmdBeginInfo));
+
+    // Sorted so copies between the same buffers, or from the same buffer to the same image, become one command
+    std::sort(_batch.m_bufferCopies.begin(), _batch.m_bufferCopies.end(), [](const BufferCopy& _a, const BufferCopy& _b) {
+        if (_a.m_src != _b.m_src)
+            return getHandleKey(_a.m_src) < getHandleKey(_b.m_src);
+        return getHandleKey(_a.m_dst) < getHandleKey(_b.m_dst);
+    });
+    std::sort(_batch.m_imageCopies.begin(), _batch.m_imageCopies.end(), [](const ImageCopy& _a, const ImageCopy& _b) {
+        if (_a.m_dst != _b.m_dst)
+            return getHandleKey(_a.m_dst) < getHandleKey(_b.m_dst);
+        return getHandleKey(_a.m_src) < getHandleKey(_b.m_src);
+    });
+
+    vector<vk::ImageMemoryBarrier2KHR> imageBarriers;
+    for (const ImageCopy& copy : _batch.m_imageCopies) {
+        vk::ImageMemoryBarrier2KHR& barrier = imageBarriers.emplace_back();
+        barrier.setDstStageMask(vk::PipelineStageFlagBits2KHR::eTransfer);
+        barrier.setDstAccessMask(vk::AccessFlagBits2KHR::eTransferWrite);
+        barrier.setOldLayout(vk::ImageLayout::eUndefined);
+        barrier.setNewLayout(vk::ImageLayout::eTransferDstOptimal);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setImage(copy.m_dst);
+        barrier.setSubresourceRange(getSubresourceRange(copy.m_region.imageSubresource));
+    }
+    if (!imageBarriers.empty()) {
+        vk::DependencyInfoKHR info;
+        info.setImageMemoryBarriers({ (u32)imageBarriers.size(), imageBarriers.data() });
+        cmd.pipelineBarrier2KHR(info, loader);
+    }
+
+    vector<vk::BufferCopy> bufferRegions;
+    for (u32 i = 0; i < _batch.m_bufferCopies.size();) {
+        const BufferCopy& first = _batch.m_bufferCopies[i];
+        bufferRegions.clear();
+        for (; i < _batch.m_bufferCopies.size(); ++i) {
+            const BufferCopy& copy = _batch.m_bufferCopies[i];
+            if (copy.m_src != first.m_src || copy.m_dst != first.m_dst)
+                break;
+            bufferRegions.push_back(copy.m_region);
+        }
+        cmd.copyBuffer(first.m_src, first.m_dst, { (u32)bufferRegions.size(), bufferRegions.data() });
+    }
+
+    vector<vk::BufferImageCopy> imageRegions;
+    for (u32 i = 0; i < _batch.m_imageCopies.size();) {
+        const ImageCopy& first = _batch.m_imageCopies[i];
+        imageRegions.clear();
+        for (; i < _batch.m_imageCopies.size(); ++i) {
+            const ImageCopy& copy = _batch.m_imageCopies[i];
+            if (copy.m_src != first.m_src || copy.m_dst != first.m_dst)
+                break;
+            imageRegions.push_back(copy.m_region);
+        }
+        cmd.copyBufferToImage(first.m_src, first.m_dst, vk::ImageLayout::eTransferDstOptimal,
+            { (u32)imageRegions.size(), imageRegions.data() });
+    }
+
+    // Transitions to the final layouts. With another family they double as the release, the matching
+    // acquire is recorded by the graphics queue once the batch completed and waited on with the timeline.
+    bool transferOwnership = needsOwnershipTransfer();
+    u32 srcFamily = transferOwnership ? m_transferFamily : VK_QUEUE_FAMILY_IGNORED;
+    u32 dstFamily = transferOwnership ? m_graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+
+    imageBarriers.clear();
+    for (const ImageCopy& copy : _batch.m_imageCopies) {
+        vk::ImageMemoryBarrier2KHR& barrier = imageBarriers.emplace_back();
+        barrier.setSrcStageMask(vk::PipelineStageFlagBits2KHR::eTransfer);
+        barrier.setSrcAccessMask(vk::AccessFlagBits2KHR::eTransferWrite);
+        if (!transferOwnership)
+            barrier.setDstStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+        barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal);
+        barrier.setNewLayout(copy.m_finalLayout);
+        barrier.setSrcQueueFamilyIndex(srcFamily);
+        barrier.setDstQueueFamilyIndex(dstFamily);
+        barrier.setImage(copy.m_dst);
+        barrier.setSubresourceRange(getSubresourceRange(copy.m_region.imageSubresource));
+
+        if (transferOwnership) {
+            vk::ImageMemoryBarrier2KHR acquire = barrier;
+            acquire.setSrcStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+            acquire.setSrcAccessMask({});
+            acquire.setDstStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+            acquire.setDstAccessMask(vk::AccessFlagBits2KHR::eMemoryRead | vk::AccessFlagBits2KHR::eMemoryWrite);
+            _batch.m_imageAcquires.push_back(acquire);
+        }
+    }
+
+    // Buffers keep their layout, only the ownership changes. Whole buffers, release and acquire have to match.
+    vector<vk::BufferMemoryBarrier2KHR> bufferBarriers;
+    if (transferOwnership) {
+        for (u32 i = 0; i < _batch.m_bufferCopies.size(); ++i) {
+            vk::Buffer dst = _batch.m_bufferCopies[i].m_dst;
+            bool released = std::any_of(bufferBarriers.begin(), bufferBarriers.end(),
+                [&](const vk::BufferMemoryBarrier2KHR& _barrier) { return _barrier.buffer == dst; });
+            if (released)
+                continue;
+
+            vk::BufferMemoryBarrier2KHR& barrier = bufferBarriers.emplace_back();
+            barrier.setSrcStageMask(vk::PipelineStageFlagBits2KHR::eTransfer);
+            barrier.setSrcAccessMask(vk::AccessFlagBits2KHR::eTransferWrite);
+            barrier.setSrcQueueFamilyIndex(srcFamily);
+            barrier.setDstQueueFamilyIndex(dstFamily);
+            barrier.setBuffer(dst);
+            barrier.setSize(VK_WHOLE_SIZE);
+
+            vk::BufferMemoryBarrier2KHR acquire = barrier;
+            acquire.setSrcStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+            acquire.setSrcAccessMask({});
+            acquire.setDstStageMask(vk::PipelineStageFlagBits2KHR::eAllCommands);
+            acquire.setDstAccessMask(vk::AccessFlagBits2KHR::eMemoryRead | vk::AccessFlagBits2KHR::eMemoryWrite);
+            _batch.m_bufferAcquires.push_back(acquire);
+        }
+    }
+
+    if (!imageBarriers.empty() || !bufferBarriers.empty()) {
+        vk::DependencyInfoKHR info;
+        info.setImageMemoryBarriers({ (u32)imageBarriers.size(), imageBarriers.data() });
+        info.setBufferMemoryBarriers({ (u32)bufferBarriers.size(), bufferBarriers.data() });
+        cmd.pipelineBarrier2KHR(info, loader);
+    }
+
+    VK_CHECK(cmd.end());
+}
+
+void UploadManager::retireCompletedBatches()
+{
+    Driver& driver = globals::getRef<Driver>();
+    vk::Device device = driver.getDriverObjects().m_device;
+    u64 completedValue = driver.getCompletedTimelineValue(QueueType::Transfer);
+
+    while (!m_submittedBatches.empty() && m_submittedBatches.front()->m_timelineValue <= completedValue) {
+        unique_ptr<Batch> batch = std::move(m_submittedBatches.front());
+        m_submittedBatches.pop_front();
+
+        m_completedImageAcquires.insert(m_completedImageAcquires.end(), batch->m_imageAcquires.begin(), batch->m_imageAcquires.end());
+        m_completedBufferAcquires.insert(m_completedBufferAcquires.end(), batch->m_bufferAcquires.begin(), batch->m_bufferAcquires.end());
+        for (const std::pair<vk::Buffer, VmaAllocation>& staging : batch->m_dedicatedStaging)
+            driver.getGpuAllocator().destroyBuffer(staging.first, staging.second);
+
+        m_ringTail = batch->m_ringEnd;
+        m_lastCompletedValue = batch->m_timelineValue;
+
+        device.resetCommandPool(batch->m_cmdPool.get());
+        batch->m_bufferCopies.clear();
+        batch->m_imageCopies.clear();
+        batch->m_dedicatedStaging.clear();
+        batch->m_imageAcquires.clear();
+        batch->m_bufferAcquires.clear();
+        m_spareBatches.push_back(std::move(batch));
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "platform/vk_common.h"
+#include "vma/vk_mem_alloc.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+class CmdContext;
+
+// Streams buffer and image data to the gpu through a persistently mapped staging ring. Copies are batched and
+// submitted on the transfer queue, uploads return the QueueType::Transfer timeline value their batch signals.
+// With a dedicated transfer family, the batch releases the destinations and the first frame starting after it
+// completed acquires them for the graphics family. Destinations are meant to be filled by uploads and only read
+// by the graphics queue. Thread-safe, uploads only block when the ring is full.
+// With the null backend nothing is staged or submitted, uploads return 0 and are available immediately.
+class UploadManager
+{
+public:
+    UploadManager();
+    // Waits for the uploads in flight
+    ~UploadManager();
+
+    UploadManager(const UploadManager&) = delete;
+    UploadManager& operator=(const UploadManager&) = delete;
+
+    // _data is copied before returning
+    u64 uploadBuffer(vk::Buffer _dst, u64 _dstOffset, const void* _data, u64 _size);
+    // The buffer offset of _region is ignored, its row length and image height describe _data. The subresources
+    // it covers start out undefined and are left in _finalLayout. Each subresource at most once per batch.
+    u64 uploadImage(vk::Image _dst, const vk::BufferImageCopy& _region, const void* _data, u64 _size,
+        vk::ImageLayout _finalLayout);
+    // Submits the copies recorded so far, returns the last timeline value submitted
+    u64 flush();
+
+    // Whether the graphics queue can use what uploads returning _value wrote, from the current frame on
+    bool isAvailable(u64 _value) const { return _value <= m_availableValue; }
+
+    // Frame boundary, render thread. Submits pending copies and collects the acquires of completed batches.
+    void beginFrame();
+    // Records the acquires collected by beginFrame(), first thing in the frame's command buffer
+    void recordAcquireBarriers(CmdContext& _ctx);
+    // Transfer timeline value the frame's submission waits for at every stage, 0 if there is nothing to acquire
+    u64 getFrameWaitValue() const { return m_frameWaitValue; }
+
+private:
+    static constexpr u64 C_StagingRingSize = 64ull * 1024 * 1024;
+    // Bigger uploads get their own staging buffer rather than taking over the ring
+    static constexpr u64 C_MaxRingUploadSize = C_StagingRingSize / 4;
+    // Satisfies the texel block and 4 byte alignment of buffer to image copies for every uncompressed format
+    static constexpr u64 C_StagingAlignment = 16;
+
+    struct BufferCopy
+    {
+        vk::Buffer m_src;
+        vk::Buffer m_dst;
+        vk::BufferCopy m_region;
+    };
+
+    struct ImageCopy
+    {
+        vk::Buffer m_src;
+        vk::Image m_dst;
+        vk::BufferImageCopy m_region;
+        vk::ImageLayout m_finalLayout;
+    };
+
+    struct Batch
+    {
+        u64 m_timelineValue = 0;
+        // Ring position up to which the staging memory is free once the batch completes
+        u64 m_ringEnd = 0;
+        UniqueHandle<vk::CommandPool> m_cmdPool;
+        vk::CommandBuffer m_cmd;
+        vector<BufferCopy> m_bufferCopies;
+        vector<ImageCopy> m_imageCopies;
+        vector<std::pair<vk::Buffer, VmaAllocation>> m_dedicatedStaging;
+        vector<vk::ImageMemoryBarrier2KHR> m_imageAcquires;
+        vector<vk::BufferMemoryBarrier2KHR> m_bufferAcquires;
+    };
+
+    std::mutex m_mutex;
+    vk::Buffer m_ring;
+    VmaAllocation m_ringAllocation = nullptr;
+    u8* m_ringData = nullptr;
+    // Byte positions only ever grow, the offset in the ring is the position modulo its size
+    u64 m_ringHead = 0;
+    u64 m_ringTail = 0;
+
+    bool m_nullBackend = false;
+    u32 m_transferFamily = 0;
+    u32 m_graphicsFamily = 0;
+
+    unique_ptr<Batch> m_pendingBatch;
+    std::deque<unique_ptr<Batch>> m_submittedBatches;
+    vector<unique_ptr<Batch>> m_spareBatches;
+    u64 m_lastSubmittedValue = 0;
+    // Acquires of completed batches, waiting for the next frame
+    vector<vk::ImageMemoryBarrier2KHR> m_completedImageAcquires;
+    vector<vk::BufferMemoryBarrier2KHR> m_completedBufferAcquires;
+    u64 m_lastCompletedValue = 0;
+
+    // Render thread only
+    vector<vk::ImageMemoryBarrier2KHR> m_frameImageAcquires;
+    vector<vk::BufferMemoryBarrier2KHR> m_frameBufferAcquires;
+    u64 m_frameWaitValue = 0;
+    std::atomic<u64> m_availableValue = 0;
+
+    bool needsOwnershipTransfer() const { return m_transferFamily != m_graphicsFamily; }
+    Batch& getPendingBatch();
+    // Copies _data to staging memory of the pending batch, the lock may be released while waiting for space
+    vk::Buffer stage(std::unique_lock<std::mutex>& _lock, const void* _data, u64 _size, u64* _offset);
+    u64 reserveRing(std::unique_lock<std::mutex>& _lock, u64 _size);
+    void submitPendingBatch();
+    void recordBatch(Batch& _batch);
+    void retireCompletedBatches();
+};
@@ -0,0 +1,17 @@
+#include "common.h"
+
+#pragma warning( push, 0 )
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wall"
+#pragma GCC diagnostic ignored "-Wextra"
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+#define VMA_IMPLEMENTATION
+#include "vma/vk_mem_alloc.h"
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+#pragma warning( pop )
@@ -0,0 +1,65 @@
+#include "common.h"
+
+#include "settings.h"
+#include <cstring>
+#include <cstdlib>
+
+void Settings::parseCommandLine(int _argc, char** _argv)
+{
+    for (int i = 1; i < _argc; ++i) {
+        LiteralString arg = _argv[i];
+        bool hasValue = i + 1 < _argc;
+
+        if (!strcmp(arg, "--headless")) {
+            m_headless = true;
+        } else if (!strcmp(arg, "--null-backend")) {
+            m_nullBackend = true;
+        } else if (!strcmp(arg, "--frames") && hasValue) {
+            m_frameCount = strtoull(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--width") && hasValue) {
+            m_dims.x = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--height") && hasValue) {
+            m_dims.y = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--draws") && hasValue) {
+            m_drawCount = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--pipeline-variants") && hasValue) {
+            m_pipelineVariantCount = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--bench-recording")) {
+            m_benchmarkRecording = true;
+        } else if (!strcmp(arg, "--bench-jobs")) {
+            m_benchmarkJobs = true;
+        } else if (!strcmp(arg, "--workers") && hasValue) {
+            m_workerCount = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--pin-threads")) {
+            m_pinThreads = true;
+        } else if (!strcmp(arg, "--bench-shaders") && hasValue) {
+            m_benchmarkShaderCount = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--trace-start") && hasValue) {
+            m_traceFirstFrame = strtoull(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--trace-frames") && hasValue) {
+            m_traceFrameCount = strtoull(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--trace-file") && hasValue) {
+            m_traceOutputPath = _argv[++i];
+        } else if (!strcmp(arg, "--pipeline-cache") && hasValue) {
+            m_pipelineCachePath = _argv[++i];
+        } else if (!strcmp(arg, "--shader-cache") && hasValue) {
+            m_shaderCachePath = _argv[++i];
+        } else if (!strcmp(arg, "--pso-manifest") && hasValue) {
+            m_psoManifestPath = _argv[++i];
+        } else if (!strcmp(arg, "--pso-warmup-progressive")) {
+            m_psoWarmUpProgressive = true;
+        } else if (!strcmp(arg, "--gpu-memory-stats") && hasValue) {
+            m_gpuMemoryStatsPath = _argv[++i];
+        } else if (!strcmp(arg, "--capture") && hasValue) {
+            m_capturePath = _argv[++i];
+        } else if (!strcmp(arg, "--replay") && hasValue) {
+            m_replayPath = _argv[++i];
+        } else if (!strcmp(arg, "--replay-loops") && hasValue) {
+            m_replayLoops = (u32)strtoul(_argv[++i], nullptr, 10);
+        } else if (!strcmp(arg, "--no-shader-reload")) {
+            m_shaderHotReload = false;
+        } else {
+            logError("Unknown command line argument: {}", arg);
+        }
+    }
+}
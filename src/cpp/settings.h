@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+
+struct Settings
+{
+    // Render into an offscreen image ring instead of a window surface
+    bool m_headless = false;
+    // Record frames into in-memory command logs instead of Vulkan command buffers and never submit anything, uploads
+    // included, to measure the cpu cost of building and recording frames. No Vulkan instance or device is created,
+    // shaders are still compiled but pipelines and resources are null or placeholder handles.
+    bool m_nullBackend = false;
+    // Exit after this many frames, 0 runs until the window is closed
+    u64 m_frameCount = 0;
+    uint2 m_dims = { 1280, 720 };
+    // Number of draws recorded every frame
+    u32 m_drawCount = 1;
+    // Pipelines the draws cycle through in emission order, each a define away from the first
+    u32 m_pipelineVariantCount = 1;
+    // Measure command recording time from 1 to N threads instead of running the main loop
+    bool m_benchmarkRecording = false;
+    // Measure job system scaling from 1 to N threads
+    bool m_benchmarkJobs = false;
+    // Measure compilation of this many shader permutations on 1 thread and on all workers, 0 disables
+    u32 m_benchmarkShaderCount = 0;
+    // Job system workers besides the main thread, 0 uses one per remaining hardware thread
+    u32 m_workerCount = 0;
+    // Bind each job system thread to its own core
+    bool m_pinThreads = false;
+    // Cpu profiler capture window, nothing is captured when m_traceFrameCount is 0
+    u64 m_traceFirstFrame = 0;
+    u64 m_traceFrameCount = 0;
+    std::string m_traceOutputPath = "eruption_trace.json";
+    std::string m_pipelineCachePath = "eruption_pipeline_cache.bin";
+    // Directory for compiled SPIR-V, empty disables the shader disk cache
+    std::string m_shaderCachePath = "shader_cache";
+    // Pipeline descriptions recorded by previous runs and created at startup, empty disables warm-up and recording
+    std::string m_psoManifestPath = "eruption_pso_manifest.bin";
+    // Create the warm-up pipelines in the background instead of before the first frame
+    bool m_psoWarmUpProgressive = false;
+    // Every frame rendered is captured to this file for eruption_replay, empty disables
+    std::string m_capturePath;
+    // Capture played back by eruption_replay, and how many times it is played
+    std::string m_replayPath;
+    u32 m_replayLoops = 1;
+    // Gpu memory budgets and vma's detailed statistics are written here on exit, empty disables
+    std::string m_gpuMemoryStatsPath;
+    // Recompile shaders edited while running, development builds only
+    bool m_shaderHotReload = true;
+
+    void parseCommandLine(int _argc, char** _argv);
+
+    // Benchmarks replace the main loop
+    bool isBenchmarking() const { return m_benchmarkRecording || m_benchmarkShaderCount || m_benchmarkJobs; }
+};
@@ -76,6 +76,7 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 
 void resizeCallback(GLFWwindow* _myWindow, int _width, int _height)
 {
+    // Can fire many times per frame while dragging, only the latest size is kept for the renderer to pick up
     Window* windowPtr = static_cast<Window*>(glfwGetWindowUserPointer(_myWindow));
     uint2 newDims = { (u32)_width, (u32)_height };
     windowPtr->setDims(newDims);
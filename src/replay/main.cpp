@@ -0,0 +1,95 @@
+#include "common.h"
+
+#include "settings.h"
+#include "window/window.h"
+#include "rendering/renderer.h"
+#include "rendering/frame_capture.h"
+#include "core/cpu_profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Plays a capture written with --capture as fast as possible through the renderer, then reports frame times.
+// Cpu times cover Renderer::RenderFrame, waits for the gpu included when it is the bottleneck.
+
+static void logFrameTimes(LiteralString _name, vector<double>& _ms)
+{
+    if (_ms.empty()) {
+        logInfo("{}: no frames timed", _name);
+        return;
+    }
+
+    std::sort(_ms.begin(), _ms.end());
+    double total = 0.0;
+    for (double ms : _ms)
+        total += ms;
+    size_t p99 = min(_ms.size() - 1, (size_t)std::ceil(_ms.size() * 0.99) - 1);
+
+    logInfo("{} over {} frames: min {:.3f} ms, avg {:.3f} ms, p99 {:.3f} ms", _name, _ms.size(), _ms.front(),
+        total / _ms.size(), _ms[p99]);
+}
+
+static int replay(const Settings& _settings)
+{
+    FrameReplay replay;
+    if (!replay.load(_settings.m_replayPath))
+        return 1;
+
+    Window* window = globals::getPtr<Window>();
+    Renderer* renderer = globals::getPtr<Renderer>();
+    CpuProfiler* cpuProfiler = globals::getPtr<CpuProfiler>();
+    renderer->setReplay(&replay);
+
+    u64 frameCount = (u64)replay.getFrameCount() * max(1u, _settings.m_replayLoops);
+    vector<double> cpuMs;
+    vector<double> gpuMs;
+    cpuMs.reserve(frameCount);
+    gpuMs.reserve(frameCount);
+    u64 readbackCount = renderer->getGpuProfiler().getReadbackCount();
+
+    for (u64 i = 0; i < frameCount && (!window || !window->shouldClose()); ++i) {
+        cpuProfiler->beginFrame(renderer->getFrameNum());
+        PROFILE_SCOPE("Frame");
+
+        if (window)
+            window->pollEvents();
+
+        auto start = std::chrono::steady_clock::now();
+        renderer->RenderFrame();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        cpuMs.push_back(elapsed.count());
+
+        // Gpu timings arrive FRAME_LATENCY frames later, the frames still in flight at the end aren't counted
+        const GpuProfiler& gpuProfiler = renderer->getGpuProfiler();
+        if (gpuProfiler.getReadbackCount() != readbackCount) {
+            readbackCount = gpuProfiler.getReadbackCount();
+            float ms = gpuProfiler.getScopeMs("frame");
+            if (ms >= 0.0f)
+                gpuMs.push_back(ms);
+        }
+    }
+
+    renderer->waitForGpuIdle();
+    renderer->setReplay(nullptr);
+
+    logInfo("Replayed {} frames of {} {} times", replay.getFrameCount(), _settings.m_replayPath,
+        max(1u, _settings.m_replayLoops));
+    logFrameTimes("Cpu frame time", cpuMs);
+    logFrameTimes("Gpu frame time", gpuMs);
+    return 0;
+}
+
+int main(int _argc, char** _argv)
+{
+    globals::init(_argc, _argv);
+
+    const Settings& settings = globals::getRef<Settings>();
+    int result = 1;
+    if (settings.m_replayPath.empty())
+        logError("Usage: eruption_replay --replay <capture> [--replay-loops <count>] [--headless | --null-backend]");
+    else
+        result = replay(settings);
+
+    globals::deinit();
+    return result;
+}